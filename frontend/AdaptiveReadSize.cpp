@@ -0,0 +1,60 @@
+#include "AdaptiveReadSize.h"
+#include <algorithm>
+
+namespace SmartMet
+{
+AdaptiveReadSize::AdaptiveReadSize(const Settings& theSettings)
+    : itsMinSize(std::max<std::size_t>(theSettings.minSize, 1)),
+      itsMaxSize(std::max(theSettings.maxSize, itsMinSize)),
+      itsSize(itsMinSize)
+{
+}
+
+std::size_t AdaptiveReadSize::next(std::size_t theRemaining) const
+{
+  if (theRemaining > 0)
+    return std::min(itsSize, theRemaining);
+  return itsSize;
+}
+
+void AdaptiveReadSize::update(std::size_t theRequested, std::size_t theReceived)
+{
+  if (theReceived >= theRequested && theRequested >= itsSize)
+  {
+    // The socket had at least as much data as we asked for, there is probably more
+    itsSize = std::min(itsSize * 2, itsMaxSize);
+  }
+  else if (theReceived < itsSize / 4)
+  {
+    // Data is arriving slowly, do not keep large buffers waiting for it
+    itsSize = std::max(itsSize / 2, itsMinSize);
+  }
+}
+
+ReceiveBufferBudget::ReceiveBufferBudget(const AdaptiveReadSize::Settings& theSettings)
+    : itsMinSize(theSettings.minSize), itsTotalSize(theSettings.totalSize)
+{
+}
+
+std::size_t ReceiveBufferBudget::reserve(std::size_t theSize)
+{
+  // The minimum size is always granted so that every stream can make progress
+  if (theSize > itsMinSize)
+  {
+    const auto used = itsUsed.fetch_add(theSize, std::memory_order_relaxed);
+    if (used + theSize <= itsTotalSize)
+      return theSize;
+    itsUsed.fetch_sub(theSize, std::memory_order_relaxed);
+    theSize = itsMinSize;
+  }
+
+  itsUsed.fetch_add(theSize, std::memory_order_relaxed);
+  return theSize;
+}
+
+void ReceiveBufferBudget::release(std::size_t theSize)
+{
+  itsUsed.fetch_sub(theSize, std::memory_order_relaxed);
+}
+
+}  // namespace SmartMet
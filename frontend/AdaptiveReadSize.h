@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace SmartMet
+{
+// Chooses the size of the next backend socket read. Small responses are read with small
+// buffers, while the read size doubles for as long as reads fill the whole buffer so that
+// bulk downloads need far fewer reads. The read size never exceeds the remaining
+// Content-Length.
+
+class AdaptiveReadSize
+{
+ public:
+  struct Settings
+  {
+    std::size_t minSize = 8192;         // initial read size
+    std::size_t maxSize = 1048576;      // read size limit per stream
+    std::size_t totalSize = 268435456;  // limit for all pending reads together
+  };
+
+  explicit AdaptiveReadSize(const Settings& theSettings);
+
+  // Size for the next read. theRemaining is the number of body bytes still expected,
+  // or zero if not known.
+  std::size_t next(std::size_t theRemaining) const;
+
+  // Adapt to the outcome of a read
+  void update(std::size_t theRequested, std::size_t theReceived);
+
+ private:
+  std::size_t itsMinSize;
+  std::size_t itsMaxSize;
+  std::size_t itsSize;
+};
+
+// Memory used by pending socket reads of all streams. Reads beyond the budget must use
+// the minimum size.
+
+class ReceiveBufferBudget
+{
+ public:
+  explicit ReceiveBufferBudget(const AdaptiveReadSize::Settings& theSettings);
+
+  // Reserve memory for a read of the given size. Returns the size reserved, which is the
+  // minimum read size if the budget would be exceeded.
+  std::size_t reserve(std::size_t theSize);
+  void release(std::size_t theSize);
+
+  std::size_t used() const { return itsUsed.load(std::memory_order_relaxed); }
+
+ private:
+  const std::size_t itsMinSize;
+  const std::size_t itsTotalSize;
+  std::atomic<std::size_t> itsUsed{0};
+};
+
+}  // namespace SmartMet
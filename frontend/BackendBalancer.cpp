@@ -0,0 +1,147 @@
+#include "BackendBalancer.h"
+#include <macgyver/Exception.h>
+#include <algorithm>
+
+namespace SmartMet
+{
+BackendBalancer::BackendBalancer(const Settings& theSettings)
+    : itsSettings(theSettings), itsStartTime(Fmi::MicrosecClock::universal_time())
+{
+}
+
+// Caller must hold the mutex
+double BackendBalancer::cost(const Key& theKey) const
+{
+  std::size_t inFlight = 0;
+  double firstByteTime = 0;
+
+  auto pos = itsBackends.find(theKey);
+  if (pos != itsBackends.end())
+  {
+    inFlight = pos->second.inFlight;
+    firstByteTime = pos->second.firstByteTime;
+  }
+
+  // A backend not measured yet is assumed to be average so that it gets its share
+  if (firstByteTime <= 0)
+  {
+    std::size_t count = 0;
+    double sum = 0;
+    for (const auto& backend : itsBackends)
+    {
+      if (backend.second.firstByteTime > 0)
+      {
+        sum += backend.second.firstByteTime;
+        ++count;
+      }
+    }
+    firstByteTime = (count > 0 ? sum / count : 1.0);
+  }
+
+  return static_cast<double>(inFlight + 1) * firstByteTime;
+}
+
+bool BackendBalancer::preferSecond(const std::string& theFirstHost,
+                                   int theFirstPort,
+                                   const std::string& theSecondHost,
+                                   int theSecondPort)
+{
+  try
+  {
+    const Key first(theFirstHost, theFirstPort);
+    const Key second(theSecondHost, theSecondPort);
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    const bool switched = (first != second && cost(second) < cost(first));
+    if (switched)
+      ++itsSecondChosen;
+    else
+      ++itsFirstChosen;
+    return switched;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void BackendBalancer::start(const std::string& theHostName, int thePort)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+    ++itsBackends[Key(theHostName, thePort)].inFlight;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void BackendBalancer::finish(const std::string& theHostName, int thePort)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    // The backend may have been retired while the request was running
+    auto pos = itsBackends.find(Key(theHostName, thePort));
+    if (pos != itsBackends.end() && pos->second.inFlight > 0)
+      --pos->second.inFlight;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void BackendBalancer::recordFirstByte(const std::string& theHostName,
+                                      int thePort,
+                                      Clock::duration theDelay)
+{
+  try
+  {
+    // Zero marks a backend not measured yet
+    const double ms =
+        std::max(0.001, std::chrono::duration<double, std::milli>(theDelay).count());
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    auto& backend = itsBackends[Key(theHostName, thePort)];
+    if (backend.firstByteTime <= 0)
+      backend.firstByteTime = ms;
+    else
+      backend.firstByteTime += itsSettings.smoothing * (ms - backend.firstByteTime);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void BackendBalancer::remove(const std::string& theHostName, int thePort)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+    itsBackends.erase(Key(theHostName, thePort));
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+Fmi::Cache::CacheStats BackendBalancer::getStats() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.size = itsBackends.size();
+  stats.hits = itsFirstChosen;
+  stats.misses = itsSecondChosen;
+  return stats;
+}
+
+}  // namespace SmartMet
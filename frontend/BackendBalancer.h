@@ -0,0 +1,83 @@
+#pragma once
+
+#include <macgyver/CacheStats.h>
+#include <macgyver/DateTime.h>
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace SmartMet
+{
+// Load aware backend selection (power of two choices). Sputnik picks a candidate backend
+// for the service, a second candidate is picked the same way, and the request goes to the
+// one expected to answer sooner: the one with the lower product of requests in flight and
+// the moving average of its time to first byte. Slow or overloaded backends therefore
+// receive proportionally less traffic, while comparing only two random candidates avoids
+// herding every request to the single least loaded backend.
+
+class BackendBalancer
+{
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Settings
+  {
+    bool enabled = false;
+    double smoothing = 0.2;  // weight of the newest time to first byte in the average
+  };
+
+  explicit BackendBalancer(const Settings& theSettings);
+
+  BackendBalancer(const BackendBalancer& other) = delete;
+  BackendBalancer(BackendBalancer&& other) = delete;
+  BackendBalancer& operator=(const BackendBalancer& other) = delete;
+  BackendBalancer& operator=(BackendBalancer&& other) = delete;
+
+  bool enabled() const { return itsSettings.enabled; }
+
+  // True if the second candidate should be used instead of the first one
+  bool preferSecond(const std::string& theFirstHost,
+                    int theFirstPort,
+                    const std::string& theSecondHost,
+                    int theSecondPort);
+
+  // A request to the backend started or practically finished
+  void start(const std::string& theHostName, int thePort);
+  void finish(const std::string& theHostName, int thePort);
+
+  // The response headers arrived after the given time
+  void recordFirstByte(const std::string& theHostName, int thePort, Clock::duration theDelay);
+
+  // Forget a retired backend
+  void remove(const std::string& theHostName, int thePort);
+
+  // Size is the number of known backends, hits are the selections keeping the first
+  // candidate and misses those switching to the second one
+  Fmi::Cache::CacheStats getStats() const;
+
+ private:
+  using Key = std::pair<std::string, int>;
+
+  struct Backend
+  {
+    std::size_t inFlight = 0;
+    double firstByteTime = 0;  // moving average in milliseconds, zero if not measured yet
+  };
+
+  double cost(const Key& theKey) const;
+
+  const Settings itsSettings;
+
+  mutable std::mutex itsMutex;
+  std::map<Key, Backend> itsBackends;
+
+  // Statistics
+  const Fmi::DateTime itsStartTime;
+  std::size_t itsFirstChosen = 0;
+  std::size_t itsSecondChosen = 0;
+};
+
+}  // namespace SmartMet
@@ -0,0 +1,279 @@
+#include "BackendConnectionPool.h"
+#include <fmt/format.h>
+#include <macgyver/Exception.h>
+#include <spine/Convenience.h>
+#include <cerrno>
+#include <iostream>
+#include <sys/socket.h>
+
+namespace SmartMet
+{
+namespace
+{
+// How often idle connections are checked for expiration
+const auto reaper_interval = std::chrono::seconds(1);
+}  // namespace
+
+BackendConnectionPool::BackendConnectionPool(boost::asio::io_context& theIoContext,
+                                             const Settings& theSettings)
+    : itsSettings(theSettings),
+      itsStartTime(Fmi::MicrosecClock::universal_time()),
+      itsReaperTimer(theIoContext)
+{
+  if (itsSettings.enabled)
+  {
+    std::cout << fmt::format(
+                     "Backend keep-alive connections enabled: max {} idle per backend, max idle "
+                     "time {} seconds, max age {} seconds",
+                     itsSettings.maxIdlePerBackend,
+                     itsSettings.maxIdleSeconds,
+                     itsSettings.maxAgeSeconds)
+              << std::endl;
+    scheduleReaper();
+  }
+}
+
+bool BackendConnectionPool::isExpired(const IdleConnection& theConnection,
+                                      Clock::time_point theNow) const
+{
+  return (theNow - theConnection.idleSince > std::chrono::seconds(itsSettings.maxIdleSeconds) ||
+          theNow - theConnection.created > std::chrono::seconds(itsSettings.maxAgeSeconds));
+}
+
+// A pooled connection is healthy if it is open and there is nothing to read from it.
+// EOF means the backend has closed its end, and any unsolicited data means the stream
+// is out of sync with the request/response framing. Neither can be reused.
+
+bool BackendConnectionPool::isHealthy(Socket& theSocket)
+{
+  if (!theSocket.is_open())
+    return false;
+
+  char byte = 0;
+  const auto n = ::recv(theSocket.native_handle(), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (n >= 0)
+    return false;
+
+  return (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+std::optional<BackendConnectionPool::Connection> BackendConnectionPool::acquire(
+    const std::string& theHostName, unsigned short thePort)
+{
+  try
+  {
+    if (!itsSettings.enabled)
+      return {};
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    auto pos = itsIdleConnections.find(Key(theHostName, thePort));
+    if (pos == itsIdleConnections.end())
+      return {};
+
+    auto& idle = pos->second;
+    const auto now = Clock::now();
+
+    // Most recently released connections are the most likely to still be alive
+    while (!idle.empty())
+    {
+      IdleConnection candidate = std::move(idle.back());
+      idle.pop_back();
+      --itsIdleCount;
+
+      if (isExpired(candidate, now) || !isHealthy(candidate.socket))
+      {
+        boost::system::error_code ignored_error;
+        candidate.socket.close(ignored_error);
+        continue;
+      }
+
+      ++itsReuseCount;
+      return Connection{std::move(candidate.socket), candidate.created};
+    }
+
+    itsIdleConnections.erase(pos);
+    return {};
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void BackendConnectionPool::release(const std::string& theHostName,
+                                    unsigned short thePort,
+                                    Connection&& theConnection)
+{
+  try
+  {
+    boost::system::error_code ignored_error;
+
+    const auto now = Clock::now();
+    if (!itsSettings.enabled || !theConnection.socket.is_open() ||
+        now - theConnection.created > std::chrono::seconds(itsSettings.maxAgeSeconds))
+    {
+      theConnection.socket.close(ignored_error);
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    if (itsShutdown)
+    {
+      theConnection.socket.close(ignored_error);
+      return;
+    }
+
+    auto& idle = itsIdleConnections[Key(theHostName, thePort)];
+
+    // Drop the oldest idle connection if the backend already has enough of them
+    if (idle.size() >= itsSettings.maxIdlePerBackend)
+    {
+      if (itsSettings.maxIdlePerBackend == 0)
+      {
+        theConnection.socket.close(ignored_error);
+        return;
+      }
+      idle.front().socket.close(ignored_error);
+      idle.pop_front();
+      --itsIdleCount;
+    }
+
+    idle.push_back(IdleConnection{std::move(theConnection.socket), theConnection.created, now});
+    ++itsIdleCount;
+    ++itsReleaseCount;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void BackendConnectionPool::evict(const std::string& theHostName, unsigned short thePort)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    auto pos = itsIdleConnections.find(Key(theHostName, thePort));
+    if (pos == itsIdleConnections.end())
+      return;
+
+    boost::system::error_code ignored_error;
+    for (auto& connection : pos->second)
+      connection.socket.close(ignored_error);
+
+    itsIdleCount -= pos->second.size();
+    itsIdleConnections.erase(pos);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void BackendConnectionPool::recordConnect()
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  ++itsConnectCount;
+}
+
+Fmi::Cache::CacheStats BackendConnectionPool::getStats() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  // Hits are reused connections, misses are new connections to the backends
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.maxsize = itsSettings.maxIdlePerBackend;
+  stats.size = itsIdleCount;
+  stats.inserts = itsReleaseCount;
+  stats.hits = itsReuseCount;
+  stats.misses = itsConnectCount;
+  return stats;
+}
+
+void BackendConnectionPool::scheduleReaper()
+{
+  itsReaperTimer.expires_after(reaper_interval);
+  itsReaperTimer.async_wait(
+      [this](const boost::system::error_code& err)
+      {
+        if (err == boost::asio::error::operation_aborted)
+          return;
+        if (reap())
+          scheduleReaper();
+      });
+}
+
+// Close idle connections which have expired. Done periodically so that connections
+// to quiet backends do not linger in CLOSE_WAIT after the backend has given up on them.
+// Returns false once the pool has been shut down.
+
+bool BackendConnectionPool::reap()
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    if (itsShutdown)
+      return false;
+
+    const auto now = Clock::now();
+    boost::system::error_code ignored_error;
+
+    for (auto pos = itsIdleConnections.begin(); pos != itsIdleConnections.end();)
+    {
+      auto& idle = pos->second;
+      for (auto it = idle.begin(); it != idle.end();)
+      {
+        if (isExpired(*it, now))
+        {
+          it->socket.close(ignored_error);
+          it = idle.erase(it);
+          --itsIdleCount;
+        }
+        else
+          ++it;
+      }
+
+      if (idle.empty())
+        pos = itsIdleConnections.erase(pos);
+      else
+        ++pos;
+    }
+  }
+  catch (...)
+  {
+    Fmi::Exception ex(BCP, "BackendConnectionPool::reap failed", nullptr);
+    ex.printError();
+    // Must not throw or execution will terminate
+  }
+  return true;
+}
+
+void BackendConnectionPool::shutdown()
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+    itsShutdown = true;
+
+    boost::system::error_code ignored_error;
+    itsReaperTimer.cancel();
+
+    for (auto& backend : itsIdleConnections)
+      for (auto& connection : backend.second)
+        connection.socket.close(ignored_error);
+
+    itsIdleConnections.clear();
+    itsIdleCount = 0;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace SmartMet
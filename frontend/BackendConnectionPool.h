@@ -0,0 +1,98 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <macgyver/CacheStats.h>
+#include <macgyver/DateTime.h>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace SmartMet
+{
+// Pool of idle HTTP/1.1 keep-alive connections to the backends, keyed by (host, port).
+// Connections are checked out by LowLatencyGatewayStreamer for the duration of one
+// request/response exchange and returned when the response has been fully framed.
+
+class BackendConnectionPool
+{
+ public:
+  using Socket = boost::asio::ip::tcp::socket;
+  using Clock = std::chrono::steady_clock;
+
+  struct Settings
+  {
+    bool enabled = false;
+    std::size_t maxIdlePerBackend = 8;  // idle connections kept per (host, port)
+    int maxIdleSeconds = 10;            // close connections idle longer than this
+    int maxAgeSeconds = 300;            // never reuse connections older than this
+  };
+
+  struct Connection
+  {
+    Socket socket;
+    Clock::time_point created;
+  };
+
+  BackendConnectionPool(boost::asio::io_context& theIoContext, const Settings& theSettings);
+
+  BackendConnectionPool(const BackendConnectionPool& other) = delete;
+  BackendConnectionPool(BackendConnectionPool&& other) = delete;
+  BackendConnectionPool& operator=(const BackendConnectionPool& other) = delete;
+  BackendConnectionPool& operator=(BackendConnectionPool&& other) = delete;
+
+  bool enabled() const { return itsSettings.enabled; }
+
+  // Return a healthy idle connection to the backend, if there is one
+  std::optional<Connection> acquire(const std::string& theHostName, unsigned short thePort);
+
+  // Return a connection whose previous response has been completely read
+  void release(const std::string& theHostName, unsigned short thePort, Connection&& theConnection);
+
+  // Close all idle connections to a backend which has been retired
+  void evict(const std::string& theHostName, unsigned short thePort);
+
+  // Record that a new connection had to be opened
+  void recordConnect();
+
+  Fmi::Cache::CacheStats getStats() const;
+
+  void shutdown();
+
+ private:
+  using Key = std::pair<std::string, unsigned short>;
+
+  struct IdleConnection
+  {
+    Socket socket;
+    Clock::time_point created;
+    Clock::time_point idleSince;
+  };
+
+  bool isExpired(const IdleConnection& theConnection, Clock::time_point theNow) const;
+  static bool isHealthy(Socket& theSocket);
+
+  void scheduleReaper();
+  bool reap();
+
+  const Settings itsSettings;
+
+  mutable std::mutex itsMutex;
+  std::map<Key, std::deque<IdleConnection>> itsIdleConnections;
+  std::size_t itsIdleCount = 0;
+
+  // Statistics
+  const Fmi::DateTime itsStartTime;
+  std::size_t itsReuseCount = 0;
+  std::size_t itsConnectCount = 0;
+  std::size_t itsReleaseCount = 0;
+
+  boost::asio::steady_timer itsReaperTimer;
+  bool itsShutdown = false;
+};
+
+}  // namespace SmartMet
@@ -0,0 +1,149 @@
+#include "CacheAdmission.h"
+#include <macgyver/Exception.h>
+#include <algorithm>
+#include <functional>
+
+namespace SmartMet
+{
+namespace
+{
+// Counters saturate at 15 as in TinyLFU, more history would only slow down aging
+const std::uint8_t max_count = 15;
+
+// Row seeds, the rows must select counters independently of each other
+const std::uint64_t seeds[] = {
+    0x9e3779b97f4a7c15UL, 0xbf58476d1ce4e5b9UL, 0x94d049bb133111ebUL, 0xc2b2ae3d27d4eb4fUL};
+
+std::uint64_t mix(std::uint64_t theValue)
+{
+  theValue ^= theValue >> 31;
+  theValue *= 0x7fb5d329728ea185UL;
+  theValue ^= theValue >> 27;
+  theValue *= 0x81dadef4bc2dd44dUL;
+  theValue ^= theValue >> 33;
+  return theValue;
+}
+}  // namespace
+
+CacheAdmission::CacheAdmission(const Settings& theSettings, std::size_t theEntries)
+    : itsSettings(theSettings), itsStartTime(Fmi::MicrosecClock::universal_time())
+{
+  if (itsSettings.policy == Policy::ADMIT_ALL)
+    return;
+
+  // A power of two at least the number of entries, so that counters are selected by masking
+  itsWidth = 1024;
+  while (itsWidth < theEntries && itsWidth < (1UL << 26))
+    itsWidth *= 2;
+
+  itsCounters.resize(depth * itsWidth, 0);
+  itsSampleSize = 10 * itsWidth;
+}
+
+CacheAdmission::Policy CacheAdmission::parsePolicy(const std::string& theName)
+{
+  if (theName == "lru")
+    return Policy::ADMIT_ALL;
+  if (theName == "tinylfu")
+    return Policy::TINY_LFU;
+  throw Fmi::Exception(BCP, "Unknown response cache admission policy")
+      .addParameter("Policy", theName);
+}
+
+std::size_t CacheAdmission::index(std::uint64_t theHash, std::size_t theRow) const
+{
+  return theRow * itsWidth + (mix(theHash ^ seeds[theRow]) & (itsWidth - 1));
+}
+
+// Caller must hold the mutex
+void CacheAdmission::increment(std::uint64_t theHash)
+{
+  // Conservative update: only the smallest counters are incremented, which reduces the
+  // overestimation caused by other keys sharing the counters
+  const auto count = estimate(theHash);
+  if (count < max_count)
+  {
+    for (std::size_t row = 0; row < depth; row++)
+    {
+      auto& counter = itsCounters[index(theHash, row)];
+      if (counter == count)
+        ++counter;
+    }
+  }
+
+  // Age all counters once enough requests have been sampled
+  if (++itsIncrements >= itsSampleSize)
+  {
+    for (auto& counter : itsCounters)
+      counter >>= 1;
+    itsIncrements /= 2;
+  }
+}
+
+// Caller must hold the mutex
+std::size_t CacheAdmission::estimate(std::uint64_t theHash) const
+{
+  std::uint8_t count = max_count;
+  for (std::size_t row = 0; row < depth; row++)
+    count = std::min(count, itsCounters[index(theHash, row)]);
+  return count;
+}
+
+std::size_t CacheAdmission::requiredFrequency(std::size_t theSize) const
+{
+  std::size_t required = itsSettings.minFrequency;
+  for (std::size_t size = itsSettings.sizeUnit; size > 0 && size < theSize; size *= 2)
+    ++required;
+  return std::min<std::size_t>(required, max_count);
+}
+
+void CacheAdmission::record(const std::string& theKey)
+{
+  if (itsSettings.policy == Policy::ADMIT_ALL)
+    return;
+
+  const auto hash = std::hash<std::string>()(theKey);
+  std::lock_guard<std::mutex> lock(itsMutex);
+  increment(hash);
+}
+
+bool CacheAdmission::admit(const std::string& theKey, std::size_t theSize, bool theCacheIsFull)
+{
+  try
+  {
+    bool admitted = true;
+
+    const auto hash = std::hash<std::string>()(theKey);
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    if (itsSettings.policy != Policy::ADMIT_ALL)
+    {
+      increment(hash);
+      admitted = (!theCacheIsFull || estimate(hash) >= requiredFrequency(theSize));
+    }
+
+    if (admitted)
+      ++itsAdmitted;
+    else
+      ++itsRejected;
+    return admitted;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+Fmi::Cache::CacheStats CacheAdmission::getStats() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.size = itsCounters.size();
+  stats.inserts = itsAdmitted;
+  stats.misses = itsRejected;
+  return stats;
+}
+
+}  // namespace SmartMet
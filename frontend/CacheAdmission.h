@@ -0,0 +1,79 @@
+#pragma once
+
+#include <macgyver/CacheStats.h>
+#include <macgyver/DateTime.h>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace SmartMet
+{
+// Admission filter in front of the response cache (TinyLFU). The recent frequency of each
+// response is estimated with a count-min sketch of small saturating counters, which are
+// halved periodically so that old popularity fades. While the cache is full, a response is
+// admitted only if it has been seen often enough for its size: the more memory a response
+// would take from others, the more requests it must have had. One-off downloads therefore
+// do not flush the small responses which produce most of the hits.
+
+class CacheAdmission
+{
+ public:
+  enum class Policy
+  {
+    ADMIT_ALL,  // plain LRU
+    TINY_LFU
+  };
+
+  struct Settings
+  {
+    Policy policy = Policy::ADMIT_ALL;
+    std::size_t minFrequency = 2;  // requests needed by small responses
+    std::size_t sizeUnit = 65536;  // each doubling above this size needs one more request
+  };
+
+  // The sketch is sized for the expected number of cached responses
+  CacheAdmission(const Settings& theSettings, std::size_t theEntries);
+
+  CacheAdmission(const CacheAdmission& other) = delete;
+  CacheAdmission(CacheAdmission&& other) = delete;
+  CacheAdmission& operator=(const CacheAdmission& other) = delete;
+  CacheAdmission& operator=(CacheAdmission&& other) = delete;
+
+  static Policy parsePolicy(const std::string& theName);
+
+  // Count a request for the response
+  void record(const std::string& theKey);
+
+  // Count a request and decide whether to cache the response. A cache with room left
+  // admits everything.
+  bool admit(const std::string& theKey, std::size_t theSize, bool theCacheIsFull);
+
+  // Inserts are the admitted responses, misses the rejected ones and size the number of
+  // counters in the sketch
+  Fmi::Cache::CacheStats getStats() const;
+
+ private:
+  static const std::size_t depth = 4;
+
+  std::size_t requiredFrequency(std::size_t theSize) const;
+  void increment(std::uint64_t theHash);
+  std::size_t estimate(std::uint64_t theHash) const;
+  std::size_t index(std::uint64_t theHash, std::size_t theRow) const;
+
+  const Settings itsSettings;
+
+  mutable std::mutex itsMutex;
+  std::vector<std::uint8_t> itsCounters;  // depth rows of width counters
+  std::size_t itsWidth = 0;
+  std::size_t itsSampleSize = 0;  // increments between agings
+  std::size_t itsIncrements = 0;
+
+  // Statistics
+  const Fmi::DateTime itsStartTime;
+  std::size_t itsAdmitted = 0;
+  std::size_t itsRejected = 0;
+};
+
+}  // namespace SmartMet
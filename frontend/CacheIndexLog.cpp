@@ -0,0 +1,311 @@
+#include "CacheIndexLog.h"
+#include "MappedFile.h"
+#include <fmt/format.h>
+#include <macgyver/Exception.h>
+#include <spine/Convenience.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <optional>
+#include <unistd.h>
+
+namespace SmartMet
+{
+namespace
+{
+// Record layout: body size, body checksum, body. The body is the record type followed by
+// the fields, each prefixed by its size. Sizes are 32-bit in host byte order.
+
+std::uint32_t checksum(const char* theData, std::size_t theSize)
+{
+  std::uint32_t hash = 2166136261U;  // FNV-1a
+  for (std::size_t i = 0; i < theSize; i++)
+  {
+    hash ^= static_cast<unsigned char>(theData[i]);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+void put_uint32(std::string& theBuffer, std::uint32_t theValue)
+{
+  theBuffer.append(reinterpret_cast<const char*>(&theValue), sizeof(theValue));
+}
+
+bool get_uint32(const char*& thePos, const char* theEnd, std::uint32_t& theValue)
+{
+  if (static_cast<std::size_t>(theEnd - thePos) < sizeof(theValue))
+    return false;
+  std::memcpy(&theValue, thePos, sizeof(theValue));
+  thePos += sizeof(theValue);
+  return true;
+}
+
+std::string encode(char theType, const CacheIndexLog::Record& theFields)
+{
+  std::string body(1, theType);
+  for (const auto& field : theFields)
+  {
+    put_uint32(body, static_cast<std::uint32_t>(field.size()));
+    body += field;
+  }
+
+  std::string record;
+  record.reserve(2 * sizeof(std::uint32_t) + body.size());
+  put_uint32(record, static_cast<std::uint32_t>(body.size()));
+  put_uint32(record, checksum(body.data(), body.size()));
+  record += body;
+  return record;
+}
+
+}  // namespace
+
+CacheIndexLog::CacheIndexLog(const Settings& theSettings)
+    : itsSettings(theSettings), itsStartTime(Fmi::MicrosecClock::universal_time())
+{
+  try
+  {
+    if (!itsSettings.enabled)
+      return;
+
+    std::filesystem::create_directories(itsSettings.directory);
+
+    itsFd = ::open(currentPath().c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (itsFd < 0)
+      throw Fmi::Exception(BCP, "Failed to open the response cache index")
+          .addParameter("Path", currentPath().string())
+          .addParameter("Error", std::strerror(errno));
+
+    itsSize = static_cast<std::size_t>(lseek(itsFd, 0, SEEK_END));
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+CacheIndexLog::~CacheIndexLog()
+{
+  if (itsFd >= 0)
+    close(itsFd);
+}
+
+std::filesystem::path CacheIndexLog::currentPath() const
+{
+  return itsSettings.directory / "index.log";
+}
+
+std::filesystem::path CacheIndexLog::previousPath() const
+{
+  return itsSettings.directory / "index.log.1";
+}
+
+void CacheIndexLog::append(char theType, const Record& theFields)
+{
+  try
+  {
+    if (itsFd < 0)
+      return;
+
+    const auto record = encode(theType, theFields);
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    if (itsSize + record.size() > itsSnapshotSize + itsSettings.maxSize)
+      rotate();
+
+    // A single append, concurrent writers cannot interleave
+    const auto n = write(itsFd, record.data(), record.size());
+    if (n > 0)
+      itsSize += static_cast<std::size_t>(n);
+    ++itsAppendCount;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void CacheIndexLog::setCompactor(Compactor theCompactor)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsCompactor = std::move(theCompactor);
+}
+
+// Caller must hold the mutex. The next generation is written to a temporary file first,
+// the snapshot needs both of the current generations. A snapshot replaces both of them,
+// otherwise the current one becomes the previous one.
+void CacheIndexLog::rotate()
+{
+  const auto nextPath = itsSettings.directory / "index.log.tmp";
+  int fd = ::open(nextPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return;  // Continue appending to the current generation
+
+  const auto snapshotSize = writeSnapshot(fd);
+
+  // Without the previous generation purged or evicted entries cannot reappear. A crash
+  // before the rename loses only the entries of the previous generation.
+  std::error_code error;
+  if (snapshotSize)
+    std::filesystem::remove(previousPath(), error);
+  else
+    std::filesystem::rename(currentPath(), previousPath(), error);
+  if (!error)
+    std::filesystem::rename(nextPath, currentPath(), error);
+  if (error)
+  {
+    std::cout << fmt::format("{} Failed to rotate the response cache index {}: {}",
+                             Spine::log_time_str(),
+                             currentPath().string(),
+                             error.message())
+              << std::endl;
+    close(fd);
+    return;
+  }
+
+  close(itsFd);
+  itsFd = fd;
+  itsSize = snapshotSize.value_or(0);
+  itsSnapshotSize = itsSize;
+}
+
+// Caller must hold the mutex. Returns the number of bytes written, or nothing if there
+// is no compactor or the snapshot failed.
+std::optional<std::size_t> CacheIndexLog::writeSnapshot(int theFd)
+{
+  if (!itsCompactor)
+    return std::nullopt;
+
+  try
+  {
+    std::size_t size = 0;
+    std::string buffer;
+    const auto flush = [&buffer, &size, theFd]()
+    {
+      const auto n = write(theFd, buffer.data(), buffer.size());
+      if (n < 0 || static_cast<std::size_t>(n) != buffer.size())
+        throw Fmi::Exception(BCP, "Failed to write the response cache index snapshot")
+            .addParameter("Error", std::strerror(errno));
+      size += buffer.size();
+      buffer.clear();
+    };
+
+    itsCompactor(
+        [this](const RecordHandler& theHandler)
+        {
+          replay(previousPath(), theHandler);
+          replay(currentPath(), theHandler);
+        },
+        [&buffer, &flush](char theType, const Record& theFields)
+        {
+          buffer += encode(theType, theFields);
+          if (buffer.size() >= 1048576)
+            flush();
+        });
+    flush();
+
+    std::cout << fmt::format("{} Response cache index compacted to {} bytes",
+                             Spine::log_time_str(),
+                             size)
+              << std::endl;
+    return size;
+  }
+  catch (...)
+  {
+    // The new generation starts empty, as without compaction
+    Fmi::Exception ex(BCP, "Failed to compact the response cache index", nullptr);
+    ex.printError();
+    if (ftruncate(theFd, 0) != 0)
+      std::cerr << fmt::format("{} Failed to truncate the response cache index snapshot",
+                               Spine::log_time_str())
+                << std::endl;
+    return std::nullopt;
+  }
+}
+
+void CacheIndexLog::replay(const RecordHandler& theHandler)
+{
+  try
+  {
+    if (itsFd < 0)
+      return;
+
+    std::size_t count = replay(previousPath(), theHandler);
+    count += replay(currentPath(), theHandler);
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    itsReplayCount += count;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::size_t CacheIndexLog::replay(const std::filesystem::path& thePath,
+                                  const RecordHandler& theHandler)
+{
+  auto file = MappedFile::open(thePath);
+  if (!file)
+    return 0;
+
+  std::size_t count = 0;
+  const char* pos = file->data();
+  const char* end = file->data() + file->size();
+
+  Record fields;
+  while (pos < end)
+  {
+    std::uint32_t size = 0;
+    std::uint32_t sum = 0;
+    if (!get_uint32(pos, end, size) || !get_uint32(pos, end, sum) || size == 0 ||
+        static_cast<std::size_t>(end - pos) < size || checksum(pos, size) != sum)
+      break;  // Torn or corrupt record
+
+    const char* body = pos;
+    const char* body_end = pos + size;
+    pos = body_end;
+
+    const char type = *body++;
+    fields.clear();
+
+    bool ok = true;
+    while (body < body_end)
+    {
+      std::uint32_t length = 0;
+      if (!get_uint32(body, body_end, length) || static_cast<std::size_t>(body_end - body) < length)
+      {
+        ok = false;
+        break;
+      }
+      fields.emplace_back(body, length);
+      body += length;
+    }
+
+    if (ok)
+    {
+      theHandler(type, fields);
+      ++count;
+    }
+  }
+
+  return count;
+}
+
+Fmi::Cache::CacheStats CacheIndexLog::getStats() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.maxsize = itsSettings.maxSize;
+  stats.size = itsSize;
+  stats.inserts = itsAppendCount;
+  stats.hits = itsReplayCount;
+  return stats;
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <macgyver/CacheStats.h>
+#include <macgyver/DateTime.h>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace SmartMet
+{
+// Append-only log of response cache index updates, replayed at startup so that the
+// responses in the file cache can be found again after a restart. Each record is a type
+// and a list of fields. When the log grows by its maximum size it is rotated: the new
+// generation begins with a snapshot of the entries still live, written by the compactor,
+// which replaces both earlier generations. Long lived entries hence survive any number of
+// rotations. Without a compactor the previous generation is kept until the next
+// rotation. A torn record at the end of a log, left by a crash, ends the replay of that
+// log.
+
+class CacheIndexLog
+{
+ public:
+  struct Settings
+  {
+    bool enabled = false;
+    std::filesystem::path directory;
+    std::size_t maxSize = 67108864;  // bytes per generation
+  };
+
+  using Record = std::vector<std::string>;
+  using RecordHandler = std::function<void(char theType, const Record& theFields)>;
+
+  // Given a function replaying all records of both generations, oldest first, pass the
+  // records describing the live entries to the writer. Called with the log locked, must
+  // not append.
+  using Replayer = std::function<void(const RecordHandler& theHandler)>;
+  using Compactor = std::function<void(const Replayer& theReplay, const RecordHandler& theWriter)>;
+
+  explicit CacheIndexLog(const Settings& theSettings);
+  ~CacheIndexLog();
+
+  CacheIndexLog(const CacheIndexLog& other) = delete;
+  CacheIndexLog(CacheIndexLog&& other) = delete;
+  CacheIndexLog& operator=(const CacheIndexLog& other) = delete;
+  CacheIndexLog& operator=(CacheIndexLog&& other) = delete;
+
+  bool enabled() const { return itsFd >= 0; }
+
+  void append(char theType, const Record& theFields);
+
+  // Without a compactor a rotation simply starts a new empty generation
+  void setCompactor(Compactor theCompactor);
+
+  // Pass the records written before startup to the handler, oldest first. Records
+  // appended meanwhile may be replayed too.
+  void replay(const RecordHandler& theHandler);
+
+  // Size is the size of the current log, inserts the appended records and hits the
+  // replayed ones
+  Fmi::Cache::CacheStats getStats() const;
+
+ private:
+  std::filesystem::path currentPath() const;
+  std::filesystem::path previousPath() const;
+  void rotate();
+  std::optional<std::size_t> writeSnapshot(int theFd);
+  std::size_t replay(const std::filesystem::path& thePath, const RecordHandler& theHandler);
+
+  const Settings itsSettings;
+
+  mutable std::mutex itsMutex;
+  int itsFd = -1;
+  std::size_t itsSize = 0;
+  std::size_t itsSnapshotSize = 0;  // at the beginning of the current generation
+  Compactor itsCompactor;
+
+  // Statistics
+  const Fmi::DateTime itsStartTime;
+  std::size_t itsAppendCount = 0;
+  std::size_t itsReplayCount = 0;
+};
+
+}  // namespace SmartMet
@@ -0,0 +1,118 @@
+#include "CachePurgeIndex.h"
+#include <boost/algorithm/string.hpp>
+#include <macgyver/Exception.h>
+#include <algorithm>
+
+namespace SmartMet
+{
+CachePurgeIndex::CachePurgeIndex(std::size_t theMaxSize)
+    : itsMaxSize(std::max<std::size_t>(1, theMaxSize))
+{
+}
+
+std::vector<std::string> CachePurgeIndex::splitTags(const std::string& theTags)
+{
+  std::vector<std::string> tags;
+  boost::algorithm::split(
+      tags, theTags, boost::algorithm::is_any_of(" \t,"), boost::algorithm::token_compress_on);
+  tags.erase(std::remove(tags.begin(), tags.end(), std::string()), tags.end());
+  return tags;
+}
+
+// Caller must hold the mutex
+void CachePurgeIndex::added()
+{
+  if (++itsCurrent.size < itsMaxSize)
+    return;
+  itsPrevious = std::move(itsCurrent);
+  itsCurrent = Generation();
+}
+
+void CachePurgeIndex::addRequest(const std::string& theRequestKey)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+    if (itsCurrent.requests.insert(theRequestKey).second)
+      added();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void CachePurgeIndex::addTags(const std::string& theETag, const std::string& theTags)
+{
+  try
+  {
+    const auto tags = splitTags(theTags);
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    for (const auto& tag : tags)
+      if (itsCurrent.tags[tag].insert(theETag).second)
+        added();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::vector<std::string> CachePurgeIndex::removeRequests(const std::string& thePrefix)
+{
+  try
+  {
+    std::set<std::string> keys;
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    for (auto* generation : {&itsPrevious, &itsCurrent})
+    {
+      auto& requests = generation->requests;
+      auto pos = requests.lower_bound(thePrefix);
+      while (pos != requests.end() && boost::algorithm::starts_with(*pos, thePrefix))
+      {
+        keys.insert(*pos);
+        pos = requests.erase(pos);
+        --generation->size;
+      }
+    }
+    return {keys.begin(), keys.end()};
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::vector<std::string> CachePurgeIndex::removeTag(const std::string& theTag)
+{
+  try
+  {
+    std::set<std::string> etags;
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    for (auto* generation : {&itsPrevious, &itsCurrent})
+    {
+      auto pos = generation->tags.find(theTag);
+      if (pos == generation->tags.end())
+        continue;
+      etags.insert(pos->second.begin(), pos->second.end());
+      generation->size -= pos->second.size();
+      generation->tags.erase(pos);
+    }
+    return {etags.begin(), etags.end()};
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::size_t CachePurgeIndex::size() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  return itsCurrent.size + itsPrevious.size;
+}
+
+}  // namespace SmartMet
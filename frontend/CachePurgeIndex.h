@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace SmartMet
+{
+// Secondary index of the response cache for purging responses by request URI prefix or
+// by the tags the backends give in Surrogate-Key or X-Cache-Tags headers. Request keys
+// are kept sorted so that a prefix is found without scanning the cache.
+//
+// The index is bounded by keeping two generations: when the current one is full it
+// replaces the previous one. Entries of responses still in use are added again and
+// survive, while those of evicted responses age out.
+
+class CachePurgeIndex
+{
+ public:
+  // The maximum number of entries in a generation
+  explicit CachePurgeIndex(std::size_t theMaxSize);
+
+  CachePurgeIndex(const CachePurgeIndex& other) = delete;
+  CachePurgeIndex(CachePurgeIndex&& other) = delete;
+  CachePurgeIndex& operator=(const CachePurgeIndex& other) = delete;
+  CachePurgeIndex& operator=(CachePurgeIndex&& other) = delete;
+
+  void addRequest(const std::string& theRequestKey);
+
+  // The tags are separated by whitespace or commas
+  void addTags(const std::string& theETag, const std::string& theTags);
+
+  // Remove and return the request keys beginning with the prefix
+  std::vector<std::string> removeRequests(const std::string& thePrefix);
+
+  // Remove and return the ETags of the responses with the tag
+  std::vector<std::string> removeTag(const std::string& theTag);
+
+  // Number of entries in both generations
+  std::size_t size() const;
+
+  static std::vector<std::string> splitTags(const std::string& theTags);
+
+ private:
+  struct Generation
+  {
+    std::set<std::string> requests;
+    std::map<std::string, std::set<std::string>> tags;
+    std::size_t size = 0;
+  };
+
+  void added();
+
+  const std::size_t itsMaxSize;
+
+  mutable std::mutex itsMutex;
+  Generation itsCurrent;
+  Generation itsPrevious;
+};
+
+}  // namespace SmartMet
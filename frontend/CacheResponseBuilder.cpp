@@ -0,0 +1,251 @@
+#include "CacheResponseBuilder.h"
+#include "FileContentStreamer.h"
+#include "ResponseCompressor.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/asio/ip/host_name.hpp>
+#include <macgyver/DateTime.h>
+#include <macgyver/Exception.h>
+#include <macgyver/TimeFormatter.h>
+
+namespace SmartMet
+{
+namespace
+{
+// Format response header date as in "Fri, 27 Jul 2018 11:26:04 GMT"
+
+std::string makeDateString()
+{
+  try
+  {
+    return Fmi::to_http_string(Fmi::SecondClock::universal_time());
+  }
+  catch (...)
+  {
+    throw Fmi::Exception(BCP, "Failed to build HTTP response date");
+  }
+}
+
+}  // namespace
+
+// Return the content encoding to serve for this request, as a Content-Encoding token
+// ("gzip", "zstd", ...) or "" for the identity (uncompressed) representation.
+std::string clientAcceptsContentEncoding(const Spine::HTTP::Request& request)
+{
+  try
+  {
+    auto encodings = clientAcceptedContentEncodings(request);
+    if (encodings.empty())
+      return "";
+    return encodings.front();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::vector<std::string> clientAcceptedContentEncodings(const Spine::HTTP::Request& request)
+{
+  try
+  {
+    std::vector<std::string> encodings;
+
+    auto accept_encoding = request.getHeader("Accept-Encoding");
+    if (accept_encoding)
+    {
+      // Mirror the backend's preference order (see Server::select_content_encoding):
+      // prefer zstd, fall back to gzip, so the cached variant matches what the backend produced.
+      if (boost::algorithm::contains(*accept_encoding, "zstd"))
+        encodings.emplace_back("zstd");
+
+      if (*accept_encoding == "*" ||  // Accepts everything, send zipped
+          boost::algorithm::contains(*accept_encoding, "gzip"))
+        encodings.emplace_back("gzip");
+    }
+    return encodings;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+ResponseCache::CachedContent findCachedVariant(ResponseCache& cache,
+                                               const std::string& etag,
+                                               const Spine::HTTP::Request& request)
+{
+  try
+  {
+    auto encodings = clientAcceptedContentEncodings(request);
+    encodings.emplace_back("");  // identity is always acceptable
+
+    for (const auto& encoding : encodings)
+    {
+      auto result = cache.getCachedContent(etag, encoding);
+      if (result)
+        return result;
+    }
+
+    // Only an encoding the client does not accept is cached, decode it. Large responses
+    // would have to be decoded into memory as a whole, the backend is asked instead.
+    for (const auto& encoding : ResponseCache::cachedEncodings())
+    {
+      if (encoding.empty())
+        continue;
+      auto result = cache.getCachedContent(etag, encoding);
+      if (!result.buffer || result.metadata.large_response)
+        continue;
+
+      auto decoded = decompressContent(*result.buffer, encoding, proxy_max_cached_buffer_size);
+      if (!decoded)
+        continue;
+
+      result.buffer = std::make_shared<std::string>(std::move(*decoded));
+      result.metadata.content_encoding.clear();
+      return result;
+    }
+
+    return {};
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool hasCachedVariant(ResponseCache& cache, const std::string& etag)
+{
+  for (const auto& encoding : ResponseCache::cachedEncodings())
+    if (cache.hasCachedBuffer(etag, encoding))
+      return true;
+  return false;
+}
+
+// Key for the request -> ETag index. Includes everything used to select the cached variant.
+
+std::string makeRequestKey(const std::string& resource, const Spine::HTTP::Request& request)
+{
+  std::string key = resource;
+  key += '?';
+  key += request.getQueryString();
+  key += '\x1f';
+  key += clientAcceptsContentEncoding(request);
+  return key;
+}
+
+Spine::HTTP::Response buildCacheResponse(const Spine::HTTP::Request& originalRequest,
+                                         const ResponseCache::CachedContent& content,
+                                         bool streamFile)
+{
+  try
+  {
+    const auto& metadata = content.metadata;
+    Spine::HTTP::Response response;
+
+    response.setHeader("Date", makeDateString());
+    response.setHeader("Server", "SmartMet Synapse (" __TIME__ " " __DATE__ ")");
+    response.setHeader("X-Frontend-Server", boost::asio::ip::host_name());
+
+    if (response.getVersion() == "1.1")
+    {
+      response.setHeader("Connection",
+                         "close");  // Current implementation is one-request-per-Connection
+    }
+
+    // The cache related response headers should be the same for 200 OK responses
+    // and 304 Not Modified responses. RFC7232: "The server generating a 304 response MUST generate
+    // any of the following header fields that would have been sent in a 200 (OK) response to the
+    // same request: Cache-Control, Content-Location, Date, ETag, Expires, and Vary."
+
+    if (!metadata.expires.empty())
+      response.setHeader("Expires", metadata.expires);
+    else
+      response.setHeader("Expires", "Thu, 01 Jan 1970 00:00:00 GMT");
+
+    if (!metadata.cache_control.empty())
+      response.setHeader("Cache-Control", metadata.cache_control);
+    else
+      response.setHeader("Cache-Control", "must-revalidate");
+
+    if (!metadata.vary.empty())
+      response.setHeader("Vary", metadata.vary);
+    else
+      response.setHeader("Vary", "Accept-Encoding");
+
+    if (!metadata.access_control_allow_origin.empty())
+      response.setHeader("Access-Control-Allow-Origin", metadata.access_control_allow_origin);
+
+    // A cache hit means the ETag we hold is the current representation, so
+    // advertise it on every response (200 OK, 304 Not Modified and 412
+    // Precondition Failed alike). RFC 7232 requires the ETag to be present on
+    // a 304 response, and the current code omitted it there.
+    if (!metadata.etag.empty() && metadata.etag != "0")
+      response.setHeader("ETag", metadata.etag);
+
+    // Decide whether the client already holds the current representation and
+    // may be answered with "304 Not Modified", whether a conditional
+    // precondition failed and we must reply "412 Precondition Failed", or
+    // whether the full body has to be returned.
+    //
+    // ETagFilter::evaluate() interprets the If-Match / If-None-Match request
+    // headers (several entity-tags, the "*" wildcard, weak/strong comparison)
+    // and returns {full_response_required, suggested_status} per RFC 7232.
+    //
+    // Per RFC 7232 the If-Modified-Since header MUST be ignored when an
+    // entity-tag precondition is present, so it is only consulted otherwise.
+    // The frontend cache is validated purely by ETag and keeps no
+    // Last-Modified timestamp, so the date itself cannot be compared: a cache
+    // hit means the requested ETag is the current one, so a bare
+    // If-Modified-Since request is honoured with "304 Not Modified".
+
+    Spine::HTTP::ETagFilter etag_filter(originalRequest);
+
+    auto [full_response_required, suggested_status] = etag_filter.evaluate(metadata.etag);
+
+    if (full_response_required && !etag_filter.has_if_match() &&
+        !etag_filter.has_if_none_match() && originalRequest.getHeader("If-Modified-Since"))
+    {
+      full_response_required = false;
+      suggested_status = Spine::HTTP::Status::not_modified;
+    }
+
+    // This block prepares the client response
+    if (!full_response_required)
+    {
+      // 304 Not Modified or 412 Precondition Failed: no body
+      response.setStatus(suggested_status);
+    }
+    else
+    {
+      // No matching precondition: return the full cached body
+
+      response.setHeader("Content-Type", metadata.mime_type);
+      if (!metadata.content_encoding.empty())
+        response.setHeader("Content-Encoding", metadata.content_encoding);
+
+      response.setHeader("X-Frontend-Cache-Hit", "true");
+
+      response.setStatus(Spine::HTTP::Status::ok);
+
+      // Large responses are sent from the mapped file in chunks, the server takes care of
+      // framing streamed content
+      if (content.buffer)
+      {
+        response.setHeader("Content-Length", std::to_string(content.buffer->size()));
+        response.setContent(content.buffer);
+      }
+      else if (streamFile)
+        response.setContent(std::make_shared<FileContentStreamer>(content.file));
+      else
+        response.setHeader("Content-Length", std::to_string(content.file->size()));
+    }
+
+    return response;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace SmartMet
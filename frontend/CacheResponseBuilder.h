@@ -0,0 +1,51 @@
+#pragma once
+
+#include "ResponseCache.h"
+#include <spine/HTTP.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace SmartMet
+{
+// Largest response kept in memory, also the limit for decoding a cached variant
+#ifndef PROXY_MAX_CACHED_BUFFER_SIZE
+const std::size_t proxy_max_cached_buffer_size = 20971520;  // 20 MB
+#else
+const std::size_t proxy_max_cached_buffer_size = PROXY_MAX_CACHED_BUFFER_SIZE;
+#endif
+
+// Return the content encoding to serve for this request, as a Content-Encoding token
+// ("gzip", "zstd", ...) or "" for the identity (uncompressed) representation.
+std::string clientAcceptsContentEncoding(const Spine::HTTP::Request& request);
+
+// All content encodings accepted by the client in order of preference, without identity
+std::vector<std::string> clientAcceptedContentEncodings(const Spine::HTTP::Request& request);
+
+// The cached variant of a response to serve to the client: the preferred accepted
+// encoding, another accepted one, identity, or as a last resort a compressed variant
+// decompressed on the fly. Large responses are never decompressed, nor variants which
+// would exceed proxy_max_cached_buffer_size when decoded. The content is empty if no
+// suitable variant is cached.
+ResponseCache::CachedContent findCachedVariant(ResponseCache& cache,
+                                               const std::string& etag,
+                                               const Spine::HTTP::Request& request);
+
+// True if findCachedVariant may find a variant
+bool hasCachedVariant(ResponseCache& cache, const std::string& etag);
+
+// Key for the request -> ETag index of ResponseCache. The resource is the one sent to
+// the backend.
+std::string makeRequestKey(const std::string& resource, const Spine::HTTP::Request& request);
+
+// Build the client response for a cached response, answering conditional requests with
+// "304 Not Modified" or "412 Precondition Failed". The content may be empty only if the
+// client is known to hold the current representation. A file is streamed from its
+// mapping, unless streamFile is false in which case the caller must send it after the
+// headers.
+Spine::HTTP::Response buildCacheResponse(const Spine::HTTP::Request& originalRequest,
+                                         const ResponseCache::CachedContent& content,
+                                         bool streamFile = true);
+
+}  // namespace SmartMet
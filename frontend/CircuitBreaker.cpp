@@ -0,0 +1,269 @@
+#include "CircuitBreaker.h"
+#include <macgyver/Exception.h>
+
+namespace SmartMet
+{
+namespace
+{
+enum Counter : std::size_t
+{
+  REQUESTS,
+  FAILURES,
+  SLOW
+};
+}  // namespace
+
+CircuitBreaker::CircuitBreaker(const Settings& theSettings)
+    : itsSettings(theSettings), itsStartTime(Fmi::MicrosecClock::universal_time())
+{
+}
+
+// Caller must hold the mutex
+CircuitBreaker::Backend& CircuitBreaker::backend(const Key& theKey)
+{
+  return itsBackends.try_emplace(theKey, itsSettings.window).first->second;
+}
+
+// Caller must hold the mutex
+void CircuitBreaker::update(Backend& theBackend, Clock::time_point theTime)
+{
+  const auto openTime = std::chrono::seconds(itsSettings.openTime);
+  if (theTime - theBackend.changed < openTime)
+    return;
+
+  if (theBackend.state == State::OPEN)
+  {
+    theBackend.state = State::HALF_OPEN;
+    theBackend.changed = theTime;
+    theBackend.probesStarted = 0;
+    theBackend.probesSucceeded = 0;
+  }
+  else if (theBackend.state == State::HALF_OPEN)
+  {
+    // Probes which never reported back, for example due to a cached response
+    theBackend.changed = theTime;
+    theBackend.probesStarted = theBackend.probesSucceeded;
+  }
+}
+
+// Caller must hold the mutex
+void CircuitBreaker::record(Backend& theBackend,
+                            bool theFailure,
+                            bool theSlow,
+                            Clock::time_point theTime)
+{
+  theBackend.outcomes.add(REQUESTS, theTime);
+  if (theFailure)
+    theBackend.outcomes.add(FAILURES, theTime);
+  if (theSlow)
+    theBackend.outcomes.add(SLOW, theTime);
+}
+
+// Caller must hold the mutex
+bool CircuitBreaker::tripped(const Backend& theBackend, Clock::time_point theTime) const
+{
+  const auto requests = theBackend.outcomes.total(REQUESTS, theTime);
+  const auto failures = theBackend.outcomes.total(FAILURES, theTime);
+  const auto slow = theBackend.outcomes.total(SLOW, theTime);
+
+  if (requests == 0 || requests < itsSettings.minRequests)
+    return false;
+
+  const double total = static_cast<double>(requests);
+  return (100.0 * failures >= itsSettings.failureRate * total ||
+          (itsSettings.slowTime > 0 && 100.0 * slow >= itsSettings.slowRate * total));
+}
+
+// Caller must hold the mutex
+void CircuitBreaker::open(Backend& theBackend, Clock::time_point theTime)
+{
+  theBackend.state = State::OPEN;
+  theBackend.changed = theTime;
+  ++itsOpenings;
+}
+
+bool CircuitBreaker::allow(const std::string& theHostName, int thePort, Clock::time_point theTime)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    auto pos = itsBackends.find(Key(theHostName, thePort));
+    if (pos == itsBackends.end())
+      return true;
+
+    auto& b = pos->second;
+    update(b, theTime);
+    switch (b.state)
+    {
+      case State::CLOSED:
+        return true;
+      case State::OPEN:
+        return false;
+      case State::HALF_OPEN:
+        return (b.probesStarted < itsSettings.probes);
+    }
+    return true;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void CircuitBreaker::start(const std::string& theHostName, int thePort, Clock::time_point theTime)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    auto pos = itsBackends.find(Key(theHostName, thePort));
+    if (pos == itsBackends.end())
+      return;
+
+    auto& b = pos->second;
+    update(b, theTime);
+    if (b.state == State::HALF_OPEN)
+      ++b.probesStarted;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void CircuitBreaker::release(const std::string& theHostName,
+                             int thePort,
+                             Clock::time_point theTime)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    auto pos = itsBackends.find(Key(theHostName, thePort));
+    if (pos == itsBackends.end())
+      return;
+
+    auto& b = pos->second;
+    update(b, theTime);
+    if (b.state == State::HALF_OPEN && b.probesStarted > b.probesSucceeded)
+      --b.probesStarted;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool CircuitBreaker::recordSuccess(const std::string& theHostName,
+                                   int thePort,
+                                   Clock::duration theResponseTime,
+                                   Clock::time_point theTime)
+{
+  try
+  {
+    const bool slow = (itsSettings.slowTime > 0 &&
+                       theResponseTime > std::chrono::milliseconds(itsSettings.slowTime));
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    auto& b = backend(Key(theHostName, thePort));
+    update(b, theTime);
+
+    switch (b.state)
+    {
+      case State::CLOSED:
+        record(b, false, slow, theTime);
+        if (tripped(b, theTime))
+          open(b, theTime);
+        return false;
+
+      case State::OPEN:
+        // Requests sent before the circuit opened
+        return false;
+
+      case State::HALF_OPEN:
+        if (slow)
+        {
+          open(b, theTime);
+          return false;
+        }
+        if (++b.probesSucceeded < itsSettings.probes)
+          return false;
+        b.state = State::CLOSED;
+        b.changed = theTime;
+        b.outcomes.clear();
+        ++itsClosings;
+        return true;
+    }
+    return false;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool CircuitBreaker::recordFailure(const std::string& theHostName,
+                                   int thePort,
+                                   Clock::time_point theTime)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    auto& b = backend(Key(theHostName, thePort));
+    update(b, theTime);
+
+    switch (b.state)
+    {
+      case State::CLOSED:
+        record(b, true, false, theTime);
+        if (!tripped(b, theTime))
+          return false;
+        open(b, theTime);
+        return true;
+
+      case State::OPEN:
+        return false;
+
+      case State::HALF_OPEN:
+        open(b, theTime);
+        return true;
+    }
+    return false;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+CircuitBreaker::State CircuitBreaker::getState(const std::string& theHostName,
+                                               int thePort,
+                                               Clock::time_point theTime)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  auto pos = itsBackends.find(Key(theHostName, thePort));
+  if (pos == itsBackends.end())
+    return State::CLOSED;
+  update(pos->second, theTime);
+  return pos->second.state;
+}
+
+Fmi::Cache::CacheStats CircuitBreaker::getStats() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  for (const auto& backend : itsBackends)
+    if (backend.second.state != State::CLOSED)
+      ++stats.size;
+  stats.inserts = itsOpenings;
+  stats.hits = itsClosings;
+  return stats;
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "SlidingWindowCounter.h"
+#include <macgyver/CacheStats.h>
+#include <macgyver/DateTime.h>
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace SmartMet
+{
+// Per backend circuit breaker. While closed, the outcomes of the requests are counted over
+// a sliding window, and the circuit opens if too many of them fail or are too slow. An
+// open backend receives no requests. After a while the circuit becomes half-open and a
+// few probe requests are let through: if they succeed the circuit closes and the backend
+// gets its full share again, otherwise it opens for another period. A backend dropping a
+// single connection therefore keeps serving, and a failed backend returns to use as soon
+// as it has recovered instead of after it has been announced again.
+
+class CircuitBreaker
+{
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  enum class State
+  {
+    CLOSED,
+    OPEN,
+    HALF_OPEN
+  };
+
+  struct Settings
+  {
+    bool enabled = false;
+    int window = 10;               // seconds
+    std::size_t minRequests = 10;  // requests in the window before the circuit may open
+    double failureRate = 50;       // percentage of failed requests opening the circuit
+    int slowTime = 0;              // milliseconds to the response, zero disables
+    double slowRate = 80;          // percentage of slow requests opening the circuit
+    int openTime = 5;              // seconds before probing
+    std::size_t probes = 3;        // successful probes needed to close the circuit
+  };
+
+  explicit CircuitBreaker(const Settings& theSettings);
+
+  CircuitBreaker(const CircuitBreaker& other) = delete;
+  CircuitBreaker(CircuitBreaker&& other) = delete;
+  CircuitBreaker& operator=(const CircuitBreaker& other) = delete;
+  CircuitBreaker& operator=(CircuitBreaker&& other) = delete;
+
+  bool enabled() const { return itsSettings.enabled; }
+
+  // True if a request may be sent to the backend
+  bool allow(const std::string& theHostName, int thePort, Clock::time_point theTime = Clock::now());
+
+  // A request is being sent to the backend, in the half-open state it is a probe
+  void start(const std::string& theHostName, int thePort, Clock::time_point theTime = Clock::now());
+
+  // A started request was abandoned without an outcome, its probe may be sent again
+  void release(const std::string& theHostName,
+               int thePort,
+               Clock::time_point theTime = Clock::now());
+
+  // Outcomes of the requests. Return true if the circuit closed or opened respectively.
+  bool recordSuccess(const std::string& theHostName,
+                     int thePort,
+                     Clock::duration theResponseTime,
+                     Clock::time_point theTime = Clock::now());
+  bool recordFailure(const std::string& theHostName,
+                     int thePort,
+                     Clock::time_point theTime = Clock::now());
+
+  State getState(const std::string& theHostName,
+                 int thePort,
+                 Clock::time_point theTime = Clock::now());
+
+  // Size is the number of circuits not closed, inserts the times circuits have opened and
+  // hits the times they have closed again
+  Fmi::Cache::CacheStats getStats() const;
+
+ private:
+  using Key = std::pair<std::string, int>;
+
+  struct Backend
+  {
+    explicit Backend(int theWindow) : outcomes(theWindow, 3) {}
+
+    State state = State::CLOSED;
+    SlidingWindowCounter outcomes;  // requests, failures and slow requests in the window
+    Clock::time_point changed;  // when the state last changed
+    std::size_t probesStarted = 0;
+    std::size_t probesSucceeded = 0;
+  };
+
+  Backend& backend(const Key& theKey);
+  void update(Backend& theBackend, Clock::time_point theTime);
+  void record(Backend& theBackend, bool theFailure, bool theSlow, Clock::time_point theTime);
+  bool tripped(const Backend& theBackend, Clock::time_point theTime) const;
+  void open(Backend& theBackend, Clock::time_point theTime);
+
+  const Settings itsSettings;
+
+  mutable std::mutex itsMutex;
+  std::map<Key, Backend> itsBackends;
+
+  // Statistics
+  const Fmi::DateTime itsStartTime;
+  std::size_t itsOpenings = 0;
+  std::size_t itsClosings = 0;
+};
+
+}  // namespace SmartMet
@@ -0,0 +1,80 @@
+#include "ClientDataQueue.h"
+#include <algorithm>
+
+namespace SmartMet
+{
+ClientDataQueue::ClientDataQueue() : itsHead(new Node), itsTail(itsHead) {}
+
+ClientDataQueue::~ClientDataQueue()
+{
+  while (itsHead != nullptr)
+  {
+    Node* next = itsHead->next.load(std::memory_order_relaxed);
+    delete itsHead;
+    itsHead = next;
+  }
+}
+
+void ClientDataQueue::push(std::string&& theData)
+{
+  if (theData.empty())
+    return;
+
+  auto* node = new Node;
+  node->data = std::move(theData);
+
+  // Count the data before publishing the node so that the consumer never subtracts more
+  // than has been added
+  itsSize.fetch_add(node->data.size(), std::memory_order_release);
+  itsTail->next.store(node, std::memory_order_release);
+  itsTail = node;
+}
+
+std::string ClientDataQueue::popAll()
+{
+  std::string data;
+  Node* last = itsHead;
+  for (Node* node = itsHead->next.load(std::memory_order_acquire); node != nullptr;
+       node = node->next.load(std::memory_order_acquire))
+  {
+    if (data.empty())
+      data = std::move(node->data);
+    else
+      data += node->data;
+    last = node;
+  }
+
+  // Release the consumed nodes. The last one becomes the new dummy head since the
+  // producer may be linking a new node to it.
+  while (itsHead != last)
+  {
+    Node* old = itsHead;
+    itsHead = old->next.load(std::memory_order_relaxed);
+    delete old;
+  }
+  std::string().swap(itsHead->data);
+
+  itsSize.fetch_sub(data.size(), std::memory_order_release);
+  return data;
+}
+
+std::string ClientDataQueue::peek(std::size_t thePos, std::size_t theLength) const
+{
+  Node* first = itsHead->next.load(std::memory_order_acquire);
+  if (first == nullptr)
+    return {};
+
+  // The peeked range is normally within the first chunk
+  const auto end = thePos + theLength;
+  if (first->data.size() >= end || first->next.load(std::memory_order_acquire) == nullptr)
+    return first->data.substr(std::min(thePos, first->data.size()), theLength);
+
+  std::string data;
+  for (Node* node = first; node != nullptr && data.size() < end;
+       node = node->next.load(std::memory_order_acquire))
+    data += node->data;
+
+  return data.substr(std::min(thePos, data.size()), theLength);
+}
+
+}  // namespace SmartMet
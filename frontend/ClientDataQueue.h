@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+namespace SmartMet
+{
+// Lock-free single producer, single consumer queue of response chunks passed from the
+// backend reader to the server thread sending them to the client. Producer calls must
+// not overlap each other and neither must consumer calls, which LowLatencyGatewayStreamer
+// guarantees by producing only while holding its mutex and consuming only from the
+// thread serving the client.
+
+class ClientDataQueue
+{
+ public:
+  ClientDataQueue();
+  ~ClientDataQueue();
+
+  ClientDataQueue(const ClientDataQueue& other) = delete;
+  ClientDataQueue(ClientDataQueue&& other) = delete;
+  ClientDataQueue& operator=(const ClientDataQueue& other) = delete;
+  ClientDataQueue& operator=(ClientDataQueue&& other) = delete;
+
+  // Producer: append a chunk
+  void push(std::string&& theData);
+
+  // Consumer: take all queued data. A single chunk is moved out as is, several are joined,
+  // since the client is sent one contiguous string at a time.
+  std::string popAll();
+
+  // Consumer: copy of the queued data in the given range, without removing it
+  std::string peek(std::size_t thePos, std::size_t theLength) const;
+
+  bool empty() const { return size() == 0; }
+
+  // Total size of the queued data
+  std::size_t size() const { return itsSize.load(std::memory_order_acquire); }
+
+ private:
+  struct Node
+  {
+    std::string data;
+    std::atomic<Node*> next{nullptr};
+  };
+
+  // The consumer owns itsHead, which is a dummy node preceding the first chunk.
+  // The producer owns itsTail.
+  Node* itsHead;
+  Node* itsTail;
+  std::atomic<std::size_t> itsSize{0};
+};
+
+}  // namespace SmartMet
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <memory>
+
+namespace SmartMet
+{
+// A reference to an object streaming content to a client, given to the server instead of
+// the object itself. When the server releases the last copy, because the response was
+// sent or the client disconnected, theDetach is called before the reference to the object
+// is dropped. The object may hence outlive its client, for example to finish a response
+// shared with other clients.
+
+template <typename T>
+std::shared_ptr<T> make_client_handle(std::shared_ptr<T> theObject, void (T::*theDetach)())
+{
+  T* object = theObject.get();
+  return std::shared_ptr<T>(object,
+                            [owner = std::move(theObject), theDetach](T* theClient) mutable
+                            {
+                              (theClient->*theDetach)();
+                              owner.reset();
+                            });
+}
+
+}  // namespace SmartMet
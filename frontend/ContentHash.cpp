@@ -0,0 +1,139 @@
+#include "ContentHash.h"
+#include <algorithm>
+#include <cstring>
+
+namespace SmartMet
+{
+namespace
+{
+const std::uint64_t prime1 = 0x9e3779b185ebca87UL;
+const std::uint64_t prime2 = 0xc2b2ae3d27d4eb4fUL;
+const std::uint64_t prime3 = 0x165667b19e3779f9UL;
+const std::uint64_t prime4 = 0x85ebca77c2b2ae63UL;
+const std::uint64_t prime5 = 0x27d4eb2f165667c5UL;
+
+inline std::uint64_t rotl(std::uint64_t theValue, int theBits)
+{
+  return (theValue << theBits) | (theValue >> (64 - theBits));
+}
+
+// Little endian loads, the hash is defined on the byte sequence
+inline std::uint64_t read64(const unsigned char* thePtr)
+{
+  std::uint64_t value = 0;
+  std::memcpy(&value, thePtr, sizeof(value));
+  return value;
+}
+
+inline std::uint32_t read32(const unsigned char* thePtr)
+{
+  std::uint32_t value = 0;
+  std::memcpy(&value, thePtr, sizeof(value));
+  return value;
+}
+
+inline std::uint64_t round(std::uint64_t theLane, std::uint64_t theInput)
+{
+  theLane += theInput * prime2;
+  theLane = rotl(theLane, 31);
+  return theLane * prime1;
+}
+
+inline std::uint64_t merge(std::uint64_t theHash, std::uint64_t theLane)
+{
+  theHash ^= round(0, theLane);
+  return theHash * prime1 + prime4;
+}
+
+inline void consume(std::uint64_t* theLanes, const unsigned char* theStripe)
+{
+  theLanes[0] = round(theLanes[0], read64(theStripe));
+  theLanes[1] = round(theLanes[1], read64(theStripe + 8));
+  theLanes[2] = round(theLanes[2], read64(theStripe + 16));
+  theLanes[3] = round(theLanes[3], read64(theStripe + 24));
+}
+
+}  // namespace
+
+ContentHash::ContentHash() : itsLanes{prime1 + prime2, prime2, 0, 0 - prime1}, itsStripe{} {}
+
+void ContentHash::update(const char* theData, std::size_t theSize)
+{
+  const auto* ptr = reinterpret_cast<const unsigned char*>(theData);
+  const auto* end = ptr + theSize;
+  itsSize += theSize;
+
+  // Complete a stripe left over from the previous update
+  if (itsStripeSize > 0)
+  {
+    const std::size_t n = std::min(sizeof(itsStripe) - itsStripeSize, theSize);
+    std::memcpy(itsStripe + itsStripeSize, ptr, n);
+    itsStripeSize += n;
+    ptr += n;
+    if (itsStripeSize < sizeof(itsStripe))
+      return;
+    consume(itsLanes, itsStripe);
+    itsStripeSize = 0;
+  }
+
+  for (; end - ptr >= 32; ptr += 32)
+    consume(itsLanes, ptr);
+
+  itsStripeSize = static_cast<std::size_t>(end - ptr);
+  if (itsStripeSize > 0)
+    std::memcpy(itsStripe, ptr, itsStripeSize);
+}
+
+std::uint64_t ContentHash::digest() const
+{
+  std::uint64_t hash = 0;
+  if (itsSize >= 32)
+  {
+    hash = rotl(itsLanes[0], 1) + rotl(itsLanes[1], 7) + rotl(itsLanes[2], 12) +
+           rotl(itsLanes[3], 18);
+    for (auto lane : itsLanes)
+      hash = merge(hash, lane);
+  }
+  else
+    hash = itsLanes[2] + prime5;
+
+  hash += itsSize;
+
+  const unsigned char* ptr = itsStripe;
+  const unsigned char* end = itsStripe + itsStripeSize;
+
+  for (; end - ptr >= 8; ptr += 8)
+  {
+    hash ^= round(0, read64(ptr));
+    hash = rotl(hash, 27) * prime1 + prime4;
+  }
+
+  if (end - ptr >= 4)
+  {
+    hash ^= read32(ptr) * prime1;
+    hash = rotl(hash, 23) * prime2 + prime3;
+    ptr += 4;
+  }
+
+  for (; ptr < end; ++ptr)
+  {
+    hash ^= *ptr * prime5;
+    hash = rotl(hash, 11) * prime1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= prime2;
+  hash ^= hash >> 29;
+  hash *= prime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+std::uint64_t ContentHash::of(const std::string& theData)
+{
+  ContentHash hash;
+  hash.update(theData);
+  return hash.digest();
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace SmartMet
+{
+// Incremental 64-bit hash of response content (XXH64). The input is processed in 32-byte
+// stripes on four independent lanes, so a response can be hashed chunk by chunk as it is
+// received at close to memory bandwidth. The result only selects a cache key: content
+// which hashes equal is still compared before it is shared.
+
+class ContentHash
+{
+ public:
+  ContentHash();
+
+  void update(const char* theData, std::size_t theSize);
+  void update(const std::string& theData) { update(theData.data(), theData.size()); }
+
+  // Hash of the data so far. Further data may still be added.
+  std::uint64_t digest() const;
+
+  // Total size of the data so far
+  std::size_t size() const { return itsSize; }
+
+  static std::uint64_t of(const std::string& theData);
+
+ private:
+  std::uint64_t itsLanes[4];
+  unsigned char itsStripe[32];
+  std::size_t itsStripeSize = 0;
+  std::size_t itsSize = 0;
+};
+
+}  // namespace SmartMet
@@ -0,0 +1,36 @@
+#include "FileContentStreamer.h"
+#include <macgyver/Exception.h>
+#include <algorithm>
+
+namespace SmartMet
+{
+namespace
+{
+const std::size_t file_chunk_size = 262144;  // 256 kB
+}  // namespace
+
+FileContentStreamer::FileContentStreamer(std::shared_ptr<MappedFile> theFile)
+    : itsFile(std::move(theFile))
+{
+}
+
+std::string FileContentStreamer::getChunk()
+{
+  try
+  {
+    const auto size = std::min(file_chunk_size, itsFile->size() - itsPosition);
+    std::string chunk(itsFile->data() + itsPosition, size);
+    itsPosition += size;
+
+    if (itsPosition == itsFile->size())
+      setStatus(ContentStreamer::StreamerStatus::EXIT_OK);
+
+    return chunk;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace SmartMet
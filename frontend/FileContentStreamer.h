@@ -0,0 +1,27 @@
+#pragma once
+
+#include "MappedFile.h"
+#include <spine/HTTP.h>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace SmartMet
+{
+// Sends a memory mapped file to the client in chunks, so that serving a large cached
+// response does not require reading all of it into memory first
+
+class FileContentStreamer : public Spine::HTTP::ContentStreamer
+{
+ public:
+  explicit FileContentStreamer(std::shared_ptr<MappedFile> theFile);
+
+  // The next chunk, the status is set to EXIT_OK with the last one
+  std::string getChunk() override;
+
+ private:
+  const std::shared_ptr<MappedFile> itsFile;
+  std::size_t itsPosition = 0;
+};
+
+}  // namespace SmartMet
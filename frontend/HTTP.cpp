@@ -1,6 +1,7 @@
 #include "HTTP.h"
+#include "CacheResponseBuilder.h"
 #include "Proxy.h"
-#include <boost/algorithm/string.hpp>
+#include "ServiceRoute.h"
 #include <boost/make_shared.hpp>
 #include <engines/sputnik/Engine.h>
 #include <fmt/format.h>
@@ -9,12 +10,11 @@
 #include <spine/ConfigTools.h>
 #include <spine/Convenience.h>
 #include <spine/Reactor.h>
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <stdexcept>
 
-namespace ba = boost::algorithm;
-
 namespace SmartMet
 {
 namespace Plugin
@@ -38,11 +38,26 @@ std::size_t parse_size(const libconfig::Setting &setting, const char *name)
   }
 }
 
+// How many times Sputnik is asked for a backend whose circuit is not open
+const int max_backend_picks = 4;
+
+std::string backend_key(const std::string &theHostName, int thePort)
+{
+  return theHostName + ":" + Fmi::to_string(thePort);
+}
+
+std::string backend_key(const BackendServer &theHost)
+{
+  return backend_key(theHost.Name(), theHost.Port());
+}
+
 }  // namespace
 
 Proxy::ProxyStatus HTTP::transport(Spine::Reactor &theReactor,
                                    const Spine::HTTP::Request &theRequest,
-                                   Spine::HTTP::Response &theResponse)
+                                   Spine::HTTP::Response &theResponse,
+                                   bool theMayRetry,
+                                   std::set<std::string> &theFailedBackends)
 {
   try
   {
@@ -51,8 +66,12 @@ Proxy::ProxyStatus HTTP::transport(Spine::Reactor &theReactor,
 
     if (theService.get() == nullptr)
     {
-      // In this case there were no available backends. If the request merely asked if the
-      // response has changed, return "304 Not Modified" instead of an error.
+      // In this case there were no available backends. Serve a stale response if allowed.
+      if (itsProxy->respondStale(theRequest, theResponse, theRequest.getResource()))
+        return Proxy::ProxyStatus::PROXY_SUCCESS;
+
+      // If the request merely asked if the response has changed, return "304 Not Modified"
+      // instead of an error.
 
       auto if_none_match = theRequest.getHeader("If-None-Match");
       auto if_modified_since = theRequest.getHeader("If-Modified-Since");
@@ -68,7 +87,7 @@ Proxy::ProxyStatus HTTP::transport(Spine::Reactor &theReactor,
     }
 
     // BackendServer where we're connecting to
-    const std::shared_ptr<BackendServer> theHost = theService->Backend();
+    std::shared_ptr<BackendServer> theHost = theService->Backend();
 
     if (!theHost)
     {
@@ -80,11 +99,98 @@ Proxy::ProxyStatus HTTP::transport(Spine::Reactor &theReactor,
       return Proxy::ProxyStatus::PROXY_FAIL_SERVICE;
     }
 
+    // Let Sputnik pick a second candidate. The one expected to answer sooner is used, and
+    // the other one receives a hedged copy of the request if the first is slow.
+    auto &balancer = itsProxy->getBackendBalancer();
+    const bool hedgeable = (itsProxy->getRequestHedger().enabled() &&
+                            theRequest.getMethod() == Spine::HTTP::RequestMethod::GET);
+    BackendServicePtr otherService;
+    std::shared_ptr<BackendServer> otherHost;
+    if (balancer.enabled() || hedgeable)
+    {
+      otherService = itsSputnikProcess->getServices().getService(theRequest);
+      if (otherService)
+        otherHost = otherService->Backend();
+      if (otherHost && balancer.enabled() &&
+          balancer.preferSecond(
+              theHost->Name(), theHost->Port(), otherHost->Name(), otherHost->Port()))
+      {
+        std::swap(theService, otherService);
+        std::swap(theHost, otherHost);
+      }
+    }
+
+    // Avoid backends whose circuit is open and backends which already failed this request
+    auto &breaker = itsProxy->getCircuitBreaker();
+    auto usable = [&](const std::shared_ptr<BackendServer> &host)
+    {
+      return (host && breaker.allow(host->Name(), host->Port()) &&
+              theFailedBackends.count(backend_key(*host)) == 0);
+    };
+
+    for (int pick = 0; !usable(theHost) && pick < max_backend_picks; pick++)
+    {
+      if (usable(otherHost))
+      {
+        std::swap(theService, otherService);
+        std::swap(theHost, otherHost);
+      }
+      else if (auto service = itsSputnikProcess->getServices().getService(theRequest))
+      {
+        if (auto host = service->Backend())
+        {
+          theService = service;
+          theHost = host;
+        }
+      }
+    }
+
+    if (!usable(theHost))
+    {
+      // All the backends found are failing. Serve a stale response if allowed.
+      if (itsProxy->respondStale(theRequest, theResponse, theRequest.getResource()))
+        return Proxy::ProxyStatus::PROXY_SUCCESS;
+
+      auto if_none_match = theRequest.getHeader("If-None-Match");
+      auto if_modified_since = theRequest.getHeader("If-Modified-Since");
+      if (if_none_match || if_modified_since)
+      {
+        theResponse.setStatus(Spine::HTTP::Status::not_modified);
+        return Proxy::ProxyStatus::PROXY_SUCCESS;
+      }
+
+      // 503 Service Unavailable
+      theResponse.setStatus(Spine::HTTP::Status::service_unavailable, true);
+      return Proxy::ProxyStatus::PROXY_FAIL_SERVICE;
+    }
+
+    // Resolve the resource URI used by the backend
+    const std::string hostName = theHost->Name();
+    const std::string resource = backendResource(theRequest, *theService, hostName);
+    if (resource.empty())
+      return Proxy::ProxyStatus::PROXY_INTERNAL_ERROR;
+
+    // Remember the most popular requests for warming up the cache
+    if (itsHotRequests && theRequest.getMethod() == Spine::HTTP::RequestMethod::GET)
+      itsHotRequests->record(theRequest.getURI(), clientAcceptsContentEncoding(theRequest));
+
+    // Answer from the cache if the response is still fresh
+    if (itsProxy->respondFromCache(theReactor,
+                                   theRequest,
+                                   theResponse,
+                                   theHost->IP(),
+                                   theHost->Port(),
+                                   resource,
+                                   hostName))
+      return Proxy::ProxyStatus::PROXY_SUCCESS;
+
     // See if this backend is set as 'temporarily unconscious'
     if (!itsSputnikProcess->getServices().queryBackendAlive(theHost->Name(), theHost->Port()))
     {
       itsSputnikProcess->getServices().removeBackend(theHost->Name(), theHost->Port());
       theReactor.removeBackendRequests(theHost->Name(), theHost->Port());
+      itsProxy->getConnectionPool().evict(theHost->Name(), theHost->Port());
+      balancer.remove(theHost->Name(), theHost->Port());
 
       std::cout << fmt::format("{} Backend {}:{} is marked as dead. Retiring backend server.",
                                Spine::log_time_str(),
@@ -92,8 +198,15 @@ Proxy::ProxyStatus HTTP::transport(Spine::Reactor &theReactor,
                                theHost->Port())
                 << std::endl;
 
-      // Respond Not Modified if possible to minimize damage. Note that the query is
-      // not sent to another backend just in case the query caused the backend to crash.
+      // Respond with a stale response or Not Modified if possible to minimize damage. Note
+      // that the query is not sent to another backend just in case the query caused the
+      // backend to crash, unless the retry policy allows it.
+
+      if (theMayRetry)
+        return Proxy::ProxyStatus::PROXY_FAIL_REMOTE_HOST;
+
+      if (itsProxy->respondStale(theRequest, theResponse, resource))
+        return Proxy::ProxyStatus::PROXY_SUCCESS;
 
       auto if_none_match = theRequest.getHeader("If-None-Match");
       auto if_modified_since = theRequest.getHeader("If-Modified-Since");
@@ -106,95 +219,143 @@ Proxy::ProxyStatus HTTP::transport(Spine::Reactor &theReactor,
       return Proxy::ProxyStatus::PROXY_FAIL_REMOTE_HOST;
     }
 
+    std::optional<Proxy::HedgeTarget> hedge;
+    if (hedgeable && usable(otherHost) &&
+        (otherHost->Name() != theHost->Name() || otherHost->Port() != theHost->Port()) &&
+        itsSputnikProcess->getServices().queryBackendAlive(otherHost->Name(), otherHost->Port()))
+    {
+      const std::string otherResource =
+          backendResource(theRequest, *otherService, otherHost->Name());
+      if (!otherResource.empty())
+        hedge = Proxy::HedgeTarget{theService->URI(),
+                                   otherHost->IP(),
+                                   otherHost->Port(),
+                                   otherHost->Name(),
+                                   otherResource};
+    }
+
     // Forward the request keeping account of how many active requests each backend has.
     // The destructor of the streamer created by the proxy will decrement the count.
 
-    Proxy::ProxyStatus proxyStatus = Proxy::ProxyStatus::PROXY_SUCCESS;
-
-    // Use Proxy class to forward the request to backend server
-    std::string resource = theRequest.getResource();
-
-    const std::string hostName = theHost->Name();
-    const std::string hostPrefix = "/" + hostName;
+    const auto startTime = CircuitBreaker::Clock::now();
+    breaker.start(theHost->Name(), theHost->Port());
+
+    Proxy::ProxyStatus proxyStatus = itsProxy->HTTPForward(theReactor,
+                                                           theRequest,
+                                                           theResponse,
+                                                           theHost->IP(),
+                                                           theHost->Port(),
+                                                           resource,
+                                                           theHost->Name(),
+                                                           theMayRetry,
+                                                           hedge);
+
+    // The hedge may have answered instead, the proxy accounts for the other backend
+    const bool hedgeServed = (hedge && theResponse.itsOriginatingBackend == hedge->hostName &&
+                              theResponse.itsBackendPort == hedge->port);
+    const std::string servedName = (hedgeServed ? hedge->hostName : theHost->Name());
+    const int servedPort = (hedgeServed ? hedge->port : theHost->Port());
 
-    if (theService->DefinesPrefix())
+    // Check the Proxy status
+    if (proxyStatus != Proxy::ProxyStatus::PROXY_SUCCESS)
     {
-      if (ba::starts_with(resource, theService->URI()))
-      {
-        // Direct match IRU prefix: can use initial resource URI.
-      }
-      else if (ba::starts_with(resource, hostPrefix + "/"))
+      theFailedBackends.insert(backend_key(servedName, servedPort));
+
+      if (breaker.enabled())
       {
-        // Begins with host prefix + "/". Strip it from resource URI, but leave final '/'
-        resource = resource.substr(hostPrefix.length());
+        // Keep the backend in use, its circuit opens if it keeps failing
+        const bool opened = breaker.recordFailure(servedName, servedPort);
+        std::cout << fmt::format("{} Backend Server connection to {}:{} failed{}",
+                                 Spine::log_time_str(),
+                                 servedName,
+                                 servedPort,
+                                 opened ? ", circuit opened." : ".")
+                  << std::endl;
+
+        itsProxy->getConnectionPool().evict(servedName, servedPort);
       }
-      if (not ba::starts_with(resource, theService->URI()))
+      else
       {
-        // Something unexpected happened.
+        // Immediately remove the backend server from the service providing pool
+        // if there was a problem connecting to backend server.
         std::cout << fmt::format(
-                         "{} Request resource '{}' does not beging with either of '{}' and '{}'",
+                         "{} Backend Server connection to {}:{} failed, retiring the backend "
+                         "server.",
                          Spine::log_time_str(),
-                         theRequest.getResource(),
-                         theService->URI(),
-                         hostPrefix + theService->URI())
+                         servedName,
+                         servedPort)
                   << std::endl;
-        return Proxy::ProxyStatus::PROXY_INTERNAL_ERROR;
+
+        itsSputnikProcess->getServices().removeBackend(servedName, servedPort);
+        theReactor.removeBackendRequests(servedName, servedPort);
+        itsProxy->getConnectionPool().evict(servedName, servedPort);
+        balancer.remove(servedName, servedPort);
       }
+
+      if (!theMayRetry && itsProxy->respondStale(theRequest, theResponse, resource))
+        proxyStatus = Proxy::ProxyStatus::PROXY_SUCCESS;
     }
     else
     {
-      if (resource == theService->URI())
-      {
-        // Direct match: can use initial resource URI.
-      }
-      else if (resource == hostPrefix + theService->URI())
-      {
-        // Host prefix found. Remove it when sending request to backend
-        resource = theService->URI();
-      }
-      else
-      {
-        // Something unexpected happened.
-        std::cout << fmt::format("{} Request resource '{}' is neither of '{}' and '{}'",
+      // Signal that a connection has been sent to the backend (for throttle bookkeeping)
+      itsSputnikProcess->getServices().signalBackendConnection(servedName, servedPort);
+
+      // The proxy records the success of a hedge with its own response time
+      if (breaker.enabled() && !hedgeServed &&
+          breaker.recordSuccess(
+              theHost->Name(), theHost->Port(), CircuitBreaker::Clock::now() - startTime))
+        std::cout << fmt::format("{} Backend {}:{} has recovered, circuit closed",
                                  Spine::log_time_str(),
-                                 theRequest.getResource(),
-                                 theService->URI(),
-                                 hostPrefix + theService->URI())
+                                 theHost->Name(),
+                                 theHost->Port())
                   << std::endl;
-        return Proxy::ProxyStatus::PROXY_INTERNAL_ERROR;
-      }
     }
 
-    proxyStatus = itsProxy->HTTPForward(theReactor,
-                                        theRequest,
-                                        theResponse,
-                                        theHost->IP(),
-                                        theHost->Port(),
-                                        resource,
-                                        theHost->Name());
+    return proxyStatus;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-    // Check the Proxy status
-    if (proxyStatus != Proxy::ProxyStatus::PROXY_SUCCESS)
-    {
-      // Immediately remove the backend server from the service providing pool
-      // if there was a problem connecting to backend server.
-      std::cout << fmt::format(
-                       "{} Backend Server connection to {}:{} failed, retiring the backend server.",
-                       Spine::log_time_str(),
-                       theHost->Name(),
-                       theHost->Port())
-                << std::endl;
+std::string HTTP::backendResource(const Spine::HTTP::Request &theRequest,
+                                  const BackendService &theService,
+                                  const std::string &theHostName)
+{
+  try
+  {
+    std::string resource = theRequest.getResource();
+    const auto &uri = theService.URI();
 
-      itsSputnikProcess->getServices().removeBackend(theHost->Name(), theHost->Port());
-      theReactor.removeBackendRequests(theHost->Name(), theHost->Port());
-    }
-    else
+    const auto strip = ServiceRoute::match(resource, uri, theService.DefinesPrefix(), theHostName);
+
+    if (!strip)
     {
-      // Signal that a connection has been sent to the backend (for throttle bookkeeping)
-      itsSputnikProcess->getServices().signalBackendConnection(theHost->Name(), theHost->Port());
+      // Something unexpected happened.
+      const std::string hostPrefix = "/" + theHostName;
+      if (theService.DefinesPrefix())
+        std::cout << fmt::format(
+                         "{} Request resource '{}' does not beging with either of '{}' and '{}'",
+                         Spine::log_time_str(),
+                         resource,
+                         uri,
+                         hostPrefix + uri)
+                  << std::endl;
+      else
+        std::cout << fmt::format("{} Request resource '{}' is neither of '{}' and '{}'",
+                                 Spine::log_time_str(),
+                                 resource,
+                                 uri,
+                                 hostPrefix + uri)
+                  << std::endl;
+      return {};
     }
 
-    return proxyStatus;
+    // Remove the host prefix when sending the request to the backend
+    if (*strip > 0)
+      resource.erase(0, *strip);
+    return resource;
   }
   catch (...)
   {
@@ -208,28 +369,222 @@ void HTTP::requestHandler(Spine::Reactor &theReactor,
 {
   try
   {
-    Proxy::ProxyStatus theStatus;
-
     // Try to send the request until it is sent or no backends are available.
-    // Currently we do not resend on PROXY_FAIL_REMOTE_HOST since the request
-    // may have crashed the backend.
-    do
+    // On PROXY_FAIL_REMOTE_HOST the request may have crashed the backend, hence
+    // only GET requests are resent and only within the retry budget.
+
+    const auto &retrySettings = itsRetryBudget->getSettings();
+    const bool retriable = (retrySettings.enabled &&
+                            theRequest.getMethod() == Spine::HTTP::RequestMethod::GET);
+    if (retriable)
+      itsRetryBudget->recordRequest();
+
+    std::set<std::string> failedBackends;
+    std::size_t retries = 0;
+    while (true)
     {
-      theStatus = transport(theReactor, theRequest, theResponse);
+      const bool mayRetry =
+          (retriable && retries < retrySettings.maxRetries && itsRetryBudget->canRetry());
+
+      const auto theStatus =
+          transport(theReactor, theRequest, theResponse, mayRetry, failedBackends);
 
       if (theStatus == Proxy::ProxyStatus::PROXY_FAIL_REMOTE_DENIED)
+      {
         std::cout << fmt::format("{} Resending URI {}", Spine::log_time_str(), theRequest.getURI())
                   << std::endl;
-    } while (theStatus == Proxy::ProxyStatus::PROXY_FAIL_REMOTE_DENIED);
+        continue;
+      }
+
+      if (theStatus != Proxy::ProxyStatus::PROXY_FAIL_REMOTE_HOST)
+        return;
+
+      if (!mayRetry)
+      {
+        if (retriable && retries < retrySettings.maxRetries)
+          itsRetryBudget->recordRefusal();
+        return;
+      }
+
+      ++retries;
+      itsRetryBudget->recordRetry();
+      std::cout << fmt::format("{} Retrying URI {} on another backend",
+                               Spine::log_time_str(),
+                               theRequest.getURI())
+                << std::endl;
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Save the hot requests periodically, and warm up the cache at startup and when requested
+void HTTP::warmupLoop()
+{
+  try
+  {
+    using Clock = std::chrono::steady_clock;
+    auto nextSave = Clock::now() + std::chrono::seconds(itsWarmupSettings.interval);
+    auto startupWarmup = Clock::now() + std::chrono::seconds(itsWarmupSettings.startupDelay);
+    bool startupPending = true;
+
+    std::unique_lock<std::mutex> lock(itsWarmupMutex);
+    while (!itsShuttingDown)
+    {
+      const auto now = Clock::now();
+      if (itsWarmupRequested || (startupPending && now >= startupWarmup))
+      {
+        itsWarmupRequested = false;
+        startupPending = false;
+        lock.unlock();
+        try
+        {
+          warmup();
+        }
+        catch (...)
+        {
+          Fmi::Exception ex(BCP, "Response cache warmup failed", nullptr);
+          ex.printError();
+        }
+        lock.lock();
+        continue;
+      }
+
+      if (now >= nextSave)
+      {
+        nextSave = now + std::chrono::seconds(itsWarmupSettings.interval);
+        lock.unlock();
+        try
+        {
+          itsHotRequests->save(itsWarmupSettings.path);
+        }
+        catch (...)
+        {
+          Fmi::Exception ex(BCP, "Failed to save the hot requests", nullptr);
+          ex.printError();
+        }
+        lock.lock();
+        continue;
+      }
+
+      itsWarmupCondition.wait_until(
+          lock, (startupPending ? std::min(nextSave, startupWarmup) : nextSave));
+    }
+  }
+  catch (...)
+  {
+    // Runs in its own thread, the frontend works without warmups
+    Fmi::Exception ex(BCP, "Response cache warmup loop failed", nullptr);
+    ex.printError();
+  }
+}
+
+// Fetch the hot requests into the cache through the normal backend selection while the
+// frontend reports itself paused
+void HTTP::warmup()
+{
+  try
+  {
+    // The current list is more accurate, after a restart the saved one is used
+    auto requests = itsHotRequests->top();
+    if (requests.empty())
+      requests = HotRequestTracker::load(itsWarmupSettings.path);
+    if (requests.empty())
+      return;
+
+    itsWarmingUp = true;
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(itsWarmupSettings.timeout);
+
+    std::cout << fmt::format("{} Warming up the response cache with {} requests",
+                             Spine::log_time_str(),
+                             requests.size())
+              << std::endl;
+
+    std::size_t count = 0;
+    for (const auto &hotRequest : requests)
+    {
+      {
+        std::lock_guard<std::mutex> lock(itsWarmupMutex);
+        if (itsShuttingDown)
+          break;
+      }
+
+      std::string message = "GET " + hotRequest.uri + " HTTP/1.1\r\n";
+      if (!hotRequest.encoding.empty())
+        message += "Accept-Encoding: " + hotRequest.encoding + "\r\n";
+      message += "\r\n";
+
+      auto parsed = Spine::HTTP::parseRequest(message);
+      if (std::get<0>(parsed) != Spine::HTTP::ParsingStatus::COMPLETE)
+        continue;
+      const auto &request = *std::get<1>(parsed);
+
+      BackendServicePtr service = itsSputnikProcess->getServices().getService(request);
+      if (!service)
+        continue;
+      const std::shared_ptr<BackendServer> host = service->Backend();
+      if (!host ||
+          !itsSputnikProcess->getServices().queryBackendAlive(host->Name(), host->Port()))
+        continue;
+
+      const std::string resource = backendResource(request, *service, host->Name());
+      if (resource.empty())
+        continue;
+
+      if (!itsProxy->prefetch(*itsReactor,
+                              request,
+                              host->IP(),
+                              host->Port(),
+                              resource,
+                              host->Name(),
+                              itsWarmupSettings.concurrency,
+                              deadline))
+        break;
+
+      itsSputnikProcess->getServices().signalBackendConnection(host->Name(), host->Port());
+      ++count;
+    }
 
-    return;
+    bool shuttingDown = false;
+    {
+      std::lock_guard<std::mutex> lock(itsWarmupMutex);
+      shuttingDown = itsShuttingDown;
+    }
+    const bool finished = (!shuttingDown && itsProxy->waitForBackgroundFetches(deadline));
+    itsWarmingUp = false;
+
+    std::cout << fmt::format("{} Response cache warmup {} after {} requests",
+                             Spine::log_time_str(),
+                             (finished ? "finished" : "timed out"),
+                             count)
+              << std::endl;
   }
   catch (...)
   {
+    itsWarmingUp = false;
     throw Fmi::Exception::Trace(BCP, "Operation failed!");
   }
 }
 
+std::string HTTP::requestWarmup()
+{
+  if (!itsWarmupThread.joinable())
+    return "Response cache warmup is not enabled";
+
+  if (itsWarmingUp)
+    return "Response cache warmup is already running";
+
+  {
+    std::lock_guard<std::mutex> lock(itsWarmupMutex);
+    itsWarmupRequested = true;
+  }
+  itsWarmupCondition.notify_one();
+  return "Response cache warmup started";
+}
+
 HTTP::HTTP(Spine::Reactor *theReactor, const char *theConfig)
 {
   using namespace boost::placeholders;
@@ -261,8 +616,11 @@ HTTP::HTTP(Spine::Reactor *theReactor, const char *theConfig)
     // do not use nullptr here or path construction throws
     const char *filesystemCachePath = "";
 
-    int backendTimeoutInSeconds = 600;
-    int backendThreadCount = 20;
+    ResponseCache::Settings cacheSettings;
+
+    Proxy::BackendSettings backendSettings;
+    auto &connectionPoolSettings = backendSettings.connectionPool;
+    RetryBudget::Settings retrySettings;
 
     try
     {
@@ -324,8 +682,192 @@ HTTP::HTTP(Spine::Reactor *theReactor, const char *theConfig)
           config.lookupValue("uncompressed_cache.directory", filesystemCachePath);
       }
 
-      config.lookupValue("backend.timeout", backendTimeoutInSeconds);
-      config.lookupValue("backend.threads", backendThreadCount);
+      unsigned int shards = cacheSettings.shards;
+      config.lookupValue("response_cache.shards", shards);
+      cacheSettings.shards = std::max(1U, shards);
+
+      const char *partitions_setting = "response_cache.partitions";
+      if (config.exists(partitions_setting))
+      {
+        const libconfig::Setting &partitions = config.lookup(partitions_setting);
+        std::size_t reservedMemory = 0;
+        std::size_t reservedFilesystem = 0;
+        for (int i = 0; i < partitions.getLength(); i++)
+        {
+          const libconfig::Setting &partition = partitions[i];
+          ResponseCache::Settings::Partition partitionSettings;
+          partition.lookupValue("name", partitionSettings.name);
+          partition.lookupValue("prefix", partitionSettings.prefix);
+          if (partitionSettings.name.empty() || partitionSettings.prefix.empty())
+            throw Fmi::Exception(BCP, "Response cache partitions need a name and a prefix");
+          if (partition.exists("memory_bytes"))
+            partitionSettings.memorySize =
+                parse_size(partition.lookup("memory_bytes"), "memory_bytes");
+          if (partition.exists("filesystem_bytes"))
+            partitionSettings.filesystemSize =
+                parse_size(partition.lookup("filesystem_bytes"), "filesystem_bytes");
+          reservedMemory += partitionSettings.memorySize;
+          reservedFilesystem += partitionSettings.filesystemSize;
+          cacheSettings.partitions.push_back(partitionSettings);
+        }
+
+        if (reservedMemory > memorySize || reservedFilesystem > filesystemSize)
+          throw Fmi::Exception(BCP, "Response cache partitions exceed the cache size");
+      }
+
+      auto &admissionSettings = cacheSettings.admission;
+      const char *admission_size_unit = "response_cache.admission.size_unit";
+      std::string admissionPolicy;
+      unsigned int minFrequency = admissionSettings.minFrequency;
+      if (config.lookupValue("response_cache.admission.policy", admissionPolicy))
+        admissionSettings.policy = CacheAdmission::parsePolicy(admissionPolicy);
+      config.lookupValue("response_cache.admission.min_frequency", minFrequency);
+      if (config.exists(admission_size_unit))
+        admissionSettings.sizeUnit =
+            parse_size(config.lookup(admission_size_unit), admission_size_unit);
+      admissionSettings.minFrequency = minFrequency;
+
+      config.lookupValue("response_cache.freshness.enabled", cacheSettings.serveFresh);
+      config.lookupValue("response_cache.freshness.stale_while_revalidate",
+                         cacheSettings.staleWhileRevalidate);
+      config.lookupValue("response_cache.freshness.stale_if_error", cacheSettings.staleIfError);
+
+      auto &compressionSettings = cacheSettings.compression;
+      unsigned int minCompressedSize = compressionSettings.minSize;
+      config.lookupValue("response_cache.compression.enabled", compressionSettings.enabled);
+      config.lookupValue("response_cache.compression.min_size", minCompressedSize);
+      config.lookupValue("response_cache.compression.gzip_level", compressionSettings.gzipLevel);
+      config.lookupValue("response_cache.compression.zstd_level", compressionSettings.zstdLevel);
+      compressionSettings.minSize = minCompressedSize;
+
+      auto &largeResponseSettings = cacheSettings.largeResponses;
+      const char *large_response_size = "response_cache.large_responses.max_size";
+      const char *large_response_free = "response_cache.large_responses.min_free_space";
+      std::string largeResponseDirectory;
+      config.lookupValue("response_cache.large_responses.enabled", largeResponseSettings.enabled);
+      config.lookupValue("response_cache.large_responses.directory", largeResponseDirectory);
+      if (config.exists(large_response_size))
+        largeResponseSettings.maxSize =
+            parse_size(config.lookup(large_response_size), large_response_size);
+      if (config.exists(large_response_free))
+        largeResponseSettings.minFreeSpace =
+            parse_size(config.lookup(large_response_free), large_response_free);
+
+      // By default the large responses are kept next to the file cache
+      if (!largeResponseDirectory.empty())
+        largeResponseSettings.directory = largeResponseDirectory;
+      else if (*filesystemCachePath != '\0')
+        largeResponseSettings.directory = std::filesystem::path(filesystemCachePath) / "large";
+      else
+        largeResponseSettings.enabled = false;
+
+      unsigned int hotRequests = itsWarmupSettings.requests;
+      unsigned int warmupConcurrency = itsWarmupSettings.concurrency;
+      config.lookupValue("response_cache.warmup.enabled", itsWarmupSettings.enabled);
+      config.lookupValue("response_cache.warmup.requests", hotRequests);
+      config.lookupValue("response_cache.warmup.interval", itsWarmupSettings.interval);
+      config.lookupValue("response_cache.warmup.startup_delay", itsWarmupSettings.startupDelay);
+      config.lookupValue("response_cache.warmup.concurrency", warmupConcurrency);
+      config.lookupValue("response_cache.warmup.timeout", itsWarmupSettings.timeout);
+      itsWarmupSettings.requests = hotRequests;
+      itsWarmupSettings.concurrency = warmupConcurrency;
+      if (*filesystemCachePath != '\0')
+        itsWarmupSettings.path =
+            std::filesystem::path(filesystemCachePath) / "warmup" / "hot_requests";
+      else
+        itsWarmupSettings.enabled = false;
+
+      auto &indexSettings = cacheSettings.index;
+      const char *index_size = "response_cache.index.max_size";
+      config.lookupValue("response_cache.index.enabled", indexSettings.enabled);
+      if (config.exists(index_size))
+        indexSettings.maxSize = parse_size(config.lookup(index_size), index_size);
+      if (*filesystemCachePath != '\0')
+        indexSettings.directory = std::filesystem::path(filesystemCachePath) / "index";
+      else
+        indexSettings.enabled = false;
+
+      config.lookupValue("backend.timeout", backendSettings.timeoutInSeconds);
+      config.lookupValue("backend.connect_timeout", backendSettings.connectTimeoutInSeconds);
+      config.lookupValue("backend.threads", backendSettings.threadCount);
+      config.lookupValue("backend.conditional_requests", backendSettings.conditionalRequests);
+      config.lookupValue("backend.coalesce_requests", backendSettings.coalesceRequests);
+
+      unsigned int maxIdleConnections = connectionPoolSettings.maxIdlePerBackend;
+      config.lookupValue("backend.keepalive.enabled", connectionPoolSettings.enabled);
+      config.lookupValue("backend.keepalive.max_idle_connections", maxIdleConnections);
+      config.lookupValue("backend.keepalive.max_idle_time", connectionPoolSettings.maxIdleSeconds);
+      config.lookupValue("backend.keepalive.max_age", connectionPoolSettings.maxAgeSeconds);
+      connectionPoolSettings.maxIdlePerBackend = maxIdleConnections;
+
+      auto &balancerSettings = backendSettings.balancer;
+      config.lookupValue("backend.balancer.enabled", balancerSettings.enabled);
+      config.lookupValue("backend.balancer.smoothing", balancerSettings.smoothing);
+      if (balancerSettings.smoothing <= 0 || balancerSettings.smoothing > 1)
+        throw Fmi::Exception(BCP, "backend.balancer.smoothing must be in the range (0,1]");
+
+      unsigned int maxRetries = retrySettings.maxRetries;
+      unsigned int minRetries = retrySettings.minRetries;
+      config.lookupValue("backend.retry.enabled", retrySettings.enabled);
+      config.lookupValue("backend.retry.max_retries", maxRetries);
+      config.lookupValue("backend.retry.budget_percent", retrySettings.percent);
+      config.lookupValue("backend.retry.min_retries", minRetries);
+      config.lookupValue("backend.retry.window", retrySettings.window);
+      retrySettings.maxRetries = maxRetries;
+      retrySettings.minRetries = minRetries;
+      if (retrySettings.window < 1)
+        throw Fmi::Exception(BCP, "backend.retry.window must be at least one second");
+
+      auto &hedgingSettings = backendSettings.hedging;
+      unsigned int minHedgeSamples = hedgingSettings.minSamples;
+      config.lookupValue("backend.hedging.enabled", hedgingSettings.enabled);
+      config.lookupValue("backend.hedging.percentile", hedgingSettings.percentile);
+      config.lookupValue("backend.hedging.min_samples", minHedgeSamples);
+      config.lookupValue("backend.hedging.min_delay", hedgingSettings.minDelay);
+      config.lookupValue("backend.hedging.max_percent", hedgingSettings.maxPercent);
+      hedgingSettings.minSamples = minHedgeSamples;
+      if (hedgingSettings.percentile <= 0 || hedgingSettings.percentile > 100)
+        throw Fmi::Exception(BCP, "backend.hedging.percentile must be in the range (0,100]");
+
+      auto &breakerSettings = backendSettings.circuitBreaker;
+      unsigned int minBreakerRequests = breakerSettings.minRequests;
+      unsigned int probes = breakerSettings.probes;
+      config.lookupValue("backend.circuit_breaker.enabled", breakerSettings.enabled);
+      config.lookupValue("backend.circuit_breaker.window", breakerSettings.window);
+      config.lookupValue("backend.circuit_breaker.min_requests", minBreakerRequests);
+      config.lookupValue("backend.circuit_breaker.failure_rate", breakerSettings.failureRate);
+      config.lookupValue("backend.circuit_breaker.slow_time", breakerSettings.slowTime);
+      config.lookupValue("backend.circuit_breaker.slow_rate", breakerSettings.slowRate);
+      config.lookupValue("backend.circuit_breaker.open_time", breakerSettings.openTime);
+      config.lookupValue("backend.circuit_breaker.probes", probes);
+      breakerSettings.minRequests = minBreakerRequests;
+      breakerSettings.probes = std::max(1U, probes);
+      if (breakerSettings.window < 1)
+        throw Fmi::Exception(BCP, "backend.circuit_breaker.window must be at least one second");
+
+      auto &readSizeSettings = backendSettings.readSize;
+      const char *min_read_size = "backend.read_size.min";
+      const char *max_read_size = "backend.read_size.max";
+      const char *total_read_size = "backend.read_size.total";
+      if (config.exists(min_read_size))
+        readSizeSettings.minSize = parse_size(config.lookup(min_read_size), min_read_size);
+      if (config.exists(max_read_size))
+        readSizeSettings.maxSize = parse_size(config.lookup(max_read_size), max_read_size);
+      if (config.exists(total_read_size))
+        readSizeSettings.totalSize = parse_size(config.lookup(total_read_size), total_read_size);
+
+      auto &flowControlSettings = backendSettings.flowControl;
+      const char *stream_window = "backend.flow_control.window";
+      const char *throttle_window = "backend.flow_control.throttle_window";
+      const char *total_stream_size = "backend.flow_control.total";
+      if (config.exists(stream_window))
+        flowControlSettings.window = parse_size(config.lookup(stream_window), stream_window);
+      if (config.exists(throttle_window))
+        flowControlSettings.throttleWindow =
+            parse_size(config.lookup(throttle_window), throttle_window);
+      if (config.exists(total_stream_size))
+        flowControlSettings.totalSize =
+            parse_size(config.lookup(total_stream_size), total_stream_size);
     }
     catch (const libconfig::ParseException &e)
     {
@@ -342,11 +884,17 @@ HTTP::HTTP(Spine::Reactor *theReactor, const char *theConfig)
       throw Fmi::Exception::Trace(BCP, "Configuration error!");
     }
 
-    itsProxy = Proxy::create(memorySize,
-                             filesystemSize,
-                             std::filesystem::path(filesystemCachePath),
-                             backendThreadCount,
-                             backendTimeoutInSeconds);
+    cacheSettings.memorySize = memorySize;
+    cacheSettings.filesystemSize = filesystemSize;
+    cacheSettings.directory = std::filesystem::path(filesystemCachePath);
+
+    itsProxy = Proxy::create(cacheSettings, backendSettings);
+
+    itsHotRequests.reset(
+        new HotRequestTracker(itsWarmupSettings.enabled ? itsWarmupSettings.requests : 0));
+    itsRetryBudget.reset(new RetryBudget(retrySettings));
+    if (itsWarmupSettings.enabled)
+      itsWarmupThread = std::thread([this] { warmupLoop(); });
 
     // Start the "Catcher in the Rye" process in SmartMet core. Must be registered only
     // after itsProxy is fully constructed: the handler dereferences itsProxy, and the
@@ -372,6 +920,14 @@ HTTP::~HTTP()
   // Must remove the Catcher in the Rye hook from SmartMet core
   // to avoid calling unloaded code.
   this->itsReactor->setNoMatchHandler(0);  // NOLINT can't use nullptr in a boost function
+
+  {
+    std::lock_guard<std::mutex> lock(itsWarmupMutex);
+    itsShuttingDown = true;
+  }
+  itsWarmupCondition.notify_one();
+  if (itsWarmupThread.joinable())
+    itsWarmupThread.join();
 }
 
 void HTTP::shutdown()
@@ -379,6 +935,15 @@ void HTTP::shutdown()
   try
   {
     std::cout << "  -- Shutdown requested (HTTP)" << std::endl;
+
+    {
+      std::lock_guard<std::mutex> lock(itsWarmupMutex);
+      itsShuttingDown = true;
+    }
+    itsWarmupCondition.notify_one();
+    if (itsWarmupThread.joinable())
+      itsWarmupThread.join();
+
     itsProxy->shutdown();
   }
   catch (...)
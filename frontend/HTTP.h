@@ -4,9 +4,18 @@
 #include <spine/HTTP.h>
 #include <spine/Reactor.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
 
+#include "HotRequestTracker.h"
 #include "Proxy.h"
+#include "RetryBudget.h"
 
 namespace SmartMet
 {
@@ -17,6 +26,18 @@ namespace Frontend
 class HTTP
 {
  public:
+  // Settings from the "response_cache.warmup" configuration block
+  struct WarmupSettings
+  {
+    bool enabled = false;
+    std::size_t requests = 1000;  // number of hot requests saved
+    int interval = 300;           // seconds between saving the hot requests
+    int startupDelay = 10;        // seconds to let Sputnik find the backends
+    std::size_t concurrency = 8;  // concurrent backend requests
+    int timeout = 120;            // seconds the frontend may stay paused
+    std::filesystem::path path;   // file of hot requests
+  };
+
   // Transport
   //
   // Called by HTTP thread, will contact the required HTTP server
@@ -45,6 +66,15 @@ class HTTP
 
   const std::shared_ptr<Proxy>& getProxy() const { return itsProxy; }
 
+  // Fetch the hot requests into the cache in the background
+  std::string requestWarmup();
+
+  // True while the cache is being warmed up, traffic should not be admitted meanwhile
+  bool isWarmingUp() const { return itsWarmingUp; }
+
+  Fmi::Cache::CacheStats getHotRequestStats() const { return itsHotRequests->getStats(); }
+  Fmi::Cache::CacheStats getRetryStats() const { return itsRetryBudget->getStats(); }
+
  private:
   // Pointer to Sputnik instance
   std::shared_ptr<Engine::Sputnik::Engine> itsSputnikProcess;
@@ -55,9 +85,36 @@ class HTTP
   // Access to the Reactor object (non-owning)
   Spine::Reactor* itsReactor;
 
+  // A request which may be retried fails without falling back to stale responses.
+  // Backends which fail are added to the set and not used again for the request.
   Proxy::ProxyStatus transport(Spine::Reactor& theReactor,
                                const Spine::HTTP::Request& theRequest,
-                               Spine::HTTP::Response& theResponse);
+                               Spine::HTTP::Response& theResponse,
+                               bool theMayRetry,
+                               std::set<std::string>& theFailedBackends);
+
+  // The resource to request from the backend, or an empty string if the request does not
+  // match the service
+  static std::string backendResource(const Spine::HTTP::Request& theRequest,
+                                     const BackendService& theService,
+                                     const std::string& theHostName);
+
+  // Save the hot requests periodically, and warm up the cache at startup and on request
+  void warmupLoop();
+  void warmup();
+
+  WarmupSettings itsWarmupSettings;
+  std::unique_ptr<HotRequestTracker> itsHotRequests;
+
+  // Resending GET requests to another backend after failures
+  std::unique_ptr<RetryBudget> itsRetryBudget;
+
+  std::thread itsWarmupThread;
+  std::mutex itsWarmupMutex;
+  std::condition_variable itsWarmupCondition;
+  bool itsWarmupRequested = false;
+  bool itsShuttingDown = false;
+  std::atomic<bool> itsWarmingUp{false};
 };
 
 }  // namespace Frontend
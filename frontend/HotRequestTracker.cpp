@@ -0,0 +1,157 @@
+#include "HotRequestTracker.h"
+#include <macgyver/Exception.h>
+#include <algorithm>
+#include <fstream>
+#include <cstdlib>
+
+namespace SmartMet
+{
+namespace
+{
+// Requests tracked for each one reported, so that requests climbing up the list have a
+// chance to be counted
+const std::size_t tracked_per_reported = 10;
+}  // namespace
+
+HotRequestTracker::HotRequestTracker(std::size_t theSize)
+    : itsSize(theSize), itsStartTime(Fmi::MicrosecClock::universal_time())
+{
+}
+
+void HotRequestTracker::record(const std::string& theURI, const std::string& theEncoding)
+{
+  try
+  {
+    if (itsSize == 0 || theURI.find_first_of("\t\r\n") != std::string::npos)
+      return;
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    ++itsRecordCount;
+    ++itsCounts[theEncoding + '\t' + theURI];
+
+    if (itsCounts.size() <= tracked_per_reported * itsSize)
+      return;
+
+    for (auto it = itsCounts.begin(); it != itsCounts.end();)
+    {
+      it->second /= 2;
+      if (it->second == 0)
+        it = itsCounts.erase(it);
+      else
+        ++it;
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::vector<HotRequestTracker::HotRequest> HotRequestTracker::top() const
+{
+  try
+  {
+    std::vector<std::pair<std::size_t, std::string>> counts;
+    {
+      std::lock_guard<std::mutex> lock(itsMutex);
+      counts.reserve(itsCounts.size());
+      for (const auto& item : itsCounts)
+        counts.emplace_back(item.second, item.first);
+    }
+
+    const auto n = std::min(itsSize, counts.size());
+    std::partial_sort(counts.begin(),
+                      counts.begin() + n,
+                      counts.end(),
+                      [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    std::vector<HotRequest> result;
+    result.reserve(n);
+    for (std::size_t i = 0; i < n; i++)
+    {
+      const auto& key = counts[i].second;
+      const auto pos = key.find('\t');
+      HotRequest request;
+      request.encoding = key.substr(0, pos);
+      request.uri = key.substr(pos + 1);
+      request.count = counts[i].first;
+      result.push_back(std::move(request));
+    }
+    return result;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// One request per line: count, encoding and URI separated by tabs
+void HotRequestTracker::save(const std::filesystem::path& thePath) const
+{
+  try
+  {
+    const auto requests = top();
+
+    std::filesystem::create_directories(thePath.parent_path());
+
+    auto tmpPath = thePath;
+    tmpPath += ".tmp";
+    {
+      std::ofstream out(tmpPath, std::ios::trunc);
+      for (const auto& request : requests)
+        out << request.count << '\t' << request.encoding << '\t' << request.uri << '\n';
+      if (!out)
+        throw Fmi::Exception(BCP, "Failed to write the hot request list")
+            .addParameter("Path", tmpPath.string());
+    }
+    std::filesystem::rename(tmpPath, thePath);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::vector<HotRequestTracker::HotRequest> HotRequestTracker::load(
+    const std::filesystem::path& thePath)
+{
+  try
+  {
+    std::vector<HotRequest> result;
+
+    std::ifstream in(thePath);
+    std::string line;
+    while (std::getline(in, line))
+    {
+      const auto pos1 = line.find('\t');
+      const auto pos2 = (pos1 == std::string::npos ? pos1 : line.find('\t', pos1 + 1));
+      if (pos2 == std::string::npos || pos2 + 1 == line.size())
+        continue;
+
+      HotRequest request;
+      request.count = std::strtoul(line.c_str(), nullptr, 10);
+      request.encoding = line.substr(pos1 + 1, pos2 - pos1 - 1);
+      request.uri = line.substr(pos2 + 1);
+      result.push_back(std::move(request));
+    }
+    return result;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+Fmi::Cache::CacheStats HotRequestTracker::getStats() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.maxsize = tracked_per_reported * itsSize;
+  stats.size = itsCounts.size();
+  stats.hits = itsRecordCount;
+  return stats;
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <macgyver/CacheStats.h>
+#include <macgyver/DateTime.h>
+#include <cstddef>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace SmartMet
+{
+// Counts requests to find the most frequently requested ones, so that they can be
+// fetched into the cache at startup. The content encoding preferred by the client is
+// kept with the URI, since it selects the cached variant. The number of tracked requests
+// is bounded: when it is exceeded, all counts are halved and requests with no hits left
+// are forgotten, which also lets old favourites fade away.
+
+class HotRequestTracker
+{
+ public:
+  struct HotRequest
+  {
+    std::string uri;
+    std::string encoding;
+    std::size_t count = 0;
+  };
+
+  explicit HotRequestTracker(std::size_t theSize);
+
+  HotRequestTracker(const HotRequestTracker& other) = delete;
+  HotRequestTracker(HotRequestTracker&& other) = delete;
+  HotRequestTracker& operator=(const HotRequestTracker& other) = delete;
+  HotRequestTracker& operator=(HotRequestTracker&& other) = delete;
+
+  void record(const std::string& theURI, const std::string& theEncoding);
+
+  // The most frequent requests, most frequent first
+  std::vector<HotRequest> top() const;
+
+  // Write the most frequent requests to the file, replacing it atomically
+  void save(const std::filesystem::path& thePath) const;
+
+  // Requests saved earlier, an empty list if there is no file
+  static std::vector<HotRequest> load(const std::filesystem::path& thePath);
+
+  // Size is the number of tracked requests, hits the recorded requests
+  Fmi::Cache::CacheStats getStats() const;
+
+ private:
+  const std::size_t itsSize;  // number of requests reported by top()
+
+  mutable std::mutex itsMutex;
+  std::unordered_map<std::string, std::size_t> itsCounts;  // encoding TAB uri -> count
+
+  // Statistics
+  const Fmi::DateTime itsStartTime;
+  std::size_t itsRecordCount = 0;
+};
+
+}  // namespace SmartMet
@@ -0,0 +1,314 @@
+#include "LargeResponseStore.h"
+#include <fmt/format.h>
+#include <macgyver/Exception.h>
+#include <spine/Convenience.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+namespace SmartMet
+{
+namespace
+{
+const char* temp_suffix = ".part";
+}  // namespace
+
+LargeResponseStore::Writer::Writer(const std::filesystem::path& thePath)
+    : itsPath(thePath), itsFile(thePath, std::ios::binary | std::ios::trunc)
+{
+}
+
+LargeResponseStore::Writer::~Writer()
+{
+  if (itsPath.empty())
+    return;
+  itsFile.close();
+  std::error_code ignored_error;
+  std::filesystem::remove(itsPath, ignored_error);
+}
+
+void LargeResponseStore::Writer::append(const std::string& theData)
+{
+  if (theData.empty() || failed())
+    return;
+
+  itsFile.write(theData.data(), static_cast<std::streamsize>(theData.size()));
+  itsSize += theData.size();
+}
+
+LargeResponseStore::LargeResponseStore(const Settings& theSettings)
+    : itsSettings(theSettings), itsStartTime(Fmi::MicrosecClock::universal_time())
+{
+  try
+  {
+    if (itsSettings.enabled)
+      scan();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!")
+        .addParameter("Directory", itsSettings.directory.string());
+  }
+}
+
+std::filesystem::path LargeResponseStore::filePath(std::size_t theKey) const
+{
+  return itsSettings.directory / fmt::format("{:016x}", theKey);
+}
+
+std::filesystem::path LargeResponseStore::tempDirectory() const
+{
+  return itsSettings.directory / "tmp";
+}
+
+bool LargeResponseStore::hasFreeSpace() const
+{
+  std::error_code error;
+  const auto space = std::filesystem::space(itsSettings.directory, error);
+  return !error && space.available > itsSettings.minFreeSpace;
+}
+
+// Files left behind by the previous run are indexed so that they count towards the size
+// limit. Unfinished temporary files are removed.
+void LargeResponseStore::scan()
+{
+  std::filesystem::create_directories(tempDirectory());
+
+  for (const auto& entry : std::filesystem::directory_iterator(tempDirectory()))
+  {
+    if (entry.path().extension() == temp_suffix)
+    {
+      std::error_code ignored_error;
+      std::filesystem::remove(entry.path(), ignored_error);
+    }
+  }
+
+  std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> files;
+  for (const auto& entry : std::filesystem::directory_iterator(itsSettings.directory))
+    if (entry.is_regular_file())
+      files.emplace_back(entry.last_write_time(), entry.path());
+
+  // Oldest first, so that the most recent ones end up at the front of the LRU list
+  std::sort(files.begin(), files.end());
+
+  for (const auto& file : files)
+  {
+    const auto name = file.second.filename().string();
+    std::size_t pos = 0;
+    std::size_t key = 0;
+    try
+    {
+      key = std::stoull(name, &pos, 16);
+    }
+    catch (...)
+    {
+      continue;
+    }
+    if (pos != name.size() || key == 0)
+      continue;
+
+    std::error_code error;
+    const auto size = std::filesystem::file_size(file.second, error);
+    if (!error)
+      index(key, size);
+  }
+
+  evict();
+}
+
+std::unique_ptr<LargeResponseStore::Writer> LargeResponseStore::createWriter()
+{
+  try
+  {
+    if (!itsSettings.enabled || !hasFreeSpace())
+      return {};
+
+    std::size_t counter = 0;
+    {
+      std::lock_guard<std::mutex> lock(itsMutex);
+      counter = ++itsTempCounter;
+    }
+
+    auto path = tempDirectory() / fmt::format("{}.{}{}", getpid(), counter, temp_suffix);
+    std::unique_ptr<Writer> writer(new Writer(path));
+    if (writer->failed())
+      return {};
+    return writer;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// True if the file stored under the key has the same content as the given file
+bool LargeResponseStore::isStored(std::size_t theKey, const std::filesystem::path& thePath)
+{
+  auto stored = open(theKey);
+  auto file = MappedFile::open(thePath);
+  return stored && file && stored->size() == file->size() &&
+         std::memcmp(stored->data(), file->data(), file->size()) == 0;
+}
+
+std::size_t LargeResponseStore::commit(std::unique_ptr<Writer> theWriter, std::uint64_t theHash)
+{
+  try
+  {
+    if (!theWriter)
+      return 0;
+
+    theWriter->itsFile.close();
+    if (theWriter->itsFile.fail() || theWriter->itsSize == 0)
+      return 0;
+
+    // Combine the content hash with the size to make collisions of large files unlikely
+    std::size_t key = theHash ^ (theWriter->itsSize * 0x9e3779b97f4a7c15UL);
+    if (key == 0)
+      key = 1;
+
+    bool exists = false;
+    {
+      std::lock_guard<std::mutex> lock(itsMutex);
+      exists = (itsEntries.count(key) != 0);
+    }
+
+    // Share an identical stored file instead of replacing it. A different file with the
+    // same key must not replace it either, cached metadata may still refer to it.
+    if (exists)
+    {
+      const bool duplicate = isStored(key, theWriter->itsPath);
+
+      std::lock_guard<std::mutex> lock(itsMutex);
+      if (!duplicate)
+      {
+        ++itsCollisionCount;
+        return 0;
+      }
+      ++itsDuplicateCount;
+      itsDuplicateSize += theWriter->itsSize;
+      return key;
+    }
+
+    // The rename is atomic within the file system, readers see either no file or all of it
+    std::error_code error;
+    std::filesystem::rename(theWriter->itsPath, filePath(key), error);
+    if (error)
+    {
+      std::cout << fmt::format("{} Failed to store a large response in {}: {}",
+                               Spine::log_time_str(),
+                               itsSettings.directory.string(),
+                               error.message())
+                << std::endl;
+      return 0;
+    }
+    theWriter->itsPath.clear();
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    index(key, theWriter->itsSize);
+    ++itsInserts;
+    evict();
+
+    // The file itself may have been evicted to make room
+    return (itsEntries.count(key) != 0 ? key : 0);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::shared_ptr<MappedFile> LargeResponseStore::open(std::size_t theKey)
+{
+  try
+  {
+    {
+      std::lock_guard<std::mutex> lock(itsMutex);
+      auto pos = itsEntries.find(theKey);
+      if (pos == itsEntries.end())
+      {
+        ++itsMisses;
+        return {};
+      }
+      itsLru.splice(itsLru.begin(), itsLru, pos->second.lru);
+      ++itsHits;
+    }
+
+    // A concurrent eviction may remove the file, in which case opening it fails. Once
+    // mapped, the file remains readable even if it is evicted.
+    return MappedFile::open(filePath(theKey));
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Caller must hold the mutex, or be the constructor
+void LargeResponseStore::index(std::size_t theKey, std::size_t theSize)
+{
+  auto pos = itsEntries.find(theKey);
+  if (pos != itsEntries.end())
+  {
+    // Same content stored again
+    itsSize -= pos->second.size;
+    itsLru.erase(pos->second.lru);
+    itsEntries.erase(pos);
+  }
+
+  itsLru.push_front(theKey);
+  Entry entry;
+  entry.size = theSize;
+  entry.lru = itsLru.begin();
+  itsEntries.emplace(theKey, entry);
+  itsSize += theSize;
+}
+
+// Caller must hold the mutex, or be the constructor
+void LargeResponseStore::evict()
+{
+  while (!itsLru.empty() &&
+         ((itsSettings.maxSize > 0 && itsSize > itsSettings.maxSize) || !hasFreeSpace()))
+  {
+    const auto key = itsLru.back();
+    itsLru.pop_back();
+
+    auto pos = itsEntries.find(key);
+    itsSize -= pos->second.size;
+    itsEntries.erase(pos);
+
+    std::error_code ignored_error;
+    std::filesystem::remove(filePath(key), ignored_error);
+  }
+}
+
+Fmi::Cache::CacheStats LargeResponseStore::getStats() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.maxsize = itsSettings.maxSize;
+  stats.size = itsSize;
+  stats.inserts = itsInserts;
+  stats.hits = itsHits;
+  stats.misses = itsMisses;
+  return stats;
+}
+
+Fmi::Cache::CacheStats LargeResponseStore::getDuplicateStats() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.size = itsDuplicateSize;
+  stats.hits = itsDuplicateCount;
+  stats.misses = itsCollisionCount;
+  return stats;
+}
+
+}  // namespace SmartMet
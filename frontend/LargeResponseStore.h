@@ -0,0 +1,124 @@
+#pragma once
+
+#include "MappedFile.h"
+#include <macgyver/CacheStats.h>
+#include <macgyver/DateTime.h>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace SmartMet
+{
+// File storage for cached responses too large to be collected in memory. The body is
+// written to a temporary file while it is being streamed to the client, and renamed
+// into the store once it is complete, so readers never see partial files. The store is
+// bounded by the configured size and the free space left on the disk, and evicts the
+// least recently used files first.
+
+class LargeResponseStore
+{
+ public:
+  struct Settings
+  {
+    bool enabled = false;
+    std::filesystem::path directory;
+    std::size_t maxSize = 0;                    // total size of the files, zero for no limit
+    std::size_t minFreeSpace = 10737418240UL;   // free space to leave on the disk
+  };
+
+  // A response body being written to a temporary file. The file is removed unless
+  // committed to the store.
+  class Writer
+  {
+   public:
+    ~Writer();
+
+    Writer(const Writer& other) = delete;
+    Writer(Writer&& other) = delete;
+    Writer& operator=(const Writer& other) = delete;
+    Writer& operator=(Writer&& other) = delete;
+
+    void append(const std::string& theData);
+
+    std::size_t size() const { return itsSize; }
+
+    // True if writing has failed, for example because the disk is full
+    bool failed() const { return !itsFile.good(); }
+
+   private:
+    friend class LargeResponseStore;
+    explicit Writer(const std::filesystem::path& thePath);
+
+    std::filesystem::path itsPath;
+    std::ofstream itsFile;
+    std::size_t itsSize = 0;
+  };
+
+  explicit LargeResponseStore(const Settings& theSettings);
+
+  LargeResponseStore(const LargeResponseStore& other) = delete;
+  LargeResponseStore(LargeResponseStore&& other) = delete;
+  LargeResponseStore& operator=(const LargeResponseStore& other) = delete;
+  LargeResponseStore& operator=(LargeResponseStore&& other) = delete;
+
+  bool enabled() const { return itsSettings.enabled; }
+
+  // Start writing a new response, nullptr if the store is disabled or the disk is full
+  std::unique_ptr<Writer> createWriter();
+
+  // Move a completely written response with the given content hash into the store. If
+  // the same content is already stored, the new file is discarded and the stored one
+  // shared. Returns the key of the stored file, or zero if the response could not be
+  // stored.
+  std::size_t commit(std::unique_ptr<Writer> theWriter, std::uint64_t theHash);
+
+  // Mapping of a stored response, nullptr if it has been evicted
+  std::shared_ptr<MappedFile> open(std::size_t theKey);
+
+  // Size is the total size of the files and maxsize the configured limit
+  Fmi::Cache::CacheStats getStats() const;
+
+  // Hits are files discarded because identical content was already stored and size their
+  // total size, misses files not stored because different content had the same key
+  Fmi::Cache::CacheStats getDuplicateStats() const;
+
+ private:
+  struct Entry
+  {
+    std::size_t size = 0;
+    std::list<std::size_t>::iterator lru;
+  };
+
+  std::filesystem::path filePath(std::size_t theKey) const;
+  std::filesystem::path tempDirectory() const;
+  bool hasFreeSpace() const;
+  bool isStored(std::size_t theKey, const std::filesystem::path& thePath);
+  void index(std::size_t theKey, std::size_t theSize);
+  void evict();
+  void scan();
+
+  const Settings itsSettings;
+
+  mutable std::mutex itsMutex;
+  std::map<std::size_t, Entry> itsEntries;
+  std::list<std::size_t> itsLru;  // most recently used first
+  std::size_t itsSize = 0;
+  std::size_t itsTempCounter = 0;
+
+  // Statistics
+  const Fmi::DateTime itsStartTime;
+  std::size_t itsInserts = 0;
+  std::size_t itsHits = 0;
+  std::size_t itsMisses = 0;
+  std::size_t itsDuplicateCount = 0;
+  std::size_t itsDuplicateSize = 0;
+  std::size_t itsCollisionCount = 0;
+};
+
+}  // namespace SmartMet
@@ -1,4 +1,5 @@
 #include "LowLatencyGatewayStreamer.h"
+#include "CacheResponseBuilder.h"
 #include "Proxy.h"
 #include <fmt/format.h>
 #include <macgyver/StringConversion.h>
@@ -13,70 +14,19 @@ namespace ip = boost::asio::ip;
 
 namespace
 {
-#ifndef PROXY_MAX_BUFFER_SIZE
-const std::size_t proxy_max_buffer_size = 16777216;  // 16 MB
-#else
-const std::size_t proxy_max_buffer_size = PROXY_MAX_BUFFER_SIZE;
-#endif
-
-#ifndef PROXY_MAX_CACHED_BUFFER_SIZE
-const std::size_t proxy_max_cached_buffer_size = 20971520;  // 20 MB
-#else
-const std::size_t proxy_max_cached_buffer_size = PROXY_MAX_CACHED_BUFFER_SIZE;
-#endif
-
-// Format response header date as in "Fri, 27 Jul 2018 11:26:04 GMT"
-
-std::string makeDateString()
-{
-  try
-  {
-    return Fmi::to_http_string(Fmi::SecondClock::universal_time());
-  }
-  catch (...)
-  {
-    throw Fmi::Exception(BCP, "Failed to build HTTP response date");
-  }
-}
-
-// Return the content encoding to serve for this request, as a Content-Encoding token
-// ("gzip", "zstd", ...) or "" for the identity (uncompressed) representation.
-std::string clientAcceptsContentEncoding(const Spine::HTTP::Request& request)
-{
-  try
-  {
-    auto accept_encoding = request.getHeader("Accept-Encoding");
-    if (accept_encoding)
-    {
-      // Mirror the backend's preference order (see Server::select_content_encoding):
-      // prefer zstd, fall back to gzip, so the cached variant matches what the backend produced.
-      if (boost::algorithm::contains(*accept_encoding, "zstd"))
-        return "zstd";
-
-      if (*accept_encoding == "*")
-        return "gzip";  // Accepts everything, send zipped
-
-      if (boost::algorithm::contains(*accept_encoding, "gzip"))
-        return "gzip";
-      return "";
-    }
-    return "";
-  }
-  catch (...)
-  {
-    throw Fmi::Exception::Trace(BCP, "Operation failed!");
-  }
-}
-
 // Build metadata part of the response
 
 ResponseCache::CachedResponseMetaData build_metadata(const Spine::HTTP::Response& response)
 {
   ResponseCache::CachedResponseMetaData meta;
 
-  // Safe to dereference, checked earlier
-  meta.mime_type = *response.getHeader("Content-Type");
-  meta.etag = *response.getHeader("ETag");
+  auto mime_type = response.getHeader("Content-Type");
+  if (mime_type)
+    meta.mime_type = *mime_type;
+
+  auto etag = response.getHeader("ETag");
+  if (etag)
+    meta.etag = *etag;
 
   auto expires = response.getHeader("Expires");
   if (expires)
@@ -104,119 +54,90 @@ ResponseCache::CachedResponseMetaData build_metadata(const Spine::HTTP::Response
     boost::algorithm::trim(meta.content_encoding);
   }
 
+  // Tags for purging groups of responses, for example all products of a model run
+  for (const char* header : {"Surrogate-Key", "X-Cache-Tags"})
+  {
+    auto tags = response.getHeader(header);
+    if (!tags)
+      continue;
+    for (const auto& tag : CachePurgeIndex::splitTags(*tags))
+      meta.tags += (meta.tags.empty() ? "" : " ") + tag;
+  }
+
   return meta;
 }
 
-Spine::HTTP::Response buildCacheResponse(const Spine::HTTP::Request& originalRequest,
-                                         const std::shared_ptr<std::string>& cachedBuffer,
-                                         const ResponseCache::CachedResponseMetaData& metadata)
+// True if the response to the request may be shared with other identical requests.
+// Conditional and range requests get responses specific to the client.
+
+bool isCoalescable(const Spine::HTTP::Request& request)
 {
-  try
+  if (request.getMethod() != Spine::HTTP::RequestMethod::GET)
+    return false;
+
+  for (const char* header : {"Range",
+                             "If-Range",
+                             "If-Match",
+                             "If-None-Match",
+                             "If-Modified-Since",
+                             "If-Unmodified-Since"})
   {
-    Spine::HTTP::Response response;
-
-    response.setHeader("Date", makeDateString());
-    response.setHeader("Server", "SmartMet Synapse (" __TIME__ " " __DATE__ ")");
-    response.setHeader("X-Frontend-Server", boost::asio::ip::host_name());
-
-    if (response.getVersion() == "1.1")
-    {
-      response.setHeader("Connection",
-                         "close");  // Current implementation is one-request-per-Connection
-    }
+    if (request.getHeader(header))
+      return false;
+  }
+  return true;
+}
 
-    // The cache related response headers should be the same for 200 OK responses
-    // and 304 Not Modified responses. RFC7232: "The server generating a 304 response MUST generate
-    // any of the following header fields that would have been sent in a 200 (OK) response to the
-    // same request: Cache-Control, Content-Location, Date, ETag, Expires, and Vary."
+// True if the backend is willing to keep the connection open after this response
 
-    if (!metadata.expires.empty())
-      response.setHeader("Expires", metadata.expires);
-    else
-      response.setHeader("Expires", "Thu, 01 Jan 1970 00:00:00 GMT");
+bool backendAllowsKeepAlive(const Spine::HTTP::Response& response)
+{
+  if (response.getVersion() != "1.1")
+    return false;
 
-    if (!metadata.cache_control.empty())
-      response.setHeader("Cache-Control", metadata.cache_control);
-    else
-      response.setHeader("Cache-Control", "must-revalidate");
+  auto connection = response.getHeader("Connection");
+  return !(connection && boost::algorithm::icontains(*connection, "close"));
+}
 
-    if (!metadata.vary.empty())
-      response.setHeader("Vary", metadata.vary);
-    else
-      response.setHeader("Vary", "Accept-Encoding");
-
-    if (!metadata.access_control_allow_origin.empty())
-      response.setHeader("Access-Control-Allow-Origin", metadata.access_control_allow_origin);
-
-    // A cache hit means the ETag we hold is the current representation, so
-    // advertise it on every response (200 OK, 304 Not Modified and 412
-    // Precondition Failed alike). RFC 7232 requires the ETag to be present on
-    // a 304 response, and the current code omitted it there.
-    if (!metadata.etag.empty() && metadata.etag != "0")
-      response.setHeader("ETag", metadata.etag);
-
-    // Decide whether the client already holds the current representation and
-    // may be answered with "304 Not Modified", whether a conditional
-    // precondition failed and we must reply "412 Precondition Failed", or
-    // whether the full body has to be returned.
-    //
-    // ETagFilter::evaluate() interprets the If-Match / If-None-Match request
-    // headers (several entity-tags, the "*" wildcard, weak/strong comparison)
-    // and returns {full_response_required, suggested_status} per RFC 7232.
-    //
-    // Per RFC 7232 the If-Modified-Since header MUST be ignored when an
-    // entity-tag precondition is present, so it is only consulted otherwise.
-    // The frontend cache is validated purely by ETag and keeps no
-    // Last-Modified timestamp, so the date itself cannot be compared: a cache
-    // hit means the requested ETag is the current one, so a bare
-    // If-Modified-Since request is honoured with "304 Not Modified".
-
-    Spine::HTTP::ETagFilter etag_filter(originalRequest);
-
-    auto [full_response_required, suggested_status] = etag_filter.evaluate(metadata.etag);
-
-    if (full_response_required && !etag_filter.has_if_match() &&
-        !etag_filter.has_if_none_match() && originalRequest.getHeader("If-Modified-Since"))
-    {
-      full_response_required = false;
-      suggested_status = Spine::HTTP::Status::not_modified;
-    }
+}  // namespace
 
-    // This block prepares the client response
-    if (!full_response_required)
-    {
-      // 304 Not Modified or 412 Precondition Failed: no body
-      response.setStatus(suggested_status);
-    }
-    else
-    {
-      // No matching precondition: return the full cached body
+LowLatencyGatewayStreamer::~LowLatencyGatewayStreamer()
+{
+  try
+  {
+    // Release followers of an unfinished response
+    endCoalescing(false);
 
-      response.setHeader("Content-Type", metadata.mime_type);
-      if (!metadata.content_encoding.empty())
-        response.setHeader("Content-Encoding", metadata.content_encoding);
-      response.setHeader("Content-Length", std::to_string(cachedBuffer->size()));
+    if (itsReservedReadSize > 0)
+      itsProxy->getReceiveBufferBudget().release(itsReservedReadSize);
 
-      response.setHeader("X-Frontend-Cache-Hit", "true");
+    if (itsTimeout)
+      itsTimeout->disarm();
 
-      response.setStatus(Spine::HTTP::Status::ok);
-      response.setContent(cachedBuffer);
-    }
+    // Data the client never took
+    itsProxy->getStreamMemoryBudget().release(itsClientData.size());
 
-    return response;
+    if (!itsRevalidationKey.empty())
+      itsProxy->endRevalidation(itsRevalidationKey);
   }
   catch (...)
   {
-    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+    Fmi::Exception ex(BCP, "LowLatencyGatewayStreamer destructor failed", nullptr);
+    ex.printError();
   }
-}
-
-}  // namespace
 
-LowLatencyGatewayStreamer::~LowLatencyGatewayStreamer()
-{
   if (!itsFinishing)
+  {
     itsReactor.stopBackendRequest(itsHostName, itsPort);
+    itsProxy->getBackendBalancer().finish(itsHostName, itsPort);
+  }
+}
+
+// Run without a client: the response only refreshes the cache. The key is released
+// from the proxy's set of ongoing revalidations once done.
+void LowLatencyGatewayStreamer::detach(const std::string& theRevalidationKey)
+{
+  itsRevalidationKey = theRevalidationKey;
 }
 
 LowLatencyGatewayStreamer::LowLatencyGatewayStreamer(Private,
@@ -229,6 +150,7 @@ LowLatencyGatewayStreamer::LowLatencyGatewayStreamer(Private,
                                                      const Spine::HTTP::Request& theOriginalRequest)
     : itsOriginalRequest(theOriginalRequest),
       itsSocketBuffer(),
+      itsReadSize(theProxy->itsBackendSettings.readSize),
       itsHostName(std::move(theHostName)),
       itsIP(std::move(theIP)),
       itsPort(thePort),
@@ -237,7 +159,12 @@ LowLatencyGatewayStreamer::LowLatencyGatewayStreamer(Private,
       itsProxy(theProxy),
       itsReactor(theReactor)
 {
+  // Proxy::HTTPForward asks for keep-alive only when the connection pool is enabled
+  auto connection = itsOriginalRequest.getHeader("Connection");
+  itsKeepAlive = (connection && boost::algorithm::iequals(*connection, "keep-alive"));
+
   itsReactor.startBackendRequest(itsHostName, itsPort);
+  itsProxy->getBackendBalancer().start(itsHostName, itsPort);
 }
 
 // Factory method
@@ -268,67 +195,59 @@ void LowLatencyGatewayStreamer::markFinishing()
   {
     itsFinishing = true;
     itsReactor.stopBackendRequest(itsHostName, itsPort);
+    itsProxy->getBackendBalancer().finish(itsHostName, itsPort);
   }
 }
 
-// Begin backend communication
-bool LowLatencyGatewayStreamer::sendAndListen()
+// A follower whose leader did not share the response sends its own request after all
+void LowLatencyGatewayStreamer::markRequesting()
+{
+  if (itsFinishing)
+  {
+    itsFinishing = false;
+    itsReactor.startBackendRequest(itsHostName, itsPort);
+    itsProxy->getBackendBalancer().start(itsHostName, itsPort);
+  }
+}
+
+// Send itsRequestBuffer to the backend and continue reading the response with the given
+// handler. An open socket (a keep-alive connection whose previous response has been read)
+// is used as is, otherwise a pooled connection is taken or a new one opened. Everything
+// runs asynchronously on the backend io_context, the caller must hold itsMutex.
+void LowLatencyGatewayStreamer::startRequest(ReadHandler theHandler)
 {
   try
   {
-    ip::tcp::endpoint theEnd(boost::asio::ip::make_address(itsIP), itsPort);
-    boost::system::error_code err;
-    itsBackendSocket.connect(theEnd, err);
+    itsRequestStatus = RequestStatus::PENDING;
+    scheduleTimeout(itsProxy->itsBackendSettings.connectTimeoutInSeconds);
 
-    if (!!err)
+    if (itsBackendSocket.is_open())
     {
-      std::cout << fmt::format("{} Backend connection to {} failed with message '{}'",
-                               Spine::log_time_str(),
-                               itsIP,
-                               err.message())
-                << std::endl;
-      return false;
+      writeRequest(theHandler);
+      return;
     }
 
-    // We have determined that this option significantly improves frontend latency
-    boost::asio::ip::tcp::no_delay no_delay_option(true);
-    itsBackendSocket.set_option(no_delay_option);
-
-    // Attempt to write to the socket
-
-    // This header signals we query ETag from the backend
-    itsOriginalRequest.setHeader("X-Request-ETag", "true");
-
-    std::string content = itsOriginalRequest.toString();
-    boost::asio::write(itsBackendSocket, boost::asio::buffer(content), err);
-    if (!!err)
+    if (itsKeepAlive)
     {
-      std::cout << fmt::format("{} Backend write to {} failed with message '{}'",
-                               Spine::log_time_str(),
-                               itsIP,
-                               err.message())
-                << std::endl;
-      return false;
+      auto connection = itsProxy->getConnectionPool().acquire(itsHostName, itsPort);
+      if (connection)
+      {
+        itsBackendSocket = std::move(connection->socket);
+        itsConnectionCreated = connection->created;
+        itsConnectionReused = true;
+        writeRequest(theHandler);
+        return;
+      }
     }
 
-    // Remove cache query header, it is no longer needed
-    itsOriginalRequest.removeHeader("X-Request-ETag");
-
-    // Start the timeout timer
-    itsTimeoutTimer = std::make_shared<DeadlineTimer>(
-        itsProxy->backendIoService, std::chrono::seconds(itsBackendTimeoutInSeconds));
-
-    itsTimeoutTimer->async_wait([me = shared_from_this()](const boost::system::error_code& err)
-                                { me->handleTimeout(err); });
-
-    // Start to listen for the reply, headers not yet received
-    std::shared_ptr<LowLatencyGatewayStreamer> me = shared_from_this();
-    itsBackendSocket.async_read_some(boost::asio::buffer(itsSocketBuffer),
-                                     [me](const boost::system::error_code& err,
-                                                               std::size_t bytes_transferred)
-                                     { me->readCacheResponse(err, bytes_transferred); });
+    itsConnectionReused = false;
+    itsConnectionCreated = BackendConnectionPool::Clock::now();
 
-    return true;
+    ip::tcp::endpoint theEnd(boost::asio::ip::make_address(itsIP), itsPort);
+    itsBackendSocket.async_connect(
+        theEnd,
+        [me = shared_from_this(), theHandler](const boost::system::error_code& err)
+        { me->handleConnect(err, theHandler); });
   }
   catch (...)
   {
@@ -336,306 +255,641 @@ bool LowLatencyGatewayStreamer::sendAndListen()
   }
 }
 
-// This function is called by the server when it can send more data
-std::string LowLatencyGatewayStreamer::getChunk()
+void LowLatencyGatewayStreamer::handleConnect(const boost::system::error_code& error,
+                                              ReadHandler theHandler)
 {
   try
   {
-    std::string returnedBuffer;
     boost::unique_lock<boost::mutex> lock(itsMutex);
-    if (itsClientDataBuffer.empty())
-    {
-      switch (itsGatewayStatus)
-      {
-        case GatewayStatus::ONGOING:
-          // Backend socket is open, but no data read. Slow connection to backend?
-          // Do a timed wait on the condition variable
-          itsDataAvailableEvent.timed_wait(lock, boost::posix_time::milliseconds(100));
-          break;
-
-        case GatewayStatus::FINISHED:
-          setStatus(ContentStreamer::StreamerStatus::EXIT_OK);
-          break;
-
-        case GatewayStatus::FAILED:
-          setStatus(ContentStreamer::StreamerStatus::EXIT_ERROR);
-          break;
-      }
-    }
-
-    returnedBuffer = itsClientDataBuffer;
-    itsClientDataBuffer.clear();
 
-    if (itsBackendBufferFull)
+    if (!!error)
     {
-      itsBackendBufferFull = false;
+      if (!itsCancelled)
+        std::cout << fmt::format("{} Backend connection to {} failed with message '{}'",
+                                 Spine::log_time_str(),
+                                 itsIP,
+                                 itsHasTimedOut ? std::string("connect timed out")
+                                                : error.message())
+                  << std::endl;
+      requestFailed();
+      return;
+    }
 
-      // Backend buffer was full
-      // Schedule new read from the socket now that we have extracted the buffer
-      itsBackendSocket.async_read_some(
-          boost::asio::buffer(itsSocketBuffer),
-          [me = shared_from_this()](const boost::system::error_code& err,
-                                    std::size_t bytes_transferred)
-          { me->readDataResponse(err, bytes_transferred); });
+    itsProxy->getConnectionPool().recordConnect();
 
-      // Reset timeout timer
-      itsTimeoutTimer->expires_after(std::chrono::seconds(itsBackendTimeoutInSeconds));
-    }
+    // We have determined that this option significantly improves frontend latency
+    boost::system::error_code ignored_error;
+    boost::asio::ip::tcp::no_delay no_delay_option(true);
+    itsBackendSocket.set_option(no_delay_option, ignored_error);
 
-    return returnedBuffer;
+    writeRequest(theHandler);
   }
   catch (...)
   {
-    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+    Fmi::Exception ex(BCP, "LowLatencyGatewayStreamer::handleConnect aborted", nullptr);
+    ex.printError();
+    // Must not throw or execution will terminate
   }
 }
 
-std::string LowLatencyGatewayStreamer::getPeekString(int pos, int len)
+// Write the current request to the backend
+void LowLatencyGatewayStreamer::writeRequest(ReadHandler theHandler)
+{
+  boost::asio::async_write(
+      itsBackendSocket,
+      boost::asio::buffer(itsRequestBuffer),
+      [me = shared_from_this(), theHandler](const boost::system::error_code& err, std::size_t)
+      { me->handleWrite(err, theHandler); });
+}
+
+void LowLatencyGatewayStreamer::handleWrite(const boost::system::error_code& error,
+                                            ReadHandler theHandler)
 {
   try
   {
     boost::unique_lock<boost::mutex> lock(itsMutex);
-    if (itsClientDataBuffer.empty())
+
+    if (!!error)
     {
-      switch (itsGatewayStatus)
+      // A stale pooled connection may fail already on write, try once with a new one
+      if (itsConnectionReused && !itsHasTimedOut && error != boost::asio::error::operation_aborted)
       {
-        case GatewayStatus::ONGOING:
-          // Backend socket is open, but no data read. Slow connection to backend?
-          // Do a timed wait on the condition variable
-          itsDataAvailableEvent.timed_wait(lock, boost::posix_time::milliseconds(100));
-          break;
-
-        case GatewayStatus::FINISHED:
-          setStatus(ContentStreamer::StreamerStatus::EXIT_OK);
-          break;
-
-        case GatewayStatus::FAILED:
-          setStatus(ContentStreamer::StreamerStatus::EXIT_ERROR);
-          break;
+        boost::system::error_code ignored_error;
+        itsBackendSocket.close(ignored_error);
+        itsKeepAlive = false;  // Do not take another pooled connection
+        startRequest(theHandler);
+        return;
       }
+
+      if (!itsCancelled)
+        std::cout << fmt::format("{} Backend write to {} failed with message '{}'",
+                                 Spine::log_time_str(),
+                                 itsIP,
+                                 itsHasTimedOut ? std::string("write timed out") : error.message())
+                  << std::endl;
+      requestFailed();
+      return;
     }
 
-    if (itsClientDataBuffer.empty())
-      return "";
+    itsRequestStatus = RequestStatus::SENT;
+    itsRequestSentTime = BackendBalancer::Clock::now();
+
+    // Start to listen for the reply, headers not yet received
+    readSocket(theHandler);
+    scheduleTimeout(itsBackendTimeoutInSeconds);
 
-    return itsClientDataBuffer.substr(pos, len);
+    itsDataAvailableEvent.notify_one();  // sendAndListen may be waiting for this
   }
   catch (...)
   {
-    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+    Fmi::Exception ex(BCP, "LowLatencyGatewayStreamer::handleWrite aborted", nullptr);
+    ex.printError();
+    // Must not throw or execution will terminate
   }
 }
 
-void LowLatencyGatewayStreamer::readCacheResponse(const boost::system::error_code& error,
-                                                  std::size_t bytes_transferred)
+// The request could not be delivered to the backend
+void LowLatencyGatewayStreamer::requestFailed()
 {
-  try
-  {
-    boost::unique_lock<boost::mutex> lock(itsMutex);
-
-    if (!!error)
-    {
-      handleError(error);
-      return;
-    }
+  boost::system::error_code ignored_error;
+  itsBackendSocket.close(ignored_error);
+  itsTimeout->disarm();
+
+  itsRequestStatus = RequestStatus::FAILED;
+  setGatewayStatus(GatewayStatus::FAILED);
+  endCoalescing(false);
+  itsDataAvailableEvent.notify_one();
+}
 
-    itsResponseHeaderBuffer.append(itsSocketBuffer.begin(), bytes_transferred);
+// (Re)start the inactivity timeout. Restarting with the current timeout only records the
+// activity, which is all that happens on every read.
+void LowLatencyGatewayStreamer::scheduleTimeout(int theTimeoutInSeconds)
+{
+  const std::chrono::seconds timeout(theTimeoutInSeconds);
+  if (itsTimeout->armed() && itsTimeout->timeout() == timeout)
+    itsTimeout->touch();
+  else
+    itsTimeout->arm(timeout);
+}
 
-    // Attempt to parse the response headers
-    auto ret = Spine::HTTP::parseResponse(itsResponseHeaderBuffer);
-    switch (std::get<0>(ret))
-    {
-      case Spine::HTTP::ParsingStatus::FAILED:
-      {
-        // Garbled response, handle error
-        std::cout << fmt::format(
-                         "{} Cache query to backend at {}:{} returned garbled response.\nQuery: "
-                         "{}\nResponse buffer: {}",
-                         Spine::log_time_str(),
-                         itsIP,
-                         itsPort,
-                         itsOriginalRequest.getQueryString(),
-                         itsResponseHeaderBuffer)
-                  << std::endl;
+// Read more data from the backend into the socket buffer
+void LowLatencyGatewayStreamer::readSocket(ReadHandler theHandler)
+{
+  itsBackendSocket.async_read_some(
+      boost::asio::buffer(itsSocketBuffer),
+      [me = shared_from_this(), theHandler](const boost::system::error_code& err,
+                                            std::size_t bytes_transferred)
+      { ((*me).*theHandler)(err, bytes_transferred); });
+}
 
-        itsGatewayStatus = GatewayStatus::FAILED;
+// Read response body data into a new buffer which can be passed on without copying
+void LowLatencyGatewayStreamer::readResponseBody()
+{
+  // The body length is known only with Content-Length framing
+  std::size_t remaining = 0;
+  if (itsBodyFraming.mode() == ResponseBodyFraming::Mode::CONTENT_LENGTH)
+    remaining = itsBodyFraming.remaining();
+
+  itsReservedReadSize = itsProxy->getReceiveBufferBudget().reserve(itsReadSize.next(remaining));
+  itsReceiveBuffer.resize(itsReservedReadSize);
+  itsBackendSocket.async_read_some(
+      boost::asio::buffer(&itsReceiveBuffer[0], itsReceiveBuffer.size()),
+      [me = shared_from_this()](const boost::system::error_code& err,
+                                std::size_t bytes_transferred)
+      { me->readDataResponse(err, bytes_transferred); });
+}
 
-        break;
-      }
-      case Spine::HTTP::ParsingStatus::INCOMPLETE:
-      {
-        // Partial response, read more data
+// Queue data for the client. Requires itsMutex to be held, which also makes this the
+// only producer of the queue. Only the consumer avoids the lock: the producer updates
+// the response state and the queue together, so that a client seeing the response
+// finished also sees all of its data.
+void LowLatencyGatewayStreamer::pushClientData(std::string&& theData)
+{
+  if (theData.empty() || !itsRevalidationKey.empty() || itsClientDetached)
+    return;
+  itsProxy->getStreamMemoryBudget().add(theData.size());
+  itsClientData.push(std::move(theData));
+  notifyClient();
+}
 
-        itsBackendSocket.async_read_some(
-            boost::asio::buffer(itsSocketBuffer),
-            [me = shared_from_this()](const boost::system::error_code& err,
-                                      std::size_t bytes_transferred)
-            { me->readCacheResponse(err, bytes_transferred); });
+// Wake up the client thread if it is waiting for data. Requires itsMutex to be held.
+void LowLatencyGatewayStreamer::notifyClient()
+{
+  if (itsClientWaiting)
+    itsDataAvailableEvent.notify_one();
+  if (itsResponseSignal)
+    itsResponseSignal->notify();
+}
 
-        // Reset timeout timer
-        itsTimeoutTimer->expires_after(std::chrono::seconds(itsBackendTimeoutInSeconds));
+// Requires itsMutex to be held
+void LowLatencyGatewayStreamer::setGatewayStatus(GatewayStatus theStatus)
+{
+  itsGatewayStatus = theStatus;
+  notifyClient();
+}
 
-        break;
-      }
-      case Spine::HTTP::ParsingStatus::COMPLETE:
-      {
-        // Successfull parse.
-        auto&& responsePtr = std::get<1>(ret);
+// A pooled connection may have been closed by the backend just as we sent the request.
+// If nothing at all was received, the request was not processed and can safely be sent
+// again on a fresh connection.
+bool LowLatencyGatewayStreamer::retryStaleConnection(const boost::system::error_code& error,
+                                                     ReadHandler theHandler)
+{
+  try
+  {
+    if (!itsConnectionReused || !itsResponseHeaderBuffer.empty() || itsHasTimedOut ||
+        error == boost::asio::error::operation_aborted)
+      return false;
 
-        // See if backend responded with ETag
-        auto etagHeader = responsePtr->getHeader("ETag");
-        if (!etagHeader)
-        {
-          // Backend responded without the ETag-header, this plugin doesn't support frontend
-          // caching. Pass response through as before
+    boost::system::error_code ignored_error;
+    itsBackendSocket.close(ignored_error);
+    itsKeepAlive = false;  // Do not take another pooled connection
 
-          itsResponseIsCacheable = false;
+    startRequest(theHandler);
+    return true;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-          itsClientDataBuffer = itsResponseHeaderBuffer;
+// Begin backend communication. The connect and the request write are done on the backend
+// threads, the calling server thread only waits until the request has been sent or has
+// failed, at most for the connect timeout.
+bool LowLatencyGatewayStreamer::sendAndListen()
+{
+  try
+  {
+    boost::unique_lock<boost::mutex> lock(itsMutex);
 
-          // Go to data response loop
-          itsBackendSocket.async_read_some(
-              boost::asio::buffer(itsSocketBuffer),
-              [me = shared_from_this()](const boost::system::error_code& err,
-                                        std::size_t bytes_transferred)
-              { me->readDataResponse(err, bytes_transferred); });
+    const bool detached = !itsRevalidationKey.empty();
 
-          // Reset timeout timer
-          itsTimeoutTimer->expires_after(std::chrono::seconds(itsBackendTimeoutInSeconds));
+    itsCoalescable = (!detached && !itsHedge && itsProxy->itsBackendSettings.coalesceRequests &&
+                      isCoalescable(itsOriginalRequest));
 
-          markFinishing();  // Remove backend communication from load balancing
+    if (itsOriginalRequest.getMethod() == Spine::HTTP::RequestMethod::GET)
+    {
+      // Needed for maintaining the request -> ETag index in both modes
+      itsRequestKey = makeRequestKey(itsOriginalRequest.getResource(), itsOriginalRequest);
 
-          itsDataAvailableEvent.notify_one();  // Tell consumer thread to proceed
-        }
-        else
-        {
-          std::string etag = *etagHeader;
+      if (itsProxy->itsBackendSettings.conditionalRequests)
+        prepareConditionalRequest();
+    }
 
-          // See if we should send a content-encoded response
-          auto accepted_content_type = clientAcceptsContentEncoding(itsOriginalRequest);
+    // This header signals we query ETag from the backend. Backends which understand
+    // conditional requests return the full response instead if no ETag matches.
+    itsOriginalRequest.setHeader("X-Request-ETag", "true");
 
-          auto& cache = itsProxy->getCache();
+    itsRequestBuffer = itsOriginalRequest.toString();
 
-          // Try the client's preferred encoding first
-          auto result = cache.getCachedBuffer(etag, accepted_content_type);
+    // Remove cache query header, it is no longer needed
+    itsOriginalRequest.removeHeader("X-Request-ETag");
 
-          // Fall back to the identity (uncompressed) representation if there is no encoded match
-          if (!result.first && !accepted_content_type.empty())
-            result = cache.getCachedBuffer(etag, "");
+    // Restore the client's own conditional headers, they are evaluated against the response
+    if (itsConditionalRequest)
+    {
+      itsOriginalRequest.removeHeader("X-Frontend-Conditional");
+      if (itsClientIfNoneMatch)
+        itsOriginalRequest.setHeader("If-None-Match", *itsClientIfNoneMatch);
+      else
+        itsOriginalRequest.removeHeader("If-None-Match");
+    }
 
-          if (!result.first)
-          {
-            // No match from either cache, request the data
-            sendContentRequest();
-            return;
-          }
+    // The wheel must not keep the streamer alive
+    std::weak_ptr<LowLatencyGatewayStreamer> weak_self = shared_from_this();
+    itsTimeout = itsProxy->getTimeoutWheel().create(
+        [weak_self]
+        {
+          if (auto me = weak_self.lock())
+            me->handleTimeout();
+        });
+
+    // Identical requests in conditional mode share the response from the start
+    if (itsConditionalRequest && !detached && startCoalescing("request\x1f" + itsRequestKey))
+      return true;
+
+    // Start to listen for the reply once sent. A conditional request may be answered with
+    // the full response at once.
+    if (itsConditionalRequest)
+      startRequest(&LowLatencyGatewayStreamer::readDataResponseHeaders);
+    else
+      startRequest(&LowLatencyGatewayStreamer::readCacheResponse);
 
-          // Found from the buffer cache
+    // Nobody waits for a background revalidation
+    if (detached)
+      return true;
 
-          // Make sure cached responses are not re-cached
-          itsResponseIsCacheable = false;
+    // The timeout timer aborts the connect, the extra second is just a safety margin
+    // in case the backend threads are not running
+    const auto max_wait =
+        boost::chrono::seconds(itsProxy->itsBackendSettings.connectTimeoutInSeconds + 1);
 
-          auto metadata = result.second;
-          auto response_buffer = result.first;
+    if (!itsDataAvailableEvent.wait_for(
+            lock, max_wait, [this] { return itsRequestStatus != RequestStatus::PENDING; }))
+      requestFailed();
 
-          // Note: The back end may update expiration times in its "not modified" responses. Hence
-          // we must update the cached response too. Note that we do not modify the cached object
-          // itself, only this particular response. We do not expect plugins to modify
-          // their cache_control flags, since we expect plugins to use Expires instead
-          // of Cache-Control: max-age
+    return (itsRequestStatus == RequestStatus::SENT);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-          auto expiresHeader = responsePtr->getHeader("Expires");
-          if (expiresHeader)
-            metadata.expires = *expiresHeader;
+// Wait a while for data unless some is already available. Requires itsMutex to be held.
+void LowLatencyGatewayStreamer::waitForClientData(boost::unique_lock<boost::mutex>& lock)
+{
+  if (isFollower())
+    followCoalescedResponse();
 
-          auto clientResponse = buildCacheResponse(itsOriginalRequest, response_buffer, metadata);
+  if (!itsClientData.empty())
+    return;
 
-          itsClientDataBuffer = clientResponse.toString();
+  switch (itsGatewayStatus)
+  {
+    case GatewayStatus::ONGOING:
+      // Backend socket is open, but no data read. Slow connection to backend?
+      // Sleep until data arrives or the status changes, the backend timeout guarantees
+      // the latter. Followers are woken up when the leader receives data.
+      itsClientWaiting = true;
+      itsDataAvailableEvent.wait_for(lock,
+                                     boost::chrono::seconds(itsBackendTimeoutInSeconds + 1),
+                                     [this]
+                                     {
+                                       if (isFollower())
+                                         followCoalescedResponse();
+                                       return !itsClientData.empty() ||
+                                              itsGatewayStatus != GatewayStatus::ONGOING;
+                                     });
+      itsClientWaiting = false;
+      break;
 
-          itsGatewayStatus =
-              GatewayStatus::FINISHED;  // Entire response content generated, we are done!
+    case GatewayStatus::FINISHED:
+      setStatus(ContentStreamer::StreamerStatus::EXIT_OK);
+      break;
 
-          // Explicitly close the socket here, since ASIO doesn't know the backend conversation is
-          // finished
-          // Backend socket will leak without this
-          boost::system::error_code ignored_error;
-          itsBackendSocket.close(ignored_error);
+    case GatewayStatus::FAILED:
+      setStatus(ContentStreamer::StreamerStatus::EXIT_ERROR);
+      break;
+  }
+}
 
-          markFinishing();  // Remove backend communication from load balancing
+// This function is called by the server when it can send more data
+std::string LowLatencyGatewayStreamer::getChunk()
+{
+  try
+  {
+    // Data is normally taken without locking, the lock is needed only to wait for more
+    // data or to resume reading from the backend
+    std::string returnedBuffer = itsClientData.popAll();
+
+    if (returnedBuffer.empty() || itsBackendBufferFull)
+    {
+      boost::unique_lock<boost::mutex> lock(itsMutex);
 
-          itsDataAvailableEvent.notify_one();  // Tell consumer thread to proceed
+      if (itsBackendBufferFull)
+      {
+        itsBackendBufferFull = false;
+
+        // Backend buffer was full
+        // Schedule new read from the socket now that we have extracted the buffer
+        readResponseBody();
+
+        // Reset timeout timer
+        scheduleTimeout(itsBackendTimeoutInSeconds);
+      }
+
+      if (returnedBuffer.empty())
+      {
+        // The headers of a cached file response may have been queued meanwhile
+        returnedBuffer = itsClientData.popAll();
+        if (returnedBuffer.empty() && itsCachedFileBody)
+        {
+          // Send the cached file after the headers
+          returnedBuffer = itsCachedFileBody->getChunk();
+          if (itsCachedFileBody->getStatus() != ContentStreamer::StreamerStatus::OK)
+          {
+            itsCachedFileBody.reset();
+            setGatewayStatus(GatewayStatus::FINISHED);
+          }
+          return returnedBuffer;
+        }
+
+        if (returnedBuffer.empty())
+        {
+          waitForClientData(lock);
+          returnedBuffer = itsClientData.popAll();
         }
       }
-      break;
     }
+
+    itsProxy->getStreamMemoryBudget().release(returnedBuffer.size());
+    return returnedBuffer;
   }
   catch (...)
   {
-    Fmi::Exception ex(BCP, "LowLatencyGatewayStreamer::readCacheResponse aborted", nullptr);
-    ex.printError();
-    // Must not throw or execution will terminate
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
   }
 }
 
-void LowLatencyGatewayStreamer::sendContentRequest()
+std::string LowLatencyGatewayStreamer::getPeekString(int pos, int len)
 {
   try
   {
-    // Close the socket since we make a new connection to the backend
-    // SmartMet doesn't currently support request pipelining
-    boost::system::error_code err;
-    itsBackendSocket.close(err);
+    if (itsClientData.empty())
+    {
+      boost::unique_lock<boost::mutex> lock(itsMutex);
+      waitForClientData(lock);
+    }
 
-    // Clear buffers just in case.
-    itsClientDataBuffer.clear();
-    itsResponseHeaderBuffer.clear();
-    itsCachedContent.clear();
+    return itsClientData.peek(pos, len);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-    ip::tcp::endpoint theEnd(boost::asio::ip::make_address(itsIP), itsPort);
+// Timeouts do not count, the backend may still be processing the request
+bool LowLatencyGatewayStreamer::failedBeforeResponse()
+{
+  boost::unique_lock<boost::mutex> lock(itsMutex);
+  return (itsGatewayStatus != GatewayStatus::ONGOING && itsClientData.empty() &&
+          itsResponseHeaderBuffer.empty() && !itsHasTimedOut && !isFollower());
+}
+
+// Must be set before sendAndListen
+void LowLatencyGatewayStreamer::setResponseSignal(std::shared_ptr<ResponseSignal> theSignal)
+{
+  boost::unique_lock<boost::mutex> lock(itsMutex);
+  itsResponseSignal = std::move(theSignal);
+}
 
-    itsBackendSocket.connect(theEnd, err);
+// Data for the client is available or the response has ended
+bool LowLatencyGatewayStreamer::responseStarted()
+{
+  boost::unique_lock<boost::mutex> lock(itsMutex);
+  return (!itsClientData.empty() || itsGatewayStatus == GatewayStatus::FINISHED);
+}
 
-    if (!!err)
+// Failed before any data for the client
+bool LowLatencyGatewayStreamer::responseFailed()
+{
+  boost::unique_lock<boost::mutex> lock(itsMutex);
+  return (itsGatewayStatus == GatewayStatus::FAILED && itsClientData.empty() && !isFollower());
+}
+
+// Called when the server releases the response, normally after it has been sent. A leader
+// still streaming the response finishes it for the followers.
+void LowLatencyGatewayStreamer::detachClient()
+{
+  try
+  {
+    boost::unique_lock<boost::mutex> lock(itsMutex);
+
+    itsResponseSignal.reset();
+    if (itsCoalescingLeader && itsCoalescedResponse)
+      releaseClient();
+  }
+  catch (...)
+  {
+    Fmi::Exception ex(BCP, "LowLatencyGatewayStreamer::detachClient failed", nullptr);
+    ex.printError();
+    // Called from a shared_ptr deleter, must not throw
+  }
+}
+
+// Drop the data nobody will take, and resume reading if the client had fallen behind.
+// Requires itsMutex to be held. Nobody consumes the queue any more, hence it may be
+// emptied here.
+void LowLatencyGatewayStreamer::releaseClient()
+{
+  try
+  {
+    itsClientDetached = true;
+    itsProxy->getStreamMemoryBudget().release(itsClientData.popAll().size());
+
+    if (itsBackendBufferFull)
     {
-      std::cout << fmt::format("{} Backend connection to {} failed with message '{}'",
-                               Spine::log_time_str(),
-                               itsIP,
-                               err.message())
-                << std::endl;
+      itsBackendBufferFull = false;
+      readResponseBody();
+      scheduleTimeout(itsBackendTimeoutInSeconds);
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-      itsGatewayStatus = GatewayStatus::FAILED;
+// Abandon the request after another copy responded first. A response shared with
+// identical requests is still read for them.
+void LowLatencyGatewayStreamer::cancel()
+{
+  try
+  {
+    boost::unique_lock<boost::mutex> lock(itsMutex);
 
+    itsResponseSignal.reset();
+    if (itsCoalescingLeader && itsCoalescedResponse)
+    {
+      releaseClient();
       return;
     }
 
-    std::string buffer = itsOriginalRequest.toString();
+    itsCancelled = true;
+    itsResponseIsCacheable = false;
+    if (itsTimeout)
+      itsTimeout->disarm();
 
-    boost::asio::write(itsBackendSocket, boost::asio::buffer(buffer), err);
+    // The handlers of the aborted operations see operation_aborted
+    boost::system::error_code ignored_error;
+    itsBackendSocket.close(ignored_error);
+    markFinishing();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-    if (!err)
-    {
-      // Start to listen for the reply, headers not yet received
-      itsBackendSocket.async_read_some(
-          boost::asio::buffer(itsSocketBuffer),
-          [me = shared_from_this()](const boost::system::error_code& err,
-                                    std::size_t bytes_transferred)
-          { me->readDataResponseHeaders(err, bytes_transferred); });
+void LowLatencyGatewayStreamer::readCacheResponse(const boost::system::error_code& error,
+                                                  std::size_t bytes_transferred)
+{
+  try
+  {
+    boost::unique_lock<boost::mutex> lock(itsMutex);
 
-      // Reset timeout timer
-      itsTimeoutTimer->expires_after(std::chrono::seconds(itsBackendTimeoutInSeconds));
+    if (!!error)
+    {
+      if (!retryStaleConnection(error, &LowLatencyGatewayStreamer::readCacheResponse))
+        handleError(error);
+      return;
     }
-    else
+
+    itsResponseHeaderBuffer.append(itsSocketBuffer.begin(), bytes_transferred);
+
+    // Attempt to parse the response headers
+    auto ret = Spine::HTTP::parseResponse(itsResponseHeaderBuffer);
+    switch (std::get<0>(ret))
     {
-      std::cout << fmt::format("{} Backed write to {} failed with message '{}'",
-                               Spine::log_time_str(),
-                               itsIP,
-                               err.message())
-                << std::endl;
+      case Spine::HTTP::ParsingStatus::FAILED:
+      {
+        // Garbled response, handle error
+        std::cout << fmt::format(
+                         "{} Cache query to backend at {}:{} returned garbled response.\nQuery: "
+                         "{}\nResponse buffer: {}",
+                         Spine::log_time_str(),
+                         itsIP,
+                         itsPort,
+                         itsOriginalRequest.getQueryString(),
+                         itsResponseHeaderBuffer)
+                  << std::endl;
+
+        setGatewayStatus(GatewayStatus::FAILED);
 
-      itsGatewayStatus = GatewayStatus::FAILED;
+        break;
+      }
+      case Spine::HTTP::ParsingStatus::INCOMPLETE:
+      {
+        // Partial response, read more data
+
+        readSocket(&LowLatencyGatewayStreamer::readCacheResponse);
+
+        // Reset timeout timer
+        scheduleTimeout(itsBackendTimeoutInSeconds);
+
+        break;
+      }
+      case Spine::HTTP::ParsingStatus::COMPLETE:
+      {
+        // Successfull parse.
+        auto&& responsePtr = std::get<1>(ret);
+
+        // Track the end of the response so that the connection can be reused
+        prepareConnectionReuse(*responsePtr);
+        auto parse_end_iter = std::get<2>(ret);
+        itsBodyFraming.consume(&*parse_end_iter,
+                               std::distance(parse_end_iter, itsResponseHeaderBuffer.cend()));
+
+        // See if backend responded with ETag
+        auto etagHeader = responsePtr->getHeader("ETag");
+        if (!etagHeader)
+        {
+          // Backend responded without the ETag-header, this plugin doesn't support frontend
+          // caching. Pass response through as before
+
+          itsResponseIsCacheable = false;
+
+          pushClientData(std::string(itsResponseHeaderBuffer));
+
+          if (itsBodyFraming.complete())
+            finishResponse();
+          else
+          {
+            // Go to data response loop
+            readResponseBody();
+
+            // Reset timeout timer
+            scheduleTimeout(itsBackendTimeoutInSeconds);
+          }
+
+          markFinishing();  // Remove backend communication from load balancing
+
+          notifyClient();  // Tell consumer thread to proceed
+        }
+        else if (!serveCachedResponse(*etagHeader, *responsePtr))
+        {
+          // No match from the cache. Share the response of an identical request already
+          // fetching the data, or request the data
+          const auto key =
+              *etagHeader + '\x1f' + clientAcceptsContentEncoding(itsOriginalRequest);
+          if (!startCoalescing(key))
+            sendContentRequest();
+        }
+      }
+      break;
     }
   }
   catch (...)
+  {
+    Fmi::Exception ex(BCP, "LowLatencyGatewayStreamer::readCacheResponse aborted", nullptr);
+    ex.printError();
+    // Must not throw or execution will terminate
+  }
+}
+
+void LowLatencyGatewayStreamer::sendContentRequest()
+{
+  try
+  {
+    // The ETag response leaves a keep-alive connection ready for the next request.
+    // Otherwise close the socket since we make a new connection to the backend,
+    // SmartMet doesn't currently support request pipelining
+    const bool reuse = (itsConnectionReusable && itsBodyFraming.complete() &&
+                        !itsBodyFraming.overrun() && itsBackendSocket.is_open());
+    if (!reuse)
+    {
+      boost::system::error_code ignored_error;
+      itsBackendSocket.close(ignored_error);
+    }
+    else
+      itsConnectionReused = true;  // The backend may still have closed it in between
+
+    // Clear buffers just in case. Nothing has been queued for the client yet.
+    itsResponseHeaderBuffer.clear();
+    itsCachedContent.clear();
+    itsCachedContentHash = ContentHash();
+    itsCachedFile.reset();
+    itsBodyFraming = ResponseBodyFraming();
+    itsConnectionReusable = false;
+
+    // The ETag request header was already removed, resend the plain request
+    itsRequestBuffer = itsOriginalRequest.toString();
+
+    startRequest(&LowLatencyGatewayStreamer::readDataResponseHeaders);
+  }
+  catch (...)
   {
     throw Fmi::Exception::Trace(BCP, "Operation failed!");
   }
@@ -651,7 +905,8 @@ void LowLatencyGatewayStreamer::readDataResponseHeaders(const boost::system::err
 
     if (!!error)
     {
-      handleError(error);
+      if (!retryStaleConnection(error, &LowLatencyGatewayStreamer::readDataResponseHeaders))
+        handleError(error);
       return;
     }
 
@@ -668,7 +923,7 @@ void LowLatencyGatewayStreamer::readDataResponseHeaders(const boost::system::err
                                  itsIP,
                                  itsPort)
                   << std::endl;
-        itsGatewayStatus = GatewayStatus::FAILED;
+        setGatewayStatus(GatewayStatus::FAILED);
         return;
       }
 
@@ -676,21 +931,28 @@ void LowLatencyGatewayStreamer::readDataResponseHeaders(const boost::system::err
       {
         // Partial response, read more data
 
-        itsBackendSocket.async_read_some(
-            boost::asio::buffer(itsSocketBuffer),
-            [me = shared_from_this()](const boost::system::error_code& err,
-                                      std::size_t bytes_transferred)
-            { me->readDataResponseHeaders(err, bytes_transferred); });
+        readSocket(&LowLatencyGatewayStreamer::readDataResponseHeaders);
 
         // Reset timeout timer
-        itsTimeoutTimer->expires_after(std::chrono::seconds(itsBackendTimeoutInSeconds));
+        scheduleTimeout(itsBackendTimeoutInSeconds);
 
         return;
       }
       case Spine::HTTP::ParsingStatus::COMPLETE:
       {
+        itsProxy->getBackendBalancer().recordFirstByte(
+            itsHostName, itsPort, BackendBalancer::Clock::now() - itsRequestSentTime);
+
         // Headers parsed, determine if we should attempt cache insertion
         auto&& responsePtr = std::get<1>(ret);
+        auto parse_end_iter = std::get<2>(ret);
+
+        if (itsConditionalRequest && (responsePtr->getStatus() == Spine::HTTP::Status::no_content ||
+                                      responsePtr->getStatus() == Spine::HTTP::Status::not_modified))
+        {
+          handleNotModified(*responsePtr, parse_end_iter);
+          break;
+        }
 
         auto etag = responsePtr->getHeader("ETag");
 
@@ -716,40 +978,61 @@ void LowLatencyGatewayStreamer::readDataResponseHeaders(const boost::system::err
             // Cacheable response, build cache metadata and store it for later use when writing to
             // the cache
             itsBackendMetadata = build_metadata(*responsePtr);
-
-            auto parse_end_iter = std::get<2>(ret);
-            std::string bodyThusFar = std::string(parse_end_iter, itsResponseHeaderBuffer.cend());
+            itsBackendMetadata.partition =
+                itsProxy->getCache().findPartition(itsOriginalRequest.getResource());
 
             // Content to be cached is stored separately from the entire stream
-            itsCachedContent = bodyThusFar;
+            itsCachedContent.assign(parse_end_iter, itsResponseHeaderBuffer.cend());
+            itsCachedContentHash = ContentHash();
+            itsCachedContentHash.update(itsCachedContent);
           }
-
-          // This data is ready to be sent to client
-          itsClientDataBuffer = itsResponseHeaderBuffer;
-
-          itsBackendSocket.async_read_some(
-              boost::asio::buffer(itsSocketBuffer),
-              [me = shared_from_this()](const boost::system::error_code& err,
-                                        std::size_t bytes_transferred)
-              { me->readDataResponse(err, bytes_transferred); });
         }
         else
         {
           // No ETag, response is not cacheable
           itsResponseIsCacheable = false;
+        }
 
-          itsClientDataBuffer = itsResponseHeaderBuffer;
-          itsBackendSocket.async_read_some(
-              boost::asio::buffer(itsSocketBuffer),
-              [me = shared_from_this()](const boost::system::error_code& err,
-                                        std::size_t bytes_transferred)
-              { me->readDataResponse(err, bytes_transferred); });
+        // Track the end of the response so that the connection can be reused
+        prepareConnectionReuse(*responsePtr);
+        itsBodyFraming.consume(&*parse_end_iter,
+                               std::distance(parse_end_iter, itsResponseHeaderBuffer.cend()));
+
+        // Avoid reallocating the cached content when the size is known in advance
+        if (itsResponseIsCacheable &&
+            itsBodyFraming.mode() == ResponseBodyFraming::Mode::CONTENT_LENGTH)
+        {
+          const auto expected_size = itsCachedContent.size() + itsBodyFraming.remaining();
+          if (expected_size <= proxy_max_cached_buffer_size)
+            itsCachedContent.reserve(expected_size);
+          else
+            spillCachedContent();
         }
 
-        // Reset timeout timer
-        itsTimeoutTimer->expires_after(std::chrono::seconds(itsBackendTimeoutInSeconds));
+        // Only complete responses are shared with identical requests
+        if (itsCoalescingLeader)
+        {
+          if (responsePtr->getStatus() == Spine::HTTP::Status::ok)
+            publishCoalescedData(itsResponseHeaderBuffer);
+          else
+            endCoalescing(false);
+        }
+
+        // This data is ready to be sent to client
+        pushClientData(std::move(itsResponseHeaderBuffer));
+        itsResponseHeaderBuffer.clear();
+
+        if (itsBodyFraming.complete())
+          finishResponse();
+        else
+        {
+          readResponseBody();
+
+          // Reset timeout timer
+          scheduleTimeout(itsBackendTimeoutInSeconds);
+        }
 
-        itsDataAvailableEvent.notify_one();  // Tell consumer thread to proceed
+        notifyClient();  // Tell consumer thread to proceed
 
         break;
       }
@@ -770,46 +1053,65 @@ void LowLatencyGatewayStreamer::readDataResponse(const boost::system::error_code
   {
     boost::unique_lock<boost::mutex> lock(itsMutex);
 
+    const auto requested = itsReservedReadSize;
+    itsProxy->getReceiveBufferBudget().release(itsReservedReadSize);
+    itsReservedReadSize = 0;
+
     if (!!error)
     {
       handleError(error);
     }
     else
     {
-      itsClientDataBuffer.append(itsSocketBuffer.begin(), bytes_transferred);
+      itsReadSize.update(requested, bytes_transferred);
+
+      // Do not keep a large buffer in the client queue for a little data
+      itsReceiveBuffer.resize(bytes_transferred);
+      if (bytes_transferred < requested / 2)
+        itsReceiveBuffer.shrink_to_fit();
 
       if (itsResponseIsCacheable)
-      {
-        itsCachedContent.append(itsSocketBuffer.begin(), bytes_transferred);
+        appendCachedContent(itsReceiveBuffer);
 
-        if (itsCachedContent.size() > proxy_max_cached_buffer_size)
-        {
-          // Overflow, do not cache this response
-          itsResponseIsCacheable = false;
-          itsCachedContent.clear();
-        }
+      const bool complete = itsBodyFraming.consume(itsReceiveBuffer.data(), bytes_transferred);
+
+      publishCoalescedData(itsReceiveBuffer);
+
+      // The received buffer is handed over to the client as is
+      pushClientData(std::move(itsReceiveBuffer));
+      itsReceiveBuffer.clear();
+
+      if (complete)
+      {
+        // Keep-alive response fully received, the backend will not close the connection
+        finishResponse();
+        notifyClient();
+        return;
       }
 
-      if (itsClientDataBuffer.size() > proxy_max_buffer_size)
+      auto& budget = itsProxy->getStreamMemoryBudget();
+
+      // Do not hold a copy of a large response for the cache when memory is short
+      if (itsResponseIsCacheable && budget.exceeded() &&
+          itsCachedContent.size() > budget.getSettings().window)
+        spillCachedContent();
+
+      if (!itsClientDetached && budget.mustPause(itsClientData.size()))
       {
-        // Too much data in buffer
+        // The client is not keeping up
         // Signal the consumer thread to schedule the next read when buffer is extracted
         itsBackendBufferFull = true;
-        itsTimeoutTimer->cancel();
+        itsTimeout->disarm();
         return;
       }
       // Go back to listen the socket
-      itsBackendSocket.async_read_some(
-          boost::asio::buffer(itsSocketBuffer),
-          [me = shared_from_this()](const boost::system::error_code& err,
-                                    std::size_t bytes_transferred)
-          { me->readDataResponse(err, bytes_transferred); });
+      readResponseBody();
 
       // Reset timeout timer
-      itsTimeoutTimer->expires_after(std::chrono::seconds(itsBackendTimeoutInSeconds));
+      scheduleTimeout(itsBackendTimeoutInSeconds);
     }
 
-    itsDataAvailableEvent.notify_one();  // Tell consumer thread to proceed
+    notifyClient();  // Tell consumer thread to proceed
   }
   catch (...)
   {
@@ -819,21 +1121,332 @@ void LowLatencyGatewayStreamer::readDataResponse(const boost::system::error_code
   }
 }
 
+// Add the ETags of cached responses for this request to If-None-Match so that the backend
+// can answer with a short "not modified" response instead of the full content.
+void LowLatencyGatewayStreamer::prepareConditionalRequest()
+{
+  try
+  {
+    auto client_if_none_match = itsOriginalRequest.getHeader("If-None-Match");
+
+    // Any current representation matches, nothing to add. The client's header is forwarded
+    // unchanged and the answer is for the client, not for the frontend cache.
+    if (client_if_none_match && boost::algorithm::trim_copy(*client_if_none_match) == "*")
+      return;
+
+    itsConditionalRequest = true;
+    if (client_if_none_match)
+      itsClientIfNoneMatch = *client_if_none_match;
+
+    auto& cache = itsProxy->getCache();
+
+    std::string if_none_match = (client_if_none_match ? *client_if_none_match : std::string());
+
+    for (const auto& etag : cache.getKnownETags(itsRequestKey))
+    {
+      // Candidates we could not serve would only make the backend skip the response body
+      if (!hasCachedVariant(cache, etag))
+        continue;
+
+      if (boost::algorithm::contains(if_none_match, etag))
+        continue;
+
+      if (!if_none_match.empty())
+        if_none_match += ", ";
+      if_none_match += etag;
+    }
+
+    if (!if_none_match.empty())
+      itsOriginalRequest.setHeader("If-None-Match", if_none_match);
+
+    // Tells the backend the conditional headers come from the frontend. Backends which
+    // do not recognize it answer as if X-Request-ETag alone was sent.
+    itsOriginalRequest.setHeader("X-Frontend-Conditional", "1");
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Serve the response from the cache if the ETag is known. Returns false on a cache miss.
+bool LowLatencyGatewayStreamer::serveCachedResponse(const std::string& theETag,
+                                                    const Spine::HTTP::Response& theResponse)
+{
+  try
+  {
+    auto& cache = itsProxy->getCache();
+
+    // The best encoding accepted by the client
+    auto result = findCachedVariant(cache, theETag, itsOriginalRequest);
+
+    if (!result)
+      return false;
+
+    // Found from the buffer cache
+
+    // Make sure cached responses are not re-cached
+    itsResponseIsCacheable = false;
+
+    auto& metadata = result.metadata;
+
+    // Note: The back end may update expiration times in its "not modified" responses. Hence
+    // we must update the cached response too. Note that we do not modify the cached object
+    // itself, only this particular response. We do not expect plugins to modify
+    // their cache_control flags, since we expect plugins to use Expires instead
+    // of Cache-Control: max-age
+
+    auto expiresHeader = theResponse.getHeader("Expires");
+    if (expiresHeader)
+      metadata.expires = *expiresHeader;
+
+    // The backend has just confirmed the content, so it is fresh again
+    auto cacheControlHeader = theResponse.getHeader("Cache-Control");
+    if (cacheControlHeader)
+      metadata.cache_control = *cacheControlHeader;
+    cache.refreshCachedResponse(theETag, metadata.cache_control, metadata.expires);
+
+    if (!itsRequestKey.empty())
+      cache.rememberETag(itsRequestKey, theETag);
+
+    auto clientResponse = buildCacheResponse(itsOriginalRequest, result, false);
+
+    pushClientData(clientResponse.toString());
+
+    // A large response is sent from its file after the headers, getChunk finishes the stream
+    if (result.file && itsRevalidationKey.empty() &&
+        clientResponse.getStatus() == Spine::HTTP::Status::ok)
+      itsCachedFileBody = std::make_shared<FileContentStreamer>(result.file);
+    else
+      setGatewayStatus(GatewayStatus::FINISHED);  // Entire response content generated, we are done!
+    endCoalescing(true);  // Client specific response, not shared
+
+    // Explicitly close the socket here (or return it to the pool), since ASIO doesn't know
+    // the backend conversation is finished
+    // Backend socket will leak without this
+    releaseConnection();
+    itsTimeout->disarm();
+
+    markFinishing();  // Remove backend communication from load balancing
+
+    notifyClient();  // Tell consumer thread to proceed
+    return true;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// The backend answered a conditional request with 204 or 304: one of the ETags matched,
+// or a backend without conditional request support returned just the ETag.
+void LowLatencyGatewayStreamer::handleNotModified(const Spine::HTTP::Response& theResponse,
+                                                  std::string::const_iterator theBodyBegin)
+{
+  try
+  {
+    prepareConnectionReuse(theResponse);
+    itsBodyFraming.consume(&*theBodyBegin,
+                           std::distance(theBodyBegin, itsResponseHeaderBuffer.cend()));
+
+    itsResponseIsCacheable = false;
+    itsConditionalRequest = false;  // Any further not modified response is for the client
+
+    auto etag = theResponse.getHeader("ETag");
+    if (etag)
+    {
+      if (serveCachedResponse(*etag, theResponse))
+        return;
+
+      // Not cached (or evicted meanwhile), but the client may hold the current version
+      // itself. Answer 304 or 412 without fetching the content.
+      Spine::HTTP::ETagFilter etag_filter(itsOriginalRequest);
+      if (!etag_filter.evaluate(*etag).first)
+      {
+        ResponseCache::CachedContent content;
+        content.metadata = build_metadata(theResponse);
+        auto clientResponse = buildCacheResponse(itsOriginalRequest, content);
+        pushClientData(clientResponse.toString());
+        setGatewayStatus(GatewayStatus::FINISHED);
+        endCoalescing(true);
+
+        releaseConnection();
+        itsTimeout->disarm();
+        markFinishing();
+        notifyClient();
+        return;
+      }
+    }
+
+    // Nothing to answer with, request the content
+    sendContentRequest();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Decide whether the connection can be returned to the pool once the response has been read
+void LowLatencyGatewayStreamer::prepareConnectionReuse(const Spine::HTTP::Response& theResponse)
+{
+  itsBodyFraming = ResponseBodyFraming::fromResponse(theResponse);
+  itsConnectionReusable =
+      (itsKeepAlive && itsBodyFraming.delimited() && backendAllowsKeepAlive(theResponse));
+}
+
+void LowLatencyGatewayStreamer::releaseConnection()
+{
+  try
+  {
+    if (itsConnectionReusable && itsBodyFraming.complete() && !itsBodyFraming.overrun() &&
+        !itsHasTimedOut && !itsCancelled)
+    {
+      itsProxy->getConnectionPool().release(
+          itsHostName,
+          itsPort,
+          BackendConnectionPool::Connection{std::move(itsBackendSocket), itsConnectionCreated});
+    }
+    else
+    {
+      boost::system::error_code ignored_error;
+      itsBackendSocket.close(ignored_error);
+    }
+    itsConnectionReusable = false;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// The whole response has been received, either at EOF or at the end of a delimited
+// keep-alive response.
+void LowLatencyGatewayStreamer::finishResponse()
+{
+  try
+  {
+    // Call caching functionality here using the backend buffering thread
+    // We do not want to accidentally block any server threads
+    if (itsResponseIsCacheable && itsCachedFile && !itsHasTimedOut)
+    {
+      // Large response written to a file, the file is moved to the cache
+      auto& cache = itsProxy->getCache();
+      cache.insertCachedFile(
+          itsBackendMetadata, std::move(itsCachedFile), itsCachedContentHash.digest());
+
+      if (!itsRequestKey.empty())
+        cache.rememberETag(itsRequestKey, itsBackendMetadata.etag);
+    }
+    else if (itsResponseIsCacheable && !itsCachedContent.empty() && !itsHasTimedOut)
+    {
+      // Non-empty and cacheable string. Cache it
+
+      auto& cache = itsProxy->getCache();
+      auto buffer = std::make_shared<std::string>(std::move(itsCachedContent));
+      auto metadata =
+          cache.insertCachedBuffer(itsBackendMetadata, buffer, itsCachedContentHash.digest());
+
+      // Create compressed variants of identity responses in the background
+      itsProxy->getResponseCompressor().compress(metadata, buffer);
+
+      if (!itsRequestKey.empty())
+        cache.rememberETag(itsRequestKey, itsBackendMetadata.etag);
+    }
+
+    setGatewayStatus(GatewayStatus::FINISHED);
+    endCoalescing(true);
+
+    releaseConnection();
+    itsTimeout->disarm();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Collect response data for the cache. The content is hashed as it arrives so that the
+// cache does not need to read it again. The data is copied: the client queue owns the
+// received chunks, and the cache needs the whole response in one buffer.
+void LowLatencyGatewayStreamer::appendCachedContent(const std::string& theData)
+{
+  try
+  {
+    itsCachedContentHash.update(theData);
+
+    if (itsCachedFile)
+    {
+      itsCachedFile->append(theData);
+      if (itsCachedFile->failed())
+      {
+        // Out of disk space, do not cache this response
+        itsResponseIsCacheable = false;
+        itsCachedFile.reset();
+      }
+      return;
+    }
+
+    itsCachedContent.append(theData);
+
+    if (itsCachedContent.size() > proxy_max_cached_buffer_size)
+      spillCachedContent();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Continue collecting the response in a file instead of memory
+void LowLatencyGatewayStreamer::spillCachedContent()
+{
+  try
+  {
+    itsCachedFile = itsProxy->getCache().getLargeResponseStore().createWriter();
+    if (itsCachedFile)
+      itsCachedFile->append(itsCachedContent);
+
+    if (!itsCachedFile || itsCachedFile->failed())
+    {
+      // Overflow, do not cache this response
+      itsResponseIsCacheable = false;
+      itsCachedFile.reset();
+    }
+    std::string().swap(itsCachedContent);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
 // Function to handle timeouts
-void LowLatencyGatewayStreamer::handleTimeout(const boost::system::error_code& err)
+void LowLatencyGatewayStreamer::handleTimeout()
 {
   try
   {
     boost::unique_lock<boost::mutex> lock(itsMutex);
-    if (err != boost::asio::error::operation_aborted)
+
+    // Activity may have been recorded after the wheel checked the deadline
+    if (!itsTimeout->expired())
     {
-      // Cancel pending async tasks
-      // This means readSocket will be called with operation_aborted - error
-      itsHasTimedOut = true;
-      itsResponseIsCacheable = false;
+      if (itsTimeout->armed())
+        itsTimeout->arm(itsTimeout->timeout());
+      return;
     }
 
-    // The timer was pushed back
+    itsTimeout->disarm();
+    itsHasTimedOut = true;
+    itsResponseIsCacheable = false;
+
+    // Abort a connect or a request write which is taking too long, or cancel the pending
+    // read. The handlers of the aborted operations report the timeout.
+    boost::system::error_code ignored_error;
+    if (itsRequestStatus == RequestStatus::PENDING)
+      itsBackendSocket.close(ignored_error);
+    else
+      itsBackendSocket.cancel(ignored_error);
   }
   catch (...)
   {
@@ -848,28 +1461,23 @@ void LowLatencyGatewayStreamer::handleError(const boost::system::error_code& err
   try
   {
     // Socket has been closed or is borked
-    if (err == boost::asio::error::eof)
+    if (err == boost::asio::error::eof && itsBodyFraming.delimited() &&
+        !itsBodyFraming.complete())
     {
-      // Clean shutdown
-
-      // Call caching functionality here using the backend buffering thread
-      // We do not want to accidentally block any server threads
-      if (itsResponseIsCacheable && !itsCachedContent.empty() && !itsHasTimedOut)
-      {
-        // Non-empty and cacheable string. Cache it
-
-        auto& cache = itsProxy->getCache();
-        cache.insertCachedBuffer(itsBackendMetadata.etag,
-                                 itsBackendMetadata.mime_type,
-                                 itsBackendMetadata.cache_control,
-                                 itsBackendMetadata.expires,
-                                 itsBackendMetadata.vary,
-                                 itsBackendMetadata.access_control_allow_origin,
-                                 itsBackendMetadata.content_encoding,
-                                 std::make_shared<std::string>(itsCachedContent));
-      }
+      // The backend closed the connection before sending all it promised
+      std::cout << fmt::format("{} Connection to backend at {}:{} closed before the response ended",
+                               Spine::log_time_str(),
+                               itsIP,
+                               itsPort)
+                << std::endl;
 
-      itsGatewayStatus = GatewayStatus::FINISHED;
+      itsResponseIsCacheable = false;
+      setGatewayStatus(GatewayStatus::FAILED);
+    }
+    else if (err == boost::asio::error::eof)
+    {
+      // Clean shutdown
+      finishResponse();
     }
     else if (err == boost::asio::error::operation_aborted)
     {
@@ -883,7 +1491,7 @@ void LowLatencyGatewayStreamer::handleError(const boost::system::error_code& err
                                  itsBackendTimeoutInSeconds)
                   << std::endl;
 
-        itsGatewayStatus = GatewayStatus::FAILED;
+        setGatewayStatus(GatewayStatus::FAILED);
       }
 
       // If operation_aborted is fired but itHasTimedOut is not set,
@@ -900,10 +1508,150 @@ void LowLatencyGatewayStreamer::handleError(const boost::system::error_code& err
                        err.message())
                 << std::endl;
 
-      itsGatewayStatus = GatewayStatus::FAILED;
+      setGatewayStatus(GatewayStatus::FAILED);
     }
 
-    itsTimeoutTimer->cancel();
+    if (itsGatewayStatus == GatewayStatus::FAILED)
+      endCoalescing(false);
+
+    itsTimeout->disarm();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Attach to an in-flight response for the same content, or register this request as the
+// one fetching it. Returns true if the request was attached as a follower.
+bool LowLatencyGatewayStreamer::startCoalescing(const std::string& theKey)
+{
+  try
+  {
+    if (!itsCoalescable)
+      return false;
+
+    auto joined = itsProxy->getResponseCoalescer().join(theKey);
+    itsCoalescedResponse = joined.first;
+    itsCoalescingKey = theKey;
+    itsCoalescingLeader = joined.second;
+
+    if (itsCoalescingLeader)
+      return false;
+
+    // The follower does not need its own backend connection unless the leader's response
+    // turns out not to be shareable, in which case it is counted as requesting again
+    releaseConnection();
+    itsTimeout->disarm();
+    markFinishing();
+
+    // The leader's thread must not wait for our lock, the notification is passed on via
+    // the backend threads
+    std::weak_ptr<LowLatencyGatewayStreamer> weak_self = shared_from_this();
+    itsCoalescedResponse->subscribe(
+        [weak_self, executor = itsProxy->backendIoService.get_executor()]
+        {
+          boost::asio::post(executor,
+                            [weak_self]
+                            {
+                              if (auto me = weak_self.lock())
+                                me->coalescedDataAvailable();
+                            });
+        });
+
+    notifyClient();
+    return true;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Leader: pass received data on to the followers
+void LowLatencyGatewayStreamer::publishCoalescedData(const std::string& theData)
+{
+  try
+  {
+    if (!itsCoalescingLeader || !itsCoalescedResponse)
+      return;
+
+    itsCoalescedResponse->append(theData);
+
+    // All data is kept for the followers, do not let more of them join a large response
+    if (itsCoalescedResponse->size() > proxy_max_cached_buffer_size)
+      itsProxy->getResponseCoalescer().close(itsCoalescingKey, itsCoalescedResponse);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Leader: the response ended or will not be shared
+void LowLatencyGatewayStreamer::endCoalescing(bool theSuccess)
+{
+  try
+  {
+    if (!itsCoalescingLeader || !itsCoalescedResponse)
+      return;
+
+    itsProxy->getResponseCoalescer().close(itsCoalescingKey, itsCoalescedResponse);
+    itsCoalescedResponse->end(theSuccess);
+    itsCoalescedResponse.reset();
+    itsCoalescingLeader = false;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Follower: the leader has received more data or the response ended
+void LowLatencyGatewayStreamer::coalescedDataAvailable()
+{
+  boost::unique_lock<boost::mutex> lock(itsMutex);
+  notifyClient();
+}
+
+// Follower: copy new data from the leader. If the leader got a response which cannot be
+// shared, make our own request after all. Requires itsMutex to be held.
+void LowLatencyGatewayStreamer::followCoalescedResponse()
+{
+  try
+  {
+    std::vector<std::string> chunks;
+    const auto status = itsCoalescedResponse->read(itsCoalescedIndex, chunks);
+
+    for (auto& chunk : chunks)
+      pushClientData(std::move(chunk));
+
+    switch (status)
+    {
+      case CoalescedResponse::Status::PENDING:
+      case CoalescedResponse::Status::STREAMING:
+        return;
+      case CoalescedResponse::Status::FINISHED:
+        setGatewayStatus(GatewayStatus::FINISHED);
+        break;
+      case CoalescedResponse::Status::FAILED:
+        setGatewayStatus(GatewayStatus::FAILED);
+        break;
+      case CoalescedResponse::Status::NOT_SHARED:
+      {
+        itsCoalescedResponse.reset();
+        markRequesting();
+
+        // A conditional request has not been sent yet, after an ETag query the content
+        // request is still needed
+        if (itsConditionalRequest)
+          startRequest(&LowLatencyGatewayStreamer::readDataResponseHeaders);
+        else
+          sendContentRequest();
+        return;
+      }
+    }
+    itsCoalescedResponse.reset();
   }
   catch (...)
   {
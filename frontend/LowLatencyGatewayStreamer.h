@@ -1,8 +1,20 @@
 #pragma once
 
+#include "AdaptiveReadSize.h"
+#include "BackendBalancer.h"
+#include "BackendConnectionPool.h"
+#include "ClientDataQueue.h"
+#include "ContentHash.h"
+#include "FileContentStreamer.h"
+#include "ResponseBodyFraming.h"
 #include "ResponseCache.h"
+#include "ResponseCoalescer.h"
+#include "ResponseSignal.h"
+#include "TimeoutWheel.h"
 #include <boost/asio.hpp>
+#include <atomic>
 #include <memory>
+#include <optional>
 #include <spine/HTTP.h>
 #include <spine/Reactor.h>
 
@@ -23,6 +35,13 @@ class LowLatencyGatewayStreamer : public Spine::HTTP::ContentStreamer,
     FAILED
   };
 
+  enum class RequestStatus
+  {
+    PENDING,  // connecting or sending the request
+    SENT,
+    FAILED
+  };
+
   LowLatencyGatewayStreamer(Private,
                             const std::shared_ptr<Proxy> theProxy,
                             Spine::Reactor& theReactor,
@@ -48,18 +67,96 @@ class LowLatencyGatewayStreamer : public Spine::HTTP::ContentStreamer,
   LowLatencyGatewayStreamer& operator=(const LowLatencyGatewayStreamer& other) = delete;
   LowLatencyGatewayStreamer& operator=(LowLatencyGatewayStreamer&& other) = delete;
 
+  // Fetch the response for the cache only, with no client reading it
+  void detach(const std::string& theRevalidationKey);
+
   // Begin backend operations
   bool sendAndListen();
 
   std::string getChunk() override;
   virtual std::string getPeekString(int pos, int len);
 
+  // The backend failed before sending anything, the request may be sent elsewhere
+  bool failedBeforeResponse();
+
+  // Hedged requests: the copy sent to another backend does not take part in coalescing,
+  // and the copy losing the race is abandoned
+  void setResponseSignal(std::shared_ptr<ResponseSignal> theSignal);
+  void markHedge() { itsHedge = true; }
+  bool responseStarted();
+  bool responseFailed();
+  void cancel();
+
+  // The client is gone. A response shared with identical requests is still read for them.
+  void detachClient();
+
+  const std::string& getHostName() const { return itsHostName; }
+  unsigned short getPort() const { return itsPort; }
+
+  // Following the response fetched by an identical request
+  bool isFollower() const { return itsCoalescedResponse && !itsCoalescingLeader; }
+
  private:
-  using DeadlineTimer = boost::asio::basic_waitable_timer<std::chrono::steady_clock>;
+  using ReadHandler = void (LowLatencyGatewayStreamer::*)(const boost::system::error_code&,
+                                                          std::size_t);
 
   // Requests content from backend
   void sendContentRequest();
 
+  // Asynchronously connect (or take a pooled connection) and send itsRequestBuffer
+  void startRequest(ReadHandler theHandler);
+  void handleConnect(const boost::system::error_code& error, ReadHandler theHandler);
+  void writeRequest(ReadHandler theHandler);
+  void handleWrite(const boost::system::error_code& error, ReadHandler theHandler);
+
+  // Connecting or sending the request failed
+  void requestFailed();
+
+  // Stop queueing data for the client of a leader
+  void releaseClient();
+
+  // (Re)start the timeout timer
+  void scheduleTimeout(int theTimeoutInSeconds);
+
+  // Schedule a read from the backend socket into itsSocketBuffer
+  void readSocket(ReadHandler theHandler);
+
+  // Schedule a read of response body data into itsReceiveBuffer
+  void readResponseBody();
+
+  // Queue data for the client
+  void pushClientData(std::string&& theData);
+
+  // Wake up the client thread if it is waiting
+  void notifyClient();
+  void setGatewayStatus(GatewayStatus theStatus);
+
+  // Resend the request on a new connection if a pooled connection turned out to be stale
+  bool retryStaleConnection(const boost::system::error_code& error, ReadHandler theHandler);
+
+  // Add known ETags to the request as If-None-Match
+  void prepareConditionalRequest();
+
+  // Answer from the cache if the ETag is known
+  bool serveCachedResponse(const std::string& theETag, const Spine::HTTP::Response& theResponse);
+
+  // Handle a 204 or 304 response to a conditional request
+  void handleNotModified(const Spine::HTTP::Response& theResponse,
+                         std::string::const_iterator theBodyBegin);
+
+  // Decide from the response headers whether the connection may be reused
+  void prepareConnectionReuse(const Spine::HTTP::Response& theResponse);
+
+  // Return the connection to the pool if the response was completely read, else close it
+  void releaseConnection();
+
+  // The response has been completely received: cache it and finish the stream
+  void finishResponse();
+
+  // Collect the response for the cache, in memory or in a file when it grows large
+  void appendCachedContent(const std::string& theData);
+  void spillCachedContent();
+
   // This buffers backend response stream
   void readDataResponse(const boost::system::error_code& error, std::size_t bytes_transferred);
 
@@ -71,7 +168,7 @@ class LowLatencyGatewayStreamer : public Spine::HTTP::ContentStreamer,
   void readCacheResponse(const boost::system::error_code& error, std::size_t bytes_transferred);
 
   // Function to handle timeouts
-  void handleTimeout(const boost::system::error_code& err);
+  void handleTimeout();
 
   // Function to handle errors in backend communication
   void handleError(const boost::system::error_code& err);
@@ -79,33 +176,72 @@ class LowLatencyGatewayStreamer : public Spine::HTTP::ContentStreamer,
   // Function to mark the communication to be in finishing stages
   void markFinishing();
 
+  // Count the communication as in progress again after markFinishing
+  void markRequesting();
+
+  // Wait for data for the client (or the end of the response)
+  void waitForClientData(boost::unique_lock<boost::mutex>& lock);
+
+  // Share one backend response between identical concurrent requests
+  bool startCoalescing(const std::string& theKey);
+  void publishCoalescedData(const std::string& theData);
+  void endCoalescing(bool theSuccess);
+  void followCoalescedResponse();
+  void coalescedDataAvailable();
+
   // Flag to indicate if we should cache the response content
   bool itsResponseIsCacheable = true;
 
-  // Flag to indicate backend response buffer is full and needs to be extracted by the server
-  bool itsBackendBufferFull = false;
+  // Flag to indicate backend response buffer is full and needs to be extracted by the server.
+  // Set with itsMutex held, but checked without it.
+  std::atomic<bool> itsBackendBufferFull{false};
 
   // Saved request originating from the client
   Spine::HTTP::Request itsOriginalRequest;
 
-  // Buffer for socket operations
+  // Buffer for socket operations while reading response headers
   std::array<char, 8192> itsSocketBuffer;
 
-  // This buffer will be sent to client
-  std::string itsClientDataBuffer;
+  // Buffer for response body data. A new one is allocated for each read so that the
+  // received data can be moved to the client queue instead of being copied.
+  std::string itsReceiveBuffer;
+
+  // Size of the next body read, and the size reserved from the global budget for the
+  // pending read
+  AdaptiveReadSize itsReadSize;
+  std::size_t itsReservedReadSize = 0;
+
+  // Data to be sent to the client in the order received
+  ClientDataQueue itsClientData;
+
+  // The client thread is waiting for data or a status change
+  bool itsClientWaiting = false;
 
   // This buffer will hold backend headers
   std::string itsResponseHeaderBuffer;
 
-  // This buffer will go to the frontend cache
+  // This buffer will go to the frontend cache. It is a copy of the chunks passed to the
+  // client, since the cache stores each response as one contiguous buffer.
   std::string itsCachedContent;
 
+  // Large responses go to the cache through a file instead
+  std::unique_ptr<LargeResponseStore::Writer> itsCachedFile;
+
+  // Hash of the cached content received so far, in memory or in the file
+  ContentHash itsCachedContentHash;
+
+  // Large cached response sent to the client after the headers
+  std::shared_ptr<FileContentStreamer> itsCachedFileBody;
+
   // Metdata related to the cached response
   ResponseCache::CachedResponseMetaData itsBackendMetadata;
 
   // Gateway stream status
   GatewayStatus itsGatewayStatus = GatewayStatus::ONGOING;
 
+  // Status of the request currently being sent to the backend
+  RequestStatus itsRequestStatus = RequestStatus::PENDING;
+
   // Backend name
   std::string itsHostName;
 
@@ -124,8 +260,53 @@ class LowLatencyGatewayStreamer : public Spine::HTTP::ContentStreamer,
   // Socket
   boost::asio::ip::tcp::socket itsBackendSocket;
 
+  // Request was sent with "Connection: keep-alive"
+  bool itsKeepAlive = false;
+
+  // The socket was taken from the connection pool
+  bool itsConnectionReused = false;
+
+  // The backend allows the connection to be reused after the current response
+  bool itsConnectionReusable = false;
+
+  // When the current request was sent, for measuring the time to first byte
+  BackendBalancer::Clock::time_point itsRequestSentTime;
+
+  // Creation time of the current connection for the pool age limit
+  BackendConnectionPool::Clock::time_point itsConnectionCreated;
+
+  // Where the current backend response body ends
+  ResponseBodyFraming itsBodyFraming;
+
+  // The request currently sent to the backend, kept for resending
+  std::string itsRequestBuffer;
+
+  // A conditional request was sent, a 204 or 304 response refers to the frontend cache
+  bool itsConditionalRequest = false;
+
+  // Request -> ETag index key, set for GET requests
+  std::string itsRequestKey;
+
+  // Set for background revalidations of cached responses
+  std::string itsRevalidationKey;
+
+  // If-None-Match header sent by the client itself
+  std::optional<std::string> itsClientIfNoneMatch;
+
+  // The response may be shared with identical requests
+  bool itsCoalescable = false;
+
+  // Response shared with identical requests, either fetched by us (the leader) or
+  // being followed
+  std::shared_ptr<CoalescedResponse> itsCoalescedResponse;
+  std::string itsCoalescingKey;
+  bool itsCoalescingLeader = false;
+
+  // Next chunk of the followed response to read
+  std::size_t itsCoalescedIndex = 0;
+
   // Timer for backend timeouts
-  std::shared_ptr<DeadlineTimer> itsTimeoutTimer;
+  std::shared_ptr<TimeoutWheel::Timeout> itsTimeout;
 
   // Flag to signal backend connection has timed out
   bool itsHasTimedOut = false;
@@ -142,6 +323,17 @@ class LowLatencyGatewayStreamer : public Spine::HTTP::ContentStreamer,
   // Boolean to indicate whether the backend task is practically finished, but sockets may remain
   // open etc
   bool itsFinishing = false;
+
+  // A copy of a hedged request, and the signal for the thread waiting for either copy
+  bool itsHedge = false;
+  std::shared_ptr<ResponseSignal> itsResponseSignal;
+
+  // Abandoned after losing the race of a hedged request
+  bool itsCancelled = false;
+
+  // A leader whose own client is gone, either cancelled or disconnected. The response is
+  // still read for the followers, but no longer queued for the client.
+  bool itsClientDetached = false;
 };
 
 }  // namespace SmartMet
@@ -0,0 +1,40 @@
+#include "MappedFile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace SmartMet
+{
+std::shared_ptr<MappedFile> MappedFile::open(const std::filesystem::path& thePath)
+{
+  int fd = ::open(thePath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return {};
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0)
+  {
+    close(fd);
+    return {};
+  }
+
+  const auto size = static_cast<std::size_t>(st.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // The mapping keeps the file open
+
+  if (data == MAP_FAILED)
+    return {};
+
+  // Responses are sent from start to end
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  return std::shared_ptr<MappedFile>(new MappedFile(static_cast<const char*>(data), size));
+}
+
+MappedFile::~MappedFile()
+{
+  munmap(const_cast<char*>(itsData), itsSize);
+}
+
+}  // namespace SmartMet
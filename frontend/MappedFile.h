@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+
+namespace SmartMet
+{
+// Read-only memory mapping of a whole file. The mapping stays valid even if the file is
+// removed while it is in use.
+
+class MappedFile
+{
+ public:
+  // nullptr if the file cannot be opened or mapped
+  static std::shared_ptr<MappedFile> open(const std::filesystem::path& thePath);
+
+  ~MappedFile();
+
+  MappedFile(const MappedFile& other) = delete;
+  MappedFile(MappedFile&& other) = delete;
+  MappedFile& operator=(const MappedFile& other) = delete;
+  MappedFile& operator=(MappedFile&& other) = delete;
+
+  const char* data() const { return itsData; }
+  std::size_t size() const { return itsSize; }
+
+ private:
+  MappedFile(const char* theData, std::size_t theSize) : itsData(theData), itsSize(theSize) {}
+
+  const char* itsData;
+  std::size_t itsSize;
+};
+
+}  // namespace SmartMet
@@ -269,7 +269,9 @@ void Plugin::requestNoMatchInfo(Spine::Reactor& theReactor,
         backendHost,
         backendPort,
         theRequest.getResource(),
-        backendHost);
+        backendHost,
+        false,
+        std::nullopt);
 
     if (proxyStatus != Proxy::ProxyStatus::PROXY_SUCCESS)
     {
@@ -480,14 +482,90 @@ std::string Plugin::requestContinue(const Spine::HTTP::Request &theRequest)
   }
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Request a response cache warmup
+ */
+// ----------------------------------------------------------------------
+
+std::string Plugin::requestWarmup(const Spine::HTTP::Request & /* theRequest */)
+{
+  try
+  {
+    return itsHTTP->requestWarmup();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Remove responses from the cache by ETag, URI prefix or tag
+ */
+// ----------------------------------------------------------------------
+
+std::string Plugin::requestPurge(const Spine::HTTP::Request &theRequest)
+{
+  try
+  {
+    ResponseCache &cache = itsHTTP->getProxy()->getCache();
+
+    std::size_t count = 0;
+    std::string target;
+
+    auto etag_opt = theRequest.getParameter("etag");
+    auto prefix_opt = theRequest.getParameter("prefix");
+    auto tag_opt = theRequest.getParameter("tag");
+
+    if (etag_opt)
+    {
+      // Accept the ETag with or without the quotes
+      std::string etag = *etag_opt;
+      if (etag.empty() || etag.back() != '"')
+        etag = '"' + etag + '"';
+      count = cache.purgeETag(etag);
+      target = "ETag " + etag;
+    }
+    else if (prefix_opt && !prefix_opt->empty())
+    {
+      count = cache.purgePrefix(*prefix_opt);
+      target = "prefix " + *prefix_opt;
+    }
+    else if (tag_opt && !tag_opt->empty())
+    {
+      count = cache.purgeTag(*tag_opt);
+      target = "tag " + *tag_opt;
+    }
+    else
+      throw Fmi::Exception(BCP, "The etag, prefix or tag parameter is required");
+
+    std::cout << fmt::format(
+                     "{} Purged {} cached responses by {}", Spine::log_time_str(), count, target)
+              << std::endl;
+
+    return fmt::format("Purged {} cached responses by {}", count, target);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
 // ----------------------------------------------------------------------
 /*!
  * \brief Return true if Frontend is paused
+ *
+ * The frontend is also paused while the response cache is warmed up
  */
 // ----------------------------------------------------------------------
 
 bool Plugin::isPaused() const
 {
+  if (itsHTTP && itsHTTP->isWarmingUp())
+    return true;
+
   Spine::UpgradeReadLock readlock(itsPauseMutex);
   if (!itsPaused)
     return false;
@@ -830,6 +908,26 @@ void Frontend::Plugin::registerAdminRequests(Spine::Reactor& theReactor)
         throw Fmi::Exception(BCP, "Failed to register continue request handler");
   }
 
+  if (!theReactor.addAdminStringRequestHandler(
+        this,
+        "warmup",
+        AdminRequestAccess::RequiresAuthentication,
+        std::bind(&Plugin::requestWarmup, this, p::_2),
+        "Warm up the response cache with the most frequent requests"))
+  {
+        throw Fmi::Exception(BCP, "Failed to register warmup request handler");
+  }
+
+  if (!theReactor.addAdminStringRequestHandler(
+        this,
+        "purge",
+        AdminRequestAccess::RequiresAuthentication,
+        std::bind(&Plugin::requestPurge, this, p::_2),
+        "Remove responses from the cache by etag, URI prefix or tag"))
+  {
+        throw Fmi::Exception(BCP, "Failed to register purge request handler");
+  }
+
   // Register handler for unrecognized admin/info requests
   // This will forward them directly to backends that support the requested info type
   theReactor.addNoMatchAdminRequestHandler(
@@ -867,6 +965,38 @@ Fmi::Cache::CacheStatistics Plugin::getCacheStats() const
                             response_cache.getMemoryCacheStats()));
   ret.insert(std::make_pair("Frontend::response_cache::file_cache",
                             response_cache.getFileCacheStats()));
+  ret.insert(std::make_pair("Frontend::response_cache::index",
+                            response_cache.getIndexLogStats()));
+  ret.insert(std::make_pair("Frontend::response_cache::deduplication",
+                            response_cache.getDeduplicationStats()));
+  ret.insert(std::make_pair("Frontend::response_cache::admission",
+                            response_cache.getAdmissionStats()));
+  ret.insert(std::make_pair("Frontend::response_cache::object_hits",
+                            response_cache.getObjectHitStats()));
+  ret.insert(std::make_pair("Frontend::response_cache::byte_hits",
+                            response_cache.getByteHitStats()));
+  for (const auto &partition : response_cache.getPartitionStats())
+    ret.insert(std::make_pair("Frontend::response_cache::partition::" +
+                                  (partition.first.empty() ? "shared" : partition.first),
+                              partition.second));
+  ret.insert(std::make_pair("Frontend::backend_connection_pool",
+                            itsHTTP->getProxy()->getConnectionPool().getStats()));
+  ret.insert(std::make_pair("Frontend::backend_balancer",
+                            itsHTTP->getProxy()->getBackendBalancer().getStats()));
+  ret.insert(std::make_pair("Frontend::backend_retries", itsHTTP->getRetryStats()));
+  ret.insert(std::make_pair("Frontend::hedged_requests",
+                            itsHTTP->getProxy()->getRequestHedger().getStats()));
+  ret.insert(std::make_pair("Frontend::circuit_breaker",
+                            itsHTTP->getProxy()->getCircuitBreaker().getStats()));
+  ret.insert(std::make_pair("Frontend::coalesced_requests",
+                            itsHTTP->getProxy()->getResponseCoalescer().getStats()));
+  ret.insert(std::make_pair("Frontend::response_compressor",
+                            itsHTTP->getProxy()->getResponseCompressor().getStats()));
+  ret.insert(std::make_pair("Frontend::hot_requests", itsHTTP->getHotRequestStats()));
+  ret.insert(std::make_pair("Frontend::large_response_store",
+                            itsHTTP->getProxy()->getCache().getLargeResponseStore().getStats()));
+  ret.insert(std::make_pair("Frontend::stream_memory",
+                            itsHTTP->getProxy()->getStreamMemoryBudget().getStats()));
 
   return ret;
 }
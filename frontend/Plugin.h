@@ -99,6 +99,10 @@ class Plugin : public SmartMetPlugin
 
   std::string requestContinue(const SmartMet::Spine::HTTP::Request& theRequest);
 
+  std::string requestWarmup(const SmartMet::Spine::HTTP::Request& theRequest);
+
+  std::string requestPurge(const SmartMet::Spine::HTTP::Request& theRequest);
+
   static std::pair<std::string, bool> listRequests(Spine::Reactor& theReactor,
                                                    const Spine::HTTP::Request& theRequest,
                                                    Spine::HTTP::Response& theResponse);
@@ -1,4 +1,6 @@
 #include "Proxy.h"
+#include "CacheResponseBuilder.h"
+#include "ClientHandle.h"
 #include "LowLatencyGatewayStreamer.h"
 #include <boost/algorithm/string.hpp>
 #include <boost/asio.hpp>
@@ -8,6 +10,7 @@
 #include <macgyver/ThreadName.h>
 #include <macgyver/TimeFormatter.h>
 #include <spine/Convenience.h>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -16,6 +19,11 @@ namespace SmartMet
 {
 namespace
 {
+// Backend timeouts are checked four times a second. One revolution of the wheel covers
+// a bit over four minutes, longer timeouts wait in their slot for several rounds.
+const std::chrono::milliseconds timeout_tick_interval(250);
+const std::size_t timeout_wheel_slots = 1024;
+
 enum class BackendDenyReason
 {
   NONE,
@@ -74,21 +82,45 @@ BackendDenyReason parseBackendDenyReason(const std::string& responsePrefix)
 }  // namespace
 
 Proxy::Proxy(Proxy::Private,
-             std::size_t memoryCacheSize,
-             std::size_t filesystemCacheSize,
-             const std::filesystem::path& fileCachePath,
-             int theBackendThreadCount,
-             int theBackendTimeoutInSeconds)
-    : itsResponseCache(memoryCacheSize, filesystemCacheSize, fileCachePath),
-      backendIoService(theBackendThreadCount),
+             const ResponseCache::Settings& theCacheSettings,
+             const BackendSettings& theBackendSettings)
+    : itsBackendSettings(theBackendSettings),
+      itsResponseCache(theCacheSettings),
+      backendIoService(theBackendSettings.threadCount),
       idler(backendIoService.get_executor()),
-      itsBackendTimeoutInSeconds(theBackendTimeoutInSeconds)
+      itsConnectionPool(backendIoService, theBackendSettings.connectionPool),
+      itsBackendBalancer(theBackendSettings.balancer),
+      itsRequestHedger(theBackendSettings.hedging),
+      itsCircuitBreaker(theBackendSettings.circuitBreaker),
+      itsResponseCompressor(backendIoService, itsResponseCache),
+      itsReceiveBufferBudget(theBackendSettings.readSize),
+      itsTimeoutWheel(backendIoService, timeout_tick_interval, timeout_wheel_slots),
+      itsStreamMemoryBudget(theBackendSettings.flowControl)
 {
-  std::cout << fmt::format(fmt::runtime("Backend ASIO pool size = {}"), theBackendThreadCount) << std::endl;
-  std::cout << fmt::format(fmt::runtime("Backend timeout = {} seconds"), itsBackendTimeoutInSeconds) << std::endl;
+  std::cout << fmt::format(fmt::runtime("Backend ASIO pool size = {}"), itsBackendSettings.threadCount) << std::endl;
+  std::cout << fmt::format(fmt::runtime("Backend timeout = {} seconds"), itsBackendSettings.timeoutInSeconds) << std::endl;
+  std::cout << fmt::format(fmt::runtime("Backend connect timeout = {} seconds"), itsBackendSettings.connectTimeoutInSeconds) << std::endl;
+  if (itsBackendSettings.conditionalRequests)
+    std::cout << "Backend conditional requests enabled" << std::endl;
+  if (itsBackendSettings.coalesceRequests)
+    std::cout << "Backend request coalescing enabled" << std::endl;
+  if (itsBackendSettings.balancer.enabled)
+    std::cout << "Load aware backend selection enabled" << std::endl;
+  if (itsBackendSettings.hedging.enabled)
+    std::cout << "Hedged backend requests enabled" << std::endl;
+  if (itsBackendSettings.circuitBreaker.enabled)
+    std::cout << "Backend circuit breakers enabled" << std::endl;
+  if (theCacheSettings.serveFresh)
+    std::cout << fmt::format("Serving fresh cached responses, stale-while-revalidate {} seconds, "
+                             "stale-if-error {} seconds",
+                             theCacheSettings.staleWhileRevalidate,
+                             theCacheSettings.staleIfError)
+              << std::endl;
+  if (theCacheSettings.compression.enabled)
+    std::cout << "Compressing cached identity responses" << std::endl;
   try
   {
-    for (int i = 0; i < theBackendThreadCount; ++i)
+    for (int i = 0; i < itsBackendSettings.threadCount; ++i)
     {
       // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
       itsBackendThreads.add_thread(new boost::thread(
@@ -106,19 +138,13 @@ Proxy::Proxy(Proxy::Private,
 }
 
 std::shared_ptr<Proxy>
-Proxy::create(std::size_t memoryCacheSize,
-        std::size_t filesystemCacheSize,
-        const std::filesystem::path& fileCachePath,
-        int theBackendThreadCount,
-        int theBackendTimeoutInSeconds)
+Proxy::create(const ResponseCache::Settings& theCacheSettings,
+        const BackendSettings& theBackendSettings)
 {
   return std::make_shared<Proxy>(
         Private(),
-        memoryCacheSize,
-        filesystemCacheSize,
-        fileCachePath,
-        theBackendThreadCount,
-        theBackendTimeoutInSeconds);
+        theCacheSettings,
+        theBackendSettings);
 }
 
 ResponseCache& Proxy::getCache()
@@ -126,6 +152,51 @@ ResponseCache& Proxy::getCache()
   return itsResponseCache;
 }
 
+BackendConnectionPool& Proxy::getConnectionPool()
+{
+  return itsConnectionPool;
+}
+
+BackendBalancer& Proxy::getBackendBalancer()
+{
+  return itsBackendBalancer;
+}
+
+RequestHedger& Proxy::getRequestHedger()
+{
+  return itsRequestHedger;
+}
+
+CircuitBreaker& Proxy::getCircuitBreaker()
+{
+  return itsCircuitBreaker;
+}
+
+ResponseCoalescer& Proxy::getResponseCoalescer()
+{
+  return itsResponseCoalescer;
+}
+
+ResponseCompressor& Proxy::getResponseCompressor()
+{
+  return itsResponseCompressor;
+}
+
+ReceiveBufferBudget& Proxy::getReceiveBufferBudget()
+{
+  return itsReceiveBufferBudget;
+}
+
+TimeoutWheel& Proxy::getTimeoutWheel()
+{
+  return itsTimeoutWheel;
+}
+
+StreamMemoryBudget& Proxy::getStreamMemoryBudget()
+{
+  return itsStreamMemoryBudget;
+}
+
 void Proxy::shutdown()
 {
   try
@@ -135,6 +206,8 @@ void Proxy::shutdown()
               << std::endl;
     itsBackendThreads.interrupt_all();
     itsBackendThreads.join_all();
+    itsConnectionPool.shutdown();
+    itsTimeoutWheel.shutdown();
   }
   catch (...)
   {
@@ -142,13 +215,9 @@ void Proxy::shutdown()
   }
 }
 
-Proxy::ProxyStatus Proxy::HTTPForward(Spine::Reactor& theReactor,
-                                      const Spine::HTTP::Request& theRequest,
-                                      Spine::HTTP::Response& theResponse,
-                                      const std::string& theBackendIP,
-                                      int theBackendPort,
-                                      const std::string& theBackendURI,
-                                      const std::string& theHostName)
+Spine::HTTP::Request Proxy::makeForwardRequest(Spine::Reactor& theReactor,
+                                               const Spine::HTTP::Request& theRequest,
+                                               const std::string& theBackendURI) const
 {
   try
   {
@@ -175,7 +244,13 @@ Proxy::ProxyStatus Proxy::HTTPForward(Spine::Reactor& theReactor,
 
     fwdRequest.setHeader("X-Forwarded-For", theRequestOriginIP);
 
-    fwdRequest.setHeader("Connection", "close");
+    // Keep the backend connection open for reuse if pooling is enabled. Other methods
+    // than GET and POST are rare enough to always use a dedicated connection.
+    const bool keepAlive = itsConnectionPool.enabled() &&
+                           (theRequest.getMethod() == Spine::HTTP::RequestMethod::GET ||
+                            theRequest.getMethod() == Spine::HTTP::RequestMethod::POST);
+
+    fwdRequest.setHeader("Connection", keepAlive ? "keep-alive" : "close");
 
     // Establish used protocol. At FMI this is normally set by the F5 load balancer,
     // but in some environments the Frontend server must do this by itself
@@ -186,6 +261,30 @@ Proxy::ProxyStatus Proxy::HTTPForward(Spine::Reactor& theReactor,
       fwdRequest.setHeader("X-Forwarded-Proto", proto);
     }
 
+    return fwdRequest;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+Proxy::ProxyStatus Proxy::HTTPForward(Spine::Reactor& theReactor,
+                                      const Spine::HTTP::Request& theRequest,
+                                      Spine::HTTP::Response& theResponse,
+                                      const std::string& theBackendIP,
+                                      int theBackendPort,
+                                      const std::string& theBackendURI,
+                                      const std::string& theHostName,
+                                      bool theRetriable,
+                                      const std::optional<HedgeTarget>& theHedge)
+{
+  try
+  {
+    const auto startTime = RequestHedger::Clock::now();
+
+    Spine::HTTP::Request fwdRequest = makeForwardRequest(theReactor, theRequest, theBackendURI);
+
     std::shared_ptr<Proxy> sptr = shared_from_this();
     std::shared_ptr<LowLatencyGatewayStreamer> responseStreamer =
         LowLatencyGatewayStreamer::create(sptr,
@@ -193,9 +292,16 @@ Proxy::ProxyStatus Proxy::HTTPForward(Spine::Reactor& theReactor,
                                           theHostName,
                                           theBackendIP,
                                           theBackendPort,
-                                          itsBackendTimeoutInSeconds,
+                                          itsBackendSettings.timeoutInSeconds,
                                           fwdRequest);
 
+    std::shared_ptr<ResponseSignal> signal;
+    if (theHedge)
+    {
+      signal = std::make_shared<ResponseSignal>();
+      responseStreamer->setResponseSignal(signal);
+    }
+
     // Begin backend negotiation
     bool success = responseStreamer->sendAndListen();
     if (!success)
@@ -203,25 +309,51 @@ Proxy::ProxyStatus Proxy::HTTPForward(Spine::Reactor& theReactor,
       return ProxyStatus::PROXY_FAIL_REMOTE_HOST;
     }
 
+    // The proxy records the outcome of a winning hedge, the caller that of the primary
+    auto sentTime = startTime;
+    const auto primary = responseStreamer;
+    if (theHedge)
+      responseStreamer = raceHedge(
+          theReactor, theRequest, responseStreamer, signal, *theHedge, startTime, sentTime);
+    const bool hedgeServed = (responseStreamer != primary);
+
+    // Set the originating backend information, with hedging the caller learns from this
+    // which backend the status refers to
+    const std::string& hostName = responseStreamer->getHostName();
+    const int backendPort = responseStreamer->getPort();
+    theResponse.itsOriginatingBackend = hostName;
+    theResponse.itsBackendPort = backendPort;
+
     // This is a gateway response. To detect backend denial statuses before streaming,
     // inspect the beginning of the response byte stream.
     // Supports both legacy 4-digit status lines and 503 + X-SmartNet-Error.
     std::string responsePrefix = responseStreamer->getPeekString(0, 4096);
+
+    if (theRetriable && responsePrefix.empty() && responseStreamer->failedBeforeResponse())
+    {
+      std::cout << fmt::format("{} Backend {}:{} failed before responding",
+                               Spine::log_time_str(),
+                               hostName,
+                               backendPort)
+                << std::endl;
+      return ProxyStatus::PROXY_FAIL_REMOTE_HOST;
+    }
+
     switch (parseBackendDenyReason(responsePrefix))
     {
       case BackendDenyReason::SHUTDOWN:
         std::cout << fmt::format("{} *** Remote {}:{} shutting down, resending to another backend",
                                  Spine::log_time_str(),
-                                 theHostName,
-                                 theBackendPort)
+                                 hostName,
+                                 backendPort)
                   << std::endl;
         return ProxyStatus::PROXY_FAIL_REMOTE_DENIED;
 
       case BackendDenyReason::HIGH_LOAD:
         std::cout << fmt::format("{} *** Remote {}:{} has high load, resending to another backend",
                                  Spine::log_time_str(),
-                                 theHostName,
-                                 theBackendPort)
+                                 hostName,
+                                 backendPort)
                   << std::endl;
         return ProxyStatus::PROXY_FAIL_REMOTE_DENIED;
 
@@ -229,14 +361,21 @@ Proxy::ProxyStatus Proxy::HTTPForward(Spine::Reactor& theReactor,
         break;
     }
 
-    theResponse.setContent(responseStreamer);
+    // A coalescing leader keeps reading for its followers if the client disconnects
+    theResponse.setContent(
+        make_client_handle(responseStreamer, &LowLatencyGatewayStreamer::detachClient));
     theResponse.isGatewayResponse =
         true;  // This response is gateway response, it will be sent as a byte stream
     theResponse.setStatus(Spine::HTTP::Status::ok);
 
-    // Set the originating backend information
-    theResponse.itsOriginatingBackend = theHostName;
-    theResponse.itsBackendPort = theBackendPort;
+    if (hedgeServed && itsCircuitBreaker.enabled() &&
+        itsCircuitBreaker.recordSuccess(
+            hostName, backendPort, RequestHedger::Clock::now() - sentTime))
+      std::cout << fmt::format("{} Backend {}:{} has recovered, circuit closed",
+                               Spine::log_time_str(),
+                               hostName,
+                               backendPort)
+                << std::endl;
 
     return ProxyStatus::PROXY_SUCCESS;
   }
@@ -246,4 +385,293 @@ Proxy::ProxyStatus Proxy::HTTPForward(Spine::Reactor& theReactor,
   }
 }
 
+// The hedge is sent if the primary has neither responded nor failed within the delay, and
+// the first copy to respond wins. A copy failing before responding is not waited for.
+std::shared_ptr<LowLatencyGatewayStreamer> Proxy::raceHedge(
+    Spine::Reactor& theReactor,
+    const Spine::HTTP::Request& theRequest,
+    std::shared_ptr<LowLatencyGatewayStreamer> thePrimary,
+    const std::shared_ptr<ResponseSignal>& theSignal,
+    const HedgeTarget& theHedge,
+    RequestHedger::Clock::time_point theStartTime,
+    RequestHedger::Clock::time_point& theSentTime)
+{
+  try
+  {
+    using Clock = RequestHedger::Clock;
+
+    // The response is fetched by an identical request, which may have been hedged itself
+    if (thePrimary->isFollower())
+      return thePrimary;
+
+    const auto delay = itsRequestHedger.delay(theHedge.serviceURI);
+
+    // Like the client, wait at most for the backend timeout. The streamers time out first.
+    const auto giveUp =
+        theStartTime + std::chrono::seconds(itsBackendSettings.timeoutInSeconds + 1);
+    bool hedgeDue = delay.has_value();
+    auto deadline = (hedgeDue ? theStartTime + *delay : giveUp);
+
+    std::shared_ptr<LowLatencyGatewayStreamer> hedge;
+    std::shared_ptr<LowLatencyGatewayStreamer> winner;
+    bool responded = false;
+    Clock::time_point hedgeTime;
+
+    while (!winner)
+    {
+      theSignal->reset();
+
+      if (thePrimary->responseStarted())
+      {
+        winner = thePrimary;
+        responded = true;
+      }
+      else if (hedge && hedge->responseStarted())
+      {
+        winner = hedge;
+        responded = true;
+      }
+      else if (thePrimary->responseFailed() && (!hedge || hedge->responseFailed()))
+        winner = thePrimary;
+      else if (hedgeDue && Clock::now() >= deadline)
+      {
+        hedgeDue = false;
+        deadline = giveUp;
+        if (itsRequestHedger.tryHedge())
+        {
+          auto fwdRequest = makeForwardRequest(theReactor, theRequest, theHedge.backendURI);
+          hedge = LowLatencyGatewayStreamer::create(shared_from_this(),
+                                                    theReactor,
+                                                    theHedge.hostName,
+                                                    theHedge.IP,
+                                                    theHedge.port,
+                                                    itsBackendSettings.timeoutInSeconds,
+                                                    fwdRequest);
+          hedge->markHedge();
+          hedge->setResponseSignal(theSignal);
+          hedgeTime = Clock::now();
+          itsCircuitBreaker.start(theHedge.hostName, theHedge.port);
+          if (!hedge->sendAndListen())
+          {
+            itsRequestHedger.recordResult(false);
+            if (itsCircuitBreaker.enabled())
+              itsCircuitBreaker.recordFailure(theHedge.hostName, theHedge.port);
+            hedge.reset();
+          }
+        }
+      }
+      else if (!theSignal->waitUntil(deadline) && deadline == giveUp)
+        winner = thePrimary;
+    }
+
+    if (responded)
+      itsRequestHedger.recordFirstByte(theHedge.serviceURI, Clock::now() - theStartTime);
+
+    winner->setResponseSignal(nullptr);
+    if (hedge)
+    {
+      const bool hedgeWon = (winner == hedge);
+      auto loser = (hedgeWon ? thePrimary : hedge);
+      const bool loserFailed = loser->responseFailed();
+      loser->cancel();
+      itsRequestHedger.recordResult(hedgeWon);
+
+      // The caller accounts for the streamer it gets back, the circuit breaker learns
+      // about the other backend here. A loser which was merely slower gives back its
+      // probe without an outcome.
+      if (itsCircuitBreaker.enabled())
+      {
+        if (loserFailed)
+          itsCircuitBreaker.recordFailure(loser->getHostName(), loser->getPort());
+        else
+          itsCircuitBreaker.release(loser->getHostName(), loser->getPort());
+      }
+      if (hedgeWon)
+        theSentTime = hedgeTime;
+    }
+
+    return winner;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool Proxy::respondFromCache(Spine::Reactor& theReactor,
+                             const Spine::HTTP::Request& theRequest,
+                             Spine::HTTP::Response& theResponse,
+                             const std::string& theBackendIP,
+                             int theBackendPort,
+                             const std::string& theBackendURI,
+                             const std::string& theHostName)
+{
+  try
+  {
+    if (!itsResponseCache.getSettings().serveFresh ||
+        theRequest.getMethod() != Spine::HTTP::RequestMethod::GET)
+      return false;
+
+    // The client may insist on revalidation
+    auto cache_control = theRequest.getHeader("Cache-Control");
+    auto pragma = theRequest.getHeader("Pragma");
+    if ((cache_control && (boost::algorithm::icontains(*cache_control, "no-cache") ||
+                           boost::algorithm::icontains(*cache_control, "max-age=0"))) ||
+        (pragma && boost::algorithm::icontains(*pragma, "no-cache")))
+      return false;
+
+    const auto key = makeRequestKey(theBackendURI, theRequest);
+    auto result = findCachedResponse(theRequest, key);
+    if (!result)
+      return false;
+
+    const auto now = std::time(nullptr);
+    if (!itsResponseCache.isFresh(result.metadata, now))
+    {
+      if (!itsResponseCache.isUsableWhileRevalidating(result.metadata, now))
+        return false;
+      revalidate(theReactor, theRequest, theBackendIP, theBackendPort, theBackendURI, theHostName, key);
+    }
+
+    theResponse = buildCacheResponse(theRequest, result);
+    theResponse.removeHeader("Connection");  // Sent by the server, not as a gateway response
+    return true;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool Proxy::respondStale(const Spine::HTTP::Request& theRequest,
+                         Spine::HTTP::Response& theResponse,
+                         const std::string& theBackendURI)
+{
+  try
+  {
+    if (!itsResponseCache.getSettings().serveFresh ||
+        theRequest.getMethod() != Spine::HTTP::RequestMethod::GET)
+      return false;
+
+    auto result = findCachedResponse(theRequest, makeRequestKey(theBackendURI, theRequest));
+    if (!result || !itsResponseCache.isUsableOnError(result.metadata, std::time(nullptr)))
+      return false;
+
+    std::cout << fmt::format("{} Serving stale response to {}", Spine::log_time_str(), theRequest.getURI())
+              << std::endl;
+
+    theResponse = buildCacheResponse(theRequest, result);
+    theResponse.removeHeader("Connection");
+    return true;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+ResponseCache::CachedContent Proxy::findCachedResponse(const Spine::HTTP::Request& theRequest,
+                                                       const std::string& theRequestKey)
+{
+  // The most recent response to the request
+  auto etags = itsResponseCache.getKnownETags(theRequestKey);
+  if (etags.empty())
+    return {};
+  return findCachedVariant(itsResponseCache, etags.front(), theRequest);
+}
+
+void Proxy::revalidate(Spine::Reactor& theReactor,
+                       const Spine::HTTP::Request& theRequest,
+                       const std::string& theBackendIP,
+                       int theBackendPort,
+                       const std::string& theBackendURI,
+                       const std::string& theHostName,
+                       const std::string& theRequestKey)
+{
+  try
+  {
+    {
+      // Only one revalidation per request at a time
+      std::lock_guard<std::mutex> lock(itsRevalidationMutex);
+      if (!itsRevalidations.insert(theRequestKey).second)
+        return;
+    }
+
+    // The response must be the generic one, not an answer to the client's conditions
+    Spine::HTTP::Request fwdRequest = makeForwardRequest(theReactor, theRequest, theBackendURI);
+    for (const char* header : {"Range",
+                               "If-Range",
+                               "If-Match",
+                               "If-None-Match",
+                               "If-Modified-Since",
+                               "If-Unmodified-Since"})
+      fwdRequest.removeHeader(header);
+
+    auto streamer = LowLatencyGatewayStreamer::create(shared_from_this(),
+                                                      theReactor,
+                                                      theHostName,
+                                                      theBackendIP,
+                                                      theBackendPort,
+                                                      itsBackendSettings.timeoutInSeconds,
+                                                      fwdRequest);
+    streamer->detach(theRequestKey);
+    streamer->sendAndListen();
+  }
+  catch (...)
+  {
+    endRevalidation(theRequestKey);
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Proxy::endRevalidation(const std::string& theRequestKey)
+{
+  std::lock_guard<std::mutex> lock(itsRevalidationMutex);
+  itsRevalidations.erase(theRequestKey);
+  itsRevalidationDone.notify_all();
+}
+
+bool Proxy::prefetch(Spine::Reactor& theReactor,
+                     const Spine::HTTP::Request& theRequest,
+                     const std::string& theBackendIP,
+                     int theBackendPort,
+                     const std::string& theBackendURI,
+                     const std::string& theHostName,
+                     std::size_t theMaxFetches,
+                     std::chrono::steady_clock::time_point theDeadline)
+{
+  try
+  {
+    {
+      std::unique_lock<std::mutex> lock(itsRevalidationMutex);
+      const auto maxFetches = std::max<std::size_t>(1, theMaxFetches);
+      if (!itsRevalidationDone.wait_until(
+              lock,
+              theDeadline,
+              [this, maxFetches] { return itsRevalidations.size() < maxFetches; }))
+        return false;
+    }
+
+    revalidate(theReactor,
+               theRequest,
+               theBackendIP,
+               theBackendPort,
+               theBackendURI,
+               theHostName,
+               makeRequestKey(theBackendURI, theRequest));
+    return true;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool Proxy::waitForBackgroundFetches(std::chrono::steady_clock::time_point theDeadline)
+{
+  std::unique_lock<std::mutex> lock(itsRevalidationMutex);
+  return itsRevalidationDone.wait_until(
+      lock, theDeadline, [this] { return itsRevalidations.empty(); });
+}
+
 }  // namespace SmartMet
@@ -1,11 +1,26 @@
 #pragma once
 
+#include "AdaptiveReadSize.h"
+#include "BackendBalancer.h"
+#include "BackendConnectionPool.h"
+#include "CircuitBreaker.h"
+#include "RequestHedger.h"
 #include "ResponseCache.h"
+#include "ResponseCoalescer.h"
+#include "ResponseCompressor.h"
+#include "ResponseSignal.h"
+#include "StreamMemoryBudget.h"
+#include "TimeoutWheel.h"
 
 #include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
 #include <filesystem>
 #include <boost/functional/hash.hpp>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <boost/thread/condition.hpp>
 #include <boost/thread/thread.hpp>
 
@@ -16,6 +31,8 @@
 
 namespace SmartMet
 {
+class LowLatencyGatewayStreamer;
+
 class Proxy : public std::enable_shared_from_this<Proxy>
 {
   friend class LowLatencyGatewayStreamer;
@@ -35,43 +52,191 @@ class Proxy : public std::enable_shared_from_this<Proxy>
     PROXY_INTERNAL_ERROR = 500
   };
 
+  // Settings from the "backend" configuration block
+  struct BackendSettings
+  {
+    int threadCount = 20;
+    int timeoutInSeconds = 600;
+    int connectTimeoutInSeconds = 10;  // connecting and sending the request
+
+    // Revalidate cached responses with a single If-None-Match request instead of
+    // an ETag probe followed by a separate content request
+    bool conditionalRequests = false;
+
+    // Let identical concurrent requests share one backend response
+    bool coalesceRequests = false;
+
+    BackendConnectionPool::Settings connectionPool;
+
+    // Load aware choice between candidate backends
+    BackendBalancer::Settings balancer;
+
+    // Sending a copy of a slow request to another backend
+    RequestHedger::Settings hedging;
+
+    // Taking failing backends out of use until they recover
+    CircuitBreaker::Settings circuitBreaker;
+
+    // Sizes of response body reads
+    AdaptiveReadSize::Settings readSize;
+
+    // Data queued for clients
+    StreamMemoryBudget::Settings flowControl;
+  };
+
+  // Another backend of the same service for a hedged request
+  struct HedgeTarget
+  {
+    std::string serviceURI;
+    std::string IP;
+    int port = 0;
+    std::string hostName;
+    std::string backendURI;
+  };
+
   Proxy(Private,
-        std::size_t memoryCacheSize,
-        std::size_t filesystemCacheSize,
-        const std::filesystem::path& fileCachePath,
-        int theBackendThreadCount,
-        int theBackendTimeoutInSeconds);
+        const ResponseCache::Settings& theCacheSettings,
+        const BackendSettings& theBackendSettings);
 
   static std::shared_ptr<Proxy>
-  create(std::size_t memoryCacheSize,
-        std::size_t filesystemCacheSize,
-        const std::filesystem::path& fileCachePath,
-        int theBackendThreadCount,
-        int theBackendTimeoutInSeconds);
+  create(const ResponseCache::Settings& theCacheSettings,
+        const BackendSettings& theBackendSettings);
 
   // Method to do HTTP transfer between requesting client and abackend
-  // at the provided IP address - with optional port (defaults to 80)
+  // at the provided IP address - with optional port (defaults to 80).
+  // A retriable request fails with PROXY_FAIL_REMOTE_HOST also if the backend
+  // closes the connection before responding. With a hedge target the request is
+  // sent there too if the backend is slow to respond, and the originating backend of
+  // the response tells which one the status refers to.
   ProxyStatus HTTPForward(Spine::Reactor& theReactor,
                           const Spine::HTTP::Request& theRequest,
                           Spine::HTTP::Response& TheResponse,
                           const std::string& theBackendIP,
                           int theBackendPort,
                           const std::string& theBackendURI,
-                          const std::string& theHostName);
+                          const std::string& theHostName,
+                          bool theRetriable,
+                          const std::optional<HedgeTarget>& theHedge);
+
+  // Respond with a fresh cached response without contacting the backend. A stale
+  // response may be used too while it is revalidated from the given backend in the
+  // background. Returns false if the request must be forwarded.
+  bool respondFromCache(Spine::Reactor& theReactor,
+                        const Spine::HTTP::Request& theRequest,
+                        Spine::HTTP::Response& theResponse,
+                        const std::string& theBackendIP,
+                        int theBackendPort,
+                        const std::string& theBackendURI,
+                        const std::string& theHostName);
+
+  // Respond with a stale cached response since no backend could be used
+  bool respondStale(const Spine::HTTP::Request& theRequest,
+                    Spine::HTTP::Response& theResponse,
+                    const std::string& theBackendURI);
+
+  // A background revalidation has finished
+  void endRevalidation(const std::string& theRequestKey);
+
+  // Fetch a response into the cache in the background like a revalidation, after waiting
+  // until fewer than the given number of background fetches are running. Returns false if
+  // the deadline passed while waiting.
+  bool prefetch(Spine::Reactor& theReactor,
+                const Spine::HTTP::Request& theRequest,
+                const std::string& theBackendIP,
+                int theBackendPort,
+                const std::string& theBackendURI,
+                const std::string& theHostName,
+                std::size_t theMaxFetches,
+                std::chrono::steady_clock::time_point theDeadline);
+
+  // Wait until no background fetches are running. Returns false on timeout.
+  bool waitForBackgroundFetches(std::chrono::steady_clock::time_point theDeadline);
 
   // Single response cache holding all content encodings (identity, gzip, zstd, ...),
   // keyed internally by (ETag, encoding).
   ResponseCache& getCache();
 
+  // Idle keep-alive connections to the backends
+  BackendConnectionPool& getConnectionPool();
+
+  // Requests in flight and response times of the backends
+  BackendBalancer& getBackendBalancer();
+
+  RequestHedger& getRequestHedger();
+  CircuitBreaker& getCircuitBreaker();
+
+  // Backend responses shared by identical concurrent requests
+  ResponseCoalescer& getResponseCoalescer();
+  ResponseCompressor& getResponseCompressor();
+  ReceiveBufferBudget& getReceiveBufferBudget();
+  TimeoutWheel& getTimeoutWheel();
+  StreamMemoryBudget& getStreamMemoryBudget();
+
   void shutdown();
 
  private:
+  // Clone the client request for sending to the backend
+  Spine::HTTP::Request makeForwardRequest(Spine::Reactor& theReactor,
+                                          const Spine::HTTP::Request& theRequest,
+                                          const std::string& theBackendURI) const;
+
+  // Wait until the backend responds, hedging the request if it is slow. Returns the
+  // streamer which responded first, and the time the hedge was sent if it won.
+  std::shared_ptr<LowLatencyGatewayStreamer> raceHedge(
+      Spine::Reactor& theReactor,
+      const Spine::HTTP::Request& theRequest,
+      std::shared_ptr<LowLatencyGatewayStreamer> thePrimary,
+      const std::shared_ptr<ResponseSignal>& theSignal,
+      const HedgeTarget& theHedge,
+      RequestHedger::Clock::time_point theStartTime,
+      RequestHedger::Clock::time_point& theSentTime);
+
+  // The most recent cached response to the request in an encoding the client accepts
+  ResponseCache::CachedContent findCachedResponse(const Spine::HTTP::Request& theRequest,
+                                                  const std::string& theRequestKey);
+
+  // Fetch the response to refresh the cache without a client waiting for it
+  void revalidate(Spine::Reactor& theReactor,
+                  const Spine::HTTP::Request& theRequest,
+                  const std::string& theBackendIP,
+                  int theBackendPort,
+                  const std::string& theBackendURI,
+                  const std::string& theHostName,
+                  const std::string& theRequestKey);
+
+  const BackendSettings itsBackendSettings;
+
   ResponseCache itsResponseCache;
 
   boost::asio::io_context backendIoService;
   boost::asio::executor_work_guard<boost::asio::io_context::executor_type> idler;
   boost::thread_group itsBackendThreads;
 
-  int itsBackendTimeoutInSeconds;
+  BackendConnectionPool itsConnectionPool;
+
+  BackendBalancer itsBackendBalancer;
+
+  RequestHedger itsRequestHedger;
+
+  CircuitBreaker itsCircuitBreaker;
+
+  ResponseCoalescer itsResponseCoalescer;
+
+  // Creates compressed variants of cached responses on the backend threads
+  ResponseCompressor itsResponseCompressor;
+
+  // Memory for pending backend reads
+  ReceiveBufferBudget itsReceiveBufferBudget;
+
+  // Backend inactivity timeouts of all streamers
+  TimeoutWheel itsTimeoutWheel;
+
+  // Data queued for all clients
+  StreamMemoryBudget itsStreamMemoryBudget;
+
+  // Request keys being revalidated in the background
+  std::mutex itsRevalidationMutex;
+  std::condition_variable itsRevalidationDone;
+  std::set<std::string> itsRevalidations;
 };
 }  // namespace SmartMet
@@ -0,0 +1,118 @@
+#include "RequestHedger.h"
+#include <macgyver/Exception.h>
+#include <algorithm>
+#include <cmath>
+
+namespace SmartMet
+{
+namespace
+{
+// The percentile is recomputed after this many new samples
+const std::size_t update_interval = 32;
+
+// The budget counters are halved after this many requests
+const double budget_period = 10000;
+}  // namespace
+
+RequestHedger::RequestHedger(const Settings& theSettings)
+    : itsSettings(theSettings), itsStartTime(Fmi::MicrosecClock::universal_time())
+{
+}
+
+// Caller must hold the mutex
+void RequestHedger::updateDelay(Service& theService) const
+{
+  std::vector<double> samples(theService.samples.begin(),
+                              theService.samples.begin() + theService.count);
+  const auto n = static_cast<std::size_t>(
+      std::ceil(itsSettings.percentile / 100.0 * static_cast<double>(samples.size())));
+  auto pos = samples.begin() + std::min(samples.size() - 1, n > 0 ? n - 1 : 0);
+  std::nth_element(samples.begin(), pos, samples.end());
+  theService.delay = std::max<double>(*pos, itsSettings.minDelay);
+}
+
+std::optional<RequestHedger::Clock::duration> RequestHedger::delay(const std::string& theService)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    if (++itsRequests > budget_period)
+    {
+      itsRequests /= 2;
+      itsHedges /= 2;
+    }
+
+    auto pos = itsServices.find(theService);
+    if (pos == itsServices.end() ||
+        pos->second.count < std::max<std::size_t>(1, itsSettings.minSamples))
+      return {};
+
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::milli>(pos->second.delay));
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void RequestHedger::recordFirstByte(const std::string& theService, Clock::duration theTime)
+{
+  try
+  {
+    const double ms = std::chrono::duration<double, std::milli>(theTime).count();
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    auto& service = itsServices[theService];
+    if (service.samples.empty())
+      service.samples.resize(std::max<std::size_t>(1, itsSettings.samples));
+
+    service.samples[service.next] = ms;
+    service.next = (service.next + 1) % service.samples.size();
+    if (service.count < service.samples.size())
+      ++service.count;
+
+    if (service.next % update_interval == 0 || service.count <= itsSettings.minSamples)
+      updateDelay(service);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool RequestHedger::tryHedge()
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  if (itsHedges + 1 > itsSettings.maxPercent / 100.0 * itsRequests)
+    return false;
+  ++itsHedges;
+  ++itsHedged;
+  return true;
+}
+
+void RequestHedger::recordResult(bool theHedgeWon)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  if (theHedgeWon)
+    ++itsWon;
+  else
+    ++itsLost;
+}
+
+Fmi::Cache::CacheStats RequestHedger::getStats() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.size = itsServices.size();
+  stats.inserts = itsHedged;
+  stats.hits = itsWon;
+  stats.misses = itsLost;
+  return stats;
+}
+
+}  // namespace SmartMet
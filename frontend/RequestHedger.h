@@ -0,0 +1,89 @@
+#pragma once
+
+#include <macgyver/CacheStats.h>
+#include <macgyver/DateTime.h>
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace SmartMet
+{
+// Hedged requests: if a GET request has not received a response within a high percentile
+// of the recent times to first byte of its service, a copy is sent to another backend and
+// the first response wins. A backend stalling for example during a data reload then
+// delays only the requests which were already waiting for it. The hedges are limited to a
+// percentage of the requests so that a slow cluster is not loaded with duplicates.
+
+class RequestHedger
+{
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Settings
+  {
+    bool enabled = false;
+    double percentile = 95;        // of the times to first byte
+    std::size_t samples = 1000;    // recent times to first byte kept per service
+    std::size_t minSamples = 100;  // needed before hedging the service
+    int minDelay = 10;             // milliseconds
+    double maxPercent = 5;         // hedged requests relative to all requests
+  };
+
+  explicit RequestHedger(const Settings& theSettings);
+
+  RequestHedger(const RequestHedger& other) = delete;
+  RequestHedger(RequestHedger&& other) = delete;
+  RequestHedger& operator=(const RequestHedger& other) = delete;
+  RequestHedger& operator=(RequestHedger&& other) = delete;
+
+  bool enabled() const { return itsSettings.enabled; }
+
+  // How long to wait for the response before hedging, or nothing if not enough is known
+  // about the service yet
+  std::optional<Clock::duration> delay(const std::string& theService);
+
+  // Time to first byte of a request, or a lower limit for it if the hedge won
+  void recordFirstByte(const std::string& theService, Clock::duration theTime);
+
+  // True if one more hedged request fits in the budget. The hedge is then counted.
+  bool tryHedge();
+
+  void recordResult(bool theHedgeWon);
+
+  // Size is the number of services, inserts the hedged requests, hits the hedges which
+  // responded first and misses the ones which lost
+  Fmi::Cache::CacheStats getStats() const;
+
+ private:
+  struct Service
+  {
+    std::vector<double> samples;  // ring of milliseconds
+    std::size_t next = 0;
+    std::size_t count = 0;
+    double delay = 0;  // the percentile, updated periodically
+  };
+
+  void updateDelay(Service& theService) const;
+
+  const Settings itsSettings;
+
+  mutable std::mutex itsMutex;
+  std::map<std::string, Service> itsServices;
+
+  // Requests and hedges for the budget, halved once in a while so that it follows
+  // recent traffic
+  double itsRequests = 0;
+  double itsHedges = 0;
+
+  // Statistics
+  const Fmi::DateTime itsStartTime;
+  std::size_t itsHedged = 0;
+  std::size_t itsWon = 0;
+  std::size_t itsLost = 0;
+};
+
+}  // namespace SmartMet
@@ -0,0 +1,188 @@
+#include "ResponseBodyFraming.h"
+#include <boost/algorithm/string.hpp>
+#include <macgyver/Exception.h>
+#include <algorithm>
+#include <cstdlib>
+
+namespace SmartMet
+{
+namespace
+{
+// Sanity limit for chunk size and trailer lines
+const std::size_t max_chunk_line_length = 1024;
+
+bool parse_chunk_size(std::string line, std::size_t& size)
+{
+  // Strip chunk extensions
+  auto pos = line.find(';');
+  if (pos != std::string::npos)
+    line.resize(pos);
+  boost::algorithm::trim(line);
+
+  if (line.empty() || line.size() > 16)
+    return false;
+
+  char* end = nullptr;
+  size = std::strtoull(line.c_str(), &end, 16);
+  return (end != nullptr && *end == '\0');
+}
+
+}  // namespace
+
+ResponseBodyFraming::ResponseBodyFraming(Mode theMode, std::size_t theContentLength)
+    : itsMode(theMode), itsRemaining(theContentLength)
+{
+  itsComplete = (itsMode == Mode::NO_BODY || (itsMode == Mode::CONTENT_LENGTH && itsRemaining == 0));
+}
+
+ResponseBodyFraming ResponseBodyFraming::fromResponse(const Spine::HTTP::Response& theResponse)
+{
+  try
+  {
+    const auto status = static_cast<int>(theResponse.getStatus());
+    if ((status >= 100 && status < 200) || status == 204 || status == 304)
+      return {Mode::NO_BODY, 0};
+
+    auto transfer_encoding = theResponse.getHeader("Transfer-Encoding");
+    if (transfer_encoding)
+    {
+      if (boost::algorithm::icontains(*transfer_encoding, "chunked"))
+        return {Mode::CHUNKED, 0};
+      return {Mode::UNTIL_CLOSE, 0};
+    }
+
+    auto content_length = theResponse.getHeader("Content-Length");
+    if (content_length)
+    {
+      std::string value = boost::algorithm::trim_copy(*content_length);
+      char* end = nullptr;
+      const auto length = std::strtoull(value.c_str(), &end, 10);
+      if (!value.empty() && end != nullptr && *end == '\0')
+        return {Mode::CONTENT_LENGTH, length};
+    }
+
+    return {Mode::UNTIL_CLOSE, 0};
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool ResponseBodyFraming::consume(const char* theData, std::size_t theLength)
+{
+  if (theLength == 0)
+    return itsComplete;
+
+  if (itsComplete)
+  {
+    itsOverrun = true;
+    return true;
+  }
+
+  switch (itsMode)
+  {
+    case Mode::NO_BODY:
+      break;
+    case Mode::UNTIL_CLOSE:
+      return false;
+    case Mode::CONTENT_LENGTH:
+    {
+      if (theLength > itsRemaining)
+        itsOverrun = true;
+      itsRemaining -= std::min(theLength, itsRemaining);
+      itsComplete = (itsRemaining == 0);
+      return itsComplete;
+    }
+    case Mode::CHUNKED:
+      return consumeChunked(theData, theLength);
+  }
+  return itsComplete;
+}
+
+bool ResponseBodyFraming::consumeChunked(const char* theData, std::size_t theLength)
+{
+  std::size_t i = 0;
+  while (i < theLength && !itsComplete)
+  {
+    switch (itsChunkState)
+    {
+      case ChunkState::SIZE:
+      {
+        const char ch = theData[i++];
+        if (ch != '\n')
+        {
+          itsLine.push_back(ch);
+          if (itsLine.size() > max_chunk_line_length)
+          {
+            // Garbled framing, the connection cannot be reused
+            itsMode = Mode::UNTIL_CLOSE;
+            return false;
+          }
+          break;
+        }
+
+        std::size_t size = 0;
+        if (!parse_chunk_size(itsLine, size))
+        {
+          itsMode = Mode::UNTIL_CLOSE;
+          return false;
+        }
+        itsLine.clear();
+
+        if (size == 0)
+          itsChunkState = ChunkState::TRAILER;
+        else
+        {
+          itsRemaining = size;
+          itsChunkState = ChunkState::DATA;
+        }
+        break;
+      }
+      case ChunkState::DATA:
+      {
+        const auto n = std::min(itsRemaining, theLength - i);
+        i += n;
+        itsRemaining -= n;
+        if (itsRemaining == 0)
+          itsChunkState = ChunkState::DATA_END;
+        break;
+      }
+      case ChunkState::DATA_END:
+      {
+        // CRLF after chunk data
+        if (theData[i++] == '\n')
+          itsChunkState = ChunkState::SIZE;
+        break;
+      }
+      case ChunkState::TRAILER:
+      {
+        // Trailer fields end with an empty line
+        const char ch = theData[i++];
+        if (ch == '\n')
+        {
+          if (itsLine.empty())
+            itsComplete = true;
+          itsLine.clear();
+        }
+        else if (ch != '\r')
+        {
+          itsLine.push_back(ch);
+          if (itsLine.size() > max_chunk_line_length)
+          {
+            itsMode = Mode::UNTIL_CLOSE;
+            return false;
+          }
+        }
+        break;
+      }
+    }
+  }
+
+  if (itsComplete && i < theLength)
+    itsOverrun = true;
+
+  return itsComplete;
+}
+
+}  // namespace SmartMet
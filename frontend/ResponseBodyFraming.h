@@ -0,0 +1,68 @@
+#pragma once
+
+#include <spine/HTTP.h>
+#include <cstddef>
+#include <string>
+
+namespace SmartMet
+{
+// Tracks where the body of a backend response ends. Responses on keep-alive
+// connections are delimited either by Content-Length or by chunked transfer coding,
+// and the connection can be reused only once the body has been consumed exactly.
+// Responses without such framing last until the backend closes the connection.
+
+class ResponseBodyFraming
+{
+ public:
+  enum class Mode
+  {
+    NO_BODY,         // 1xx, 204 and 304 responses
+    CONTENT_LENGTH,  // body length given in advance
+    CHUNKED,         // Transfer-Encoding: chunked
+    UNTIL_CLOSE      // body ends when the connection is closed
+  };
+
+  ResponseBodyFraming() = default;
+  ResponseBodyFraming(Mode theMode, std::size_t theContentLength);
+
+  // Deduce the framing from parsed response headers
+  static ResponseBodyFraming fromResponse(const Spine::HTTP::Response& theResponse);
+
+  // Consume body bytes. Returns true once the whole body has been seen.
+  bool consume(const char* theData, std::size_t theLength);
+
+  bool complete() const { return itsComplete; }
+
+  // True if the end of the body can be detected without the connection being closed
+  bool delimited() const { return itsMode != Mode::UNTIL_CLOSE; }
+
+  // True if the backend sent more data than the framing allows
+  bool overrun() const { return itsOverrun; }
+
+  Mode mode() const { return itsMode; }
+
+  // Body bytes still expected, known only in CONTENT_LENGTH mode
+  std::size_t remaining() const { return itsRemaining; }
+
+ private:
+  enum class ChunkState
+  {
+    SIZE,
+    DATA,
+    DATA_END,
+    TRAILER
+  };
+
+  bool consumeChunked(const char* theData, std::size_t theLength);
+
+  Mode itsMode = Mode::UNTIL_CLOSE;
+  std::size_t itsRemaining = 0;
+  bool itsComplete = false;
+  bool itsOverrun = false;
+
+  // Chunked transfer coding parser state
+  ChunkState itsChunkState = ChunkState::SIZE;
+  std::string itsLine;
+};
+
+}  // namespace SmartMet
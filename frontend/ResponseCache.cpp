@@ -1,15 +1,559 @@
 #include "ResponseCache.h"
+#include "ContentHash.h"
+#include <fmt/format.h>
+#include <macgyver/Exception.h>
+#include <spine/Convenience.h>
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <map>
 
 namespace SmartMet
 {
-ResponseCache::ResponseCache(std::size_t memoryCacheSize,
-                             std::size_t filesystemCacheSize,
-                             const std::filesystem::path& fileCachePath)
-    : itsMetaDataCache((memoryCacheSize + filesystemCacheSize) /
-                       8192)  // Buffer cache sizes are in bytes, this in units
-      ,
-      itsBufferCache(memoryCacheSize, filesystemCacheSize, fileCachePath)
+namespace
 {
+// How many ETags to remember per request. Several are kept so that clients alternating
+// between recent representations still produce useful conditional requests.
+const std::size_t max_etags_per_request = 4;
+
+// Record types of the persistent index
+const char metadata_record = 'M';
+const char etags_record = 'E';
+const char purge_record = 'P';
+
+CacheIndexLog::Record to_record(const std::string& key,
+                                const ResponseCache::CachedResponseMetaData& metadata)
+{
+  const auto& freshness = metadata.freshness;
+  return {key,
+          std::to_string(metadata.buffer_hash),
+          metadata.mime_type,
+          metadata.etag,
+          metadata.cache_control,
+          metadata.expires,
+          metadata.vary,
+          metadata.access_control_allow_origin,
+          metadata.content_encoding,
+          (metadata.large_response ? "1" : "0"),
+          std::to_string(freshness.freshUntil),
+          std::to_string(freshness.staleWhileRevalidate),
+          std::to_string(freshness.staleIfError),
+          (freshness.mustRevalidate ? "1" : "0"),
+          std::to_string(metadata.buffer_size),
+          metadata.partition,
+          metadata.tags};
+}
+
+ResponseCache::CachedResponseMetaData from_record(const CacheIndexLog::Record& record)
+{
+  // Records written before the content size, partition and tags were added are shorter
+  if (record.size() < 14 || record.size() > 17)
+    throw Fmi::Exception(BCP, "Invalid response cache index record");
+
+  ResponseCache::CachedResponseMetaData metadata;
+  metadata.buffer_hash = std::stoull(record[1]);
+  metadata.mime_type = record[2];
+  metadata.etag = record[3];
+  metadata.cache_control = record[4];
+  metadata.expires = record[5];
+  metadata.vary = record[6];
+  metadata.access_control_allow_origin = record[7];
+  metadata.content_encoding = record[8];
+  metadata.large_response = (record[9] == "1");
+  metadata.freshness.freshUntil = static_cast<std::time_t>(std::stoll(record[10]));
+  metadata.freshness.staleWhileRevalidate = std::stoi(record[11]);
+  metadata.freshness.staleIfError = std::stoi(record[12]);
+  metadata.freshness.mustRevalidate = (record[13] == "1");
+  if (record.size() > 14)
+    metadata.buffer_size = std::stoull(record[14]);
+  if (record.size() > 15)
+    metadata.partition = record[15];
+  if (record.size() > 16)
+    metadata.tags = record[16];
+  return metadata;
+}
+
+// The state described by the index records, the latest record of each key winning
+struct IndexState
+{
+  std::map<std::string, ResponseCache::CachedResponseMetaData> metadata;
+  std::map<std::string, std::vector<std::string>> etags;
+
+  void apply(char type, const CacheIndexLog::Record& record)
+  {
+    if (record.empty())
+      return;
+    if (type == metadata_record)
+      metadata[record[0]] = from_record(record);
+    else if (type == purge_record)
+      metadata.erase(record[0]);
+    else if (type == etags_record && record.size() == 1)
+      etags.erase(record[0]);
+    else if (type == etags_record)
+      etags[record[0]] = std::vector<std::string>(record.begin() + 1, record.end());
+  }
+};
+
+// Estimated number of cached responses
+std::size_t expected_entries(const ResponseCache::Settings& theSettings)
+{
+  return (theSettings.memorySize + theSettings.filesystemSize) / 8192;
+}
+
+void add_stats(Fmi::Cache::CacheStats& theTotal, const Fmi::Cache::CacheStats& theStats)
+{
+  theTotal.maxsize += theStats.maxsize;
+  theTotal.size += theStats.size;
+  theTotal.inserts += theStats.inserts;
+  theTotal.hits += theStats.hits;
+  theTotal.misses += theStats.misses;
+}
+
+// Free room in a buffer cache, memory and files combined
+std::size_t free_room(const Spine::SmartMetCache& theCache)
+{
+  const auto memory = theCache.getMemoryCacheStats();
+  const auto files = theCache.getFileCacheStats();
+  const auto used = memory.size + files.size;
+  const auto quota = memory.maxsize + files.maxsize;
+  return (used < quota ? quota - used : 0);
+}
+
+// Shard index of a shard directory name such as "shard03", or -1
+int shard_index(const std::string& theName)
+{
+  if (theName.size() < 7 || theName.compare(0, 5, "shard") != 0 ||
+      !std::all_of(theName.begin() + 5, theName.end(), ::isdigit))
+    return -1;
+  return std::stoi(theName.substr(5));
+}
+
+// Names of the files and subdirectories of the file cache are hexadecimal hash values
+bool is_cache_file_name(const std::string& theName)
+{
+  return !theName.empty() && std::all_of(theName.begin(), theName.end(), ::isxdigit);
+}
+
+// Shard count of the files in the directory, from the marker written at startup
+const char* const shard_marker = "shards";
+
+std::optional<std::size_t> read_shard_marker(const std::filesystem::path& theDirectory)
+{
+  std::ifstream in(theDirectory / shard_marker);
+  std::size_t shards = 0;
+  if (in >> shards && shards > 0)
+    return shards;
+  return std::nullopt;
+}
+
+// The keys are assigned to the shards by their hash modulo the shard count. If the count
+// has changed since the files were written, they would never be found or evicted, hence
+// the files of the earlier layout are removed. The count is known only from the marker
+// file, without it nothing is removed. Only entries which look like the cache's own are
+// removed: shard directories, or with a single shard hexadecimal file names in the
+// directory itself.
+void remove_old_shard_layout(const std::filesystem::path& theDirectory, std::size_t theShards)
+{
+  if (theDirectory.empty())
+    return;
+
+  // Created here already so that the marker is written on the first start too
+  std::error_code err;
+  std::filesystem::create_directories(theDirectory, err);
+  if (!std::filesystem::is_directory(theDirectory))
+    return;
+
+  const auto old_shards = read_shard_marker(theDirectory);
+
+  if (old_shards && *old_shards != theShards)
+  {
+    std::vector<std::filesystem::path> removed;
+    for (const auto& entry : std::filesystem::directory_iterator(theDirectory))
+    {
+      const auto name = entry.path().filename().string();
+      if (*old_shards > 1)
+      {
+        const auto index = shard_index(name);
+        if (entry.is_directory() && index >= 0 && static_cast<std::size_t>(index) < *old_shards)
+          removed.push_back(entry.path());
+      }
+      else if (is_cache_file_name(name))
+        removed.push_back(entry.path());
+    }
+
+    std::cout << fmt::format("{} Response cache shard count changed from {} to {}, removing "
+                             "old files in {}",
+                             Spine::log_time_str(),
+                             *old_shards,
+                             theShards,
+                             theDirectory.string())
+              << std::endl;
+
+    for (const auto& path : removed)
+    {
+      std::filesystem::remove_all(path, err);
+      if (err)
+        std::cerr << fmt::format("{} Failed to remove {}: {}",
+                                 Spine::log_time_str(),
+                                 path.string(),
+                                 err.message())
+                  << std::endl;
+    }
+  }
+
+  if (old_shards != theShards)
+  {
+    std::ofstream out(theDirectory / shard_marker, std::ios::trunc);
+    out << theShards << std::endl;
+    if (!out)
+      std::cerr << fmt::format("{} Failed to write the response cache shard marker in {}",
+                               Spine::log_time_str(),
+                               theDirectory.string())
+                << std::endl;
+  }
+}
+
+}  // namespace
+
+ResponseCache::Shard::Shard(std::size_t theEntries)
+    : metaDataCache(theEntries), etagIndex(theEntries)
+{
+}
+
+ResponseCache::ResponseCache(const Settings& theSettings)
+    : itsSettings(theSettings),
+      itsLargeResponseStore(theSettings.largeResponses),
+      itsStartTime(Fmi::MicrosecClock::universal_time()),
+      itsAdmission(theSettings.admission, expected_entries(theSettings)),
+      itsPurgeIndex(expected_entries(theSettings)),
+      itsIndexLog(theSettings.index)
+{
+  // Buffer cache sizes are in bytes, the metadata caches in units
+  const std::size_t shards = std::max<std::size_t>(1, theSettings.shards);
+  const std::size_t entries = expected_entries(theSettings);
+
+  for (std::size_t i = 0; i < shards; i++)
+    itsShards.emplace_back(new Shard(entries / shards));
+
+  // The shared partition gets what the others do not reserve, and uses the cache
+  // directory as is
+  auto partitions = theSettings.partitions;
+  Settings::Partition shared;
+  shared.memorySize = theSettings.memorySize;
+  shared.filesystemSize = theSettings.filesystemSize;
+  for (const auto& settings : partitions)
+  {
+    shared.memorySize -= std::min(shared.memorySize, settings.memorySize);
+    shared.filesystemSize -= std::min(shared.filesystemSize, settings.filesystemSize);
+  }
+  partitions.insert(partitions.begin(), shared);
+
+  for (const auto& settings : partitions)
+  {
+    std::unique_ptr<Partition> partition(new Partition);
+    partition->name = settings.name;
+    partition->prefix = settings.prefix;
+
+    auto directory = theSettings.directory;
+    if (!settings.name.empty() && !directory.empty())
+      directory = directory / "partitions" / settings.name;
+
+    remove_old_shard_layout(directory, shards);
+
+    for (std::size_t i = 0; i < shards; i++)
+    {
+      // A single shard uses the partition directory as is
+      auto shard_directory = directory;
+      if (shards > 1 && !directory.empty())
+        shard_directory /= fmt::format("shard{:02}", i);
+
+      partition->bufferCaches.emplace_back(new BufferCache(
+          settings.memorySize / shards, settings.filesystemSize / shards, shard_directory));
+    }
+    itsPartitions.push_back(std::move(partition));
+  }
+
+  if (itsIndexLog.enabled())
+  {
+    itsIndexLog.setCompactor(
+        [this](const CacheIndexLog::Replayer& replay, const CacheIndexLog::RecordHandler& write)
+        { compactIndex(replay, write); });
+    itsIndexLoader = std::thread([this] { loadIndex(); });
+  }
+}
+
+ResponseCache::~ResponseCache()
+{
+  if (itsIndexLoader.joinable())
+    itsIndexLoader.join();
+}
+
+// Restore the index written before the restart. The latest record of each key wins, but
+// entries inserted since the startup are newer still.
+void ResponseCache::loadIndex()
+{
+  try
+  {
+    IndexState state;
+    itsIndexLog.replay([&state](char type, const CacheIndexLog::Record& record)
+                       { state.apply(type, record); });
+    const auto& metadata = state.metadata;
+    const auto& etags = state.etags;
+
+    for (const auto& item : metadata)
+    {
+      if (!metaDataCache(item.first).find(item.first))
+        metaDataCache(item.first).insert(item.first, item.second);
+      if (!item.second.tags.empty())
+        itsPurgeIndex.addTags(item.second.etag, item.second.tags);
+    }
+
+    for (const auto& item : etags)
+    {
+      if (!etagIndex(item.first).find(item.first))
+        etagIndex(item.first).insert(item.first, item.second);
+      itsPurgeIndex.addRequest(item.first);
+    }
+
+    std::cout << fmt::format("{} Response cache index loaded: {} responses, {} requests",
+                             Spine::log_time_str(),
+                             metadata.size(),
+                             etags.size())
+              << std::endl;
+  }
+  catch (...)
+  {
+    // Runs in its own thread, the cache works without the index
+    Fmi::Exception ex(BCP, "Failed to load the response cache index", nullptr);
+    ex.printError();
+  }
+  itsIndexLoaded = true;
+}
+
+// Write the entries of the index which are still cached when the index log is rotated.
+// Entries no longer in memory have been evicted, unless the index is still being loaded.
+void ResponseCache::compactIndex(const CacheIndexLog::Replayer& replay,
+                                 const CacheIndexLog::RecordHandler& write)
+{
+  IndexState state;
+  replay([&state](char type, const CacheIndexLog::Record& record) { state.apply(type, record); });
+
+  const bool loaded = itsIndexLoaded;
+
+  for (const auto& item : state.metadata)
+  {
+    // Purged entries are kept in memory without an ETag
+    auto current = metaDataCache(item.first).find(item.first);
+    if (current && !current->etag.empty())
+      write(metadata_record, to_record(item.first, *current));
+    else if (!current && !loaded)
+      write(metadata_record, to_record(item.first, item.second));
+  }
+
+  for (const auto& item : state.etags)
+  {
+    auto current = etagIndex(item.first).find(item.first);
+    const auto* etags = (current ? &*current : (loaded ? nullptr : &item.second));
+    if (!etags || etags->empty())
+      continue;
+
+    CacheIndexLog::Record record{item.first};
+    record.insert(record.end(), etags->begin(), etags->end());
+    write(etags_record, record);
+  }
+}
+
+void ResponseCache::logMetaData(const std::string& key, const CachedResponseMetaData& metadata)
+{
+  if (itsIndexLog.enabled())
+    itsIndexLog.append(metadata_record, to_record(key, metadata));
+}
+
+const std::vector<std::string>& ResponseCache::cachedEncodings()
+{
+  static const std::vector<std::string> encodings{"zstd", "gzip", ""};
+  return encodings;
+}
+
+ResponseCache::MetaDataCache& ResponseCache::metaDataCache(const std::string& key)
+{
+  return itsShards[std::hash<std::string>()(key) % itsShards.size()]->metaDataCache;
+}
+
+ResponseCache::ETagIndex& ResponseCache::etagIndex(const std::string& request_key)
+{
+  return itsShards[std::hash<std::string>()(request_key) % itsShards.size()]->etagIndex;
+}
+
+ResponseCache::Partition& ResponseCache::partition(const std::string& name)
+{
+  // Buffers of partitions removed from the configuration are looked up in the shared one
+  for (auto& partition : itsPartitions)
+    if (partition->name == name)
+      return *partition;
+  return *itsPartitions.front();
+}
+
+ResponseCache::BufferCache& ResponseCache::bufferCache(Partition& partition,
+                                                       std::size_t buffer_hash)
+{
+  // The high bits are mixed in since the hash may not be well distributed modulo small
+  // shard counts
+  const auto& caches = partition.bufferCaches;
+  return *caches[(buffer_hash ^ (buffer_hash >> 32)) % caches.size()];
+}
+
+std::string ResponseCache::findPartition(const std::string& resource) const
+{
+  // The longest matching prefix wins
+  const Partition* best = nullptr;
+  for (const auto& partition : itsPartitions)
+  {
+    const auto& prefix = partition->prefix;
+    if (prefix.empty() || resource.compare(0, prefix.size(), prefix) != 0)
+      continue;
+    if (resource.size() > prefix.size() && prefix.back() != '/' && resource[prefix.size()] != '/')
+      continue;  // "/wms" must not match "/wmsx"
+    if (!best || prefix.size() > best->prefix.size())
+      best = partition.get();
+  }
+  return (best ? best->name : std::string());
+}
+
+ResponseCache::Partition* ResponseCache::choosePartition(Partition& home,
+                                                         std::size_t buffer_hash,
+                                                         std::size_t size)
+{
+  if (free_room(bufferCache(home, buffer_hash)) >= size)
+    return &home;
+
+  // Borrow unused quota. The lender's own responses evict borrowed ones as it fills up.
+  Partition* lender = nullptr;
+  std::size_t lender_room = size;
+  for (auto& partition : itsPartitions)
+  {
+    if (partition.get() == &home)
+      continue;
+    const auto room = free_room(bufferCache(*partition, buffer_hash));
+    if (room >= lender_room)
+    {
+      lender = partition.get();
+      lender_room = room;
+    }
+  }
+  return lender;
+}
+
+Fmi::Cache::CacheStats ResponseCache::combineStats(
+    const std::function<Fmi::Cache::CacheStats(const Shard&)>& getStats) const
+{
+  Fmi::Cache::CacheStats stats;
+  for (const auto& shard : itsShards)
+  {
+    const auto shardStats = getStats(*shard);
+    if (&shard == &itsShards.front())
+      stats.starttime = shardStats.starttime;
+    add_stats(stats, shardStats);
+  }
+  return stats;
+}
+
+Fmi::Cache::CacheStats ResponseCache::getMetaDataCacheStats() const
+{
+  return combineStats([](const Shard& shard) { return shard.metaDataCache.statistics(); });
+}
+
+Fmi::Cache::CacheStats ResponseCache::getETagIndexStats() const
+{
+  return combineStats([](const Shard& shard) { return shard.etagIndex.statistics(); });
+}
+
+Fmi::Cache::CacheStats ResponseCache::combineBufferStats(
+    const std::vector<std::unique_ptr<BufferCache>>& bufferCaches,
+    const std::function<Fmi::Cache::CacheStats(const BufferCache&)>& getStats) const
+{
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  for (const auto& cache : bufferCaches)
+    add_stats(stats, getStats(*cache));
+  return stats;
+}
+
+Fmi::Cache::CacheStats ResponseCache::getMemoryCacheStats() const
+{
+  Fmi::Cache::CacheStats stats;
+  for (const auto& partition : itsPartitions)
+    add_stats(stats,
+              combineBufferStats(partition->bufferCaches,
+                                 [](const BufferCache& cache)
+                                 { return cache.getMemoryCacheStats(); }));
+  stats.starttime = itsStartTime;
+  return stats;
+}
+
+Fmi::Cache::CacheStats ResponseCache::getFileCacheStats() const
+{
+  Fmi::Cache::CacheStats stats;
+  for (const auto& partition : itsPartitions)
+    add_stats(stats,
+              combineBufferStats(partition->bufferCaches,
+                                 [](const BufferCache& cache)
+                                 { return cache.getFileCacheStats(); }));
+  stats.starttime = itsStartTime;
+  return stats;
+}
+
+std::vector<std::pair<std::string, Fmi::Cache::CacheStats>> ResponseCache::getPartitionStats()
+    const
+{
+  std::vector<std::pair<std::string, Fmi::Cache::CacheStats>> result;
+  for (const auto& partition : itsPartitions)
+  {
+    auto stats = combineBufferStats(partition->bufferCaches,
+                                    [](const BufferCache& cache)
+                                    {
+                                      auto total = cache.getMemoryCacheStats();
+                                      const auto files = cache.getFileCacheStats();
+                                      total.maxsize += files.maxsize;
+                                      total.size += files.size;
+                                      return total;
+                                    });
+    stats.inserts = partition->inserts;
+    stats.hits = partition->hits;
+    stats.misses = partition->misses;
+    result.emplace_back(partition->name, stats);
+  }
+  return result;
+}
+
+Fmi::Cache::CacheStats ResponseCache::getObjectHitStats() const
+{
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.hits = itsObjectHits;
+  stats.misses = itsObjectMisses;
+  return stats;
+}
+
+Fmi::Cache::CacheStats ResponseCache::getByteHitStats() const
+{
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.hits = itsByteHits;
+  stats.misses = itsByteMisses;
+  return stats;
+}
+
+Fmi::Cache::CacheStats ResponseCache::getDeduplicationStats() const
+{
+  auto stats = itsLargeResponseStore.getDuplicateStats();
+  stats.starttime = itsStartTime;
+  stats.inserts += itsBufferInserts + itsLargeResponseStore.getStats().inserts;
+  stats.hits += itsDuplicateBuffers;
+  stats.size += itsDuplicateBufferSize;
+  stats.misses += itsBufferCollisions;
+  return stats;
 }
 
 std::string ResponseCache::makeKey(const std::string& etag, const std::string& content_encoding)
@@ -19,47 +563,347 @@ std::string ResponseCache::makeKey(const std::string& etag, const std::string& c
   return etag + '\x1f' + content_encoding;
 }
 
-std::pair<std::shared_ptr<std::string>, ResponseCache::CachedResponseMetaData>
-ResponseCache::getCachedBuffer(const std::string& etag, const std::string& content_encoding)
+ResponseCache::CachedContent ResponseCache::getCachedContent(const std::string& etag,
+                                                             const std::string& content_encoding)
 {
-  auto mdata = itsMetaDataCache.find(makeKey(etag, content_encoding));
+  CachedContent content;
+
+  const auto key = makeKey(etag, content_encoding);
+  auto mdata = findMetaData(key);
 
   if (mdata)
   {
     std::size_t bufferhash = mdata->buffer_hash;
 
-    auto buffer = itsBufferCache.find(bufferhash);
+    // Large responses are mapped instead of being read into memory
+    auto& buffer_partition = partition(mdata->partition);
+    if (mdata->large_response)
+      content.file = itsLargeResponseStore.open(bufferhash);
+    else
+      content.buffer = bufferCache(buffer_partition, bufferhash).find(bufferhash);
+    content.metadata = *mdata;
+
+    // Different content may have been stored under the same hash after the original
+    // content was evicted
+    if (mdata->buffer_size != 0 && content.size() != mdata->buffer_size)
+    {
+      content.buffer.reset();
+      content.file.reset();
+    }
+
+    if (content)
+    {
+      itsAdmission.record(key);
+      ++buffer_partition.hits;
+      ++itsObjectHits;
+      itsByteHits += content.size();
+    }
+  }
+
+  return content;
+}
+
+ResponseCache::CachedResponseMetaData ResponseCache::insertCachedBuffer(
+    const CachedResponseMetaData& metadata,
+    const std::shared_ptr<std::string>& buffer,
+    std::uint64_t content_hash)
+{
+  CachedResponseMetaData data = metadata;
+  data.buffer_hash = content_hash;
+  data.buffer_size = buffer->size();
+  data.large_response = false;
+  data.freshness = ResponseFreshness::parse(data.cache_control, data.expires, std::time(nullptr));
+
+  auto& home = partition(data.partition);
+  ++home.misses;
+  ++itsObjectMisses;
+  itsByteMisses += buffer->size();
+
+  const auto key = makeKey(data.etag, data.content_encoding);
+
+  // Memory is full when the buffers spill to files, and the cache is full when the files
+  // reach their limit too. A full cache evicts from the home partition.
+  auto* target = choosePartition(home, data.buffer_hash, buffer->size());
+  if (!itsAdmission.admit(key, buffer->size(), target == nullptr))
+    return data;
+  if (!target)
+    target = &home;
+
+  // The buffer is stored first so that the metadata never refers to a buffer which was
+  // rejected
+  if (!storeBuffer(bufferCache(*target, data.buffer_hash), data.buffer_hash, buffer))
+    return data;
+  ++target->inserts;
+  data.partition = target->name;
+
+  metaDataCache(key).insert(key, data);
+  logMetaData(key, data);
+  if (!data.tags.empty())
+    itsPurgeIndex.addTags(data.etag, data.tags);
+
+  return data;
+}
+
+void ResponseCache::insertCachedVariant(const CachedResponseMetaData& metadata,
+                                        const std::shared_ptr<std::string>& buffer)
+{
+  CachedResponseMetaData data = metadata;
+  data.buffer_hash = ContentHash::of(*buffer);
+  data.buffer_size = buffer->size();
+  data.large_response = false;
+
+  // Stored next to the original, or in the home partition of the original if it is full
+  auto* target = choosePartition(partition(data.partition), data.buffer_hash, buffer->size());
+  if (!target)
+    target = &partition(data.partition);
+
+  if (!storeBuffer(bufferCache(*target, data.buffer_hash), data.buffer_hash, buffer))
+    return;
+  ++target->inserts;
+  data.partition = target->name;
+
+  const auto key = makeKey(data.etag, data.content_encoding);
+  metaDataCache(key).insert(key, data);
+  logMetaData(key, data);
+}
+
+bool ResponseCache::storeBuffer(BufferCache& cache,
+                                std::size_t buffer_hash,
+                                const std::shared_ptr<std::string>& buffer)
+{
+  // Concurrent inserts of the same content may both store it, which is harmless
+  auto old_buffer = cache.find(buffer_hash);
+  if (old_buffer)
+  {
+    if (*old_buffer != *buffer)
+    {
+      ++itsBufferCollisions;
+      return false;
+    }
+    ++itsDuplicateBuffers;
+    itsDuplicateBufferSize += buffer->size();
+    return true;
+  }
+
+  cache.insert(buffer_hash, buffer);
+  ++itsBufferInserts;
+  return true;
+}
+
+void ResponseCache::insertCachedFile(const CachedResponseMetaData& metadata,
+                                     std::unique_ptr<LargeResponseStore::Writer> writer,
+                                     std::uint64_t content_hash)
+{
+  if (!writer)
+    return;
+
+  const auto size = writer->size();
+  ++partition(metadata.partition).misses;
+  ++itsObjectMisses;
+  itsByteMisses += size;
+
+  const auto key = makeKey(metadata.etag, metadata.content_encoding);
+
+  // A store limited only by the free disk space is never considered full
+  const auto store = itsLargeResponseStore.getStats();
+  const bool full = (store.maxsize > 0 && store.size + size > store.maxsize);
+
+  if (!itsAdmission.admit(key, size, full))
+    return;
+
+  const auto file_key = itsLargeResponseStore.commit(std::move(writer), content_hash);
+  if (file_key == 0)
+    return;
+
+  CachedResponseMetaData data = metadata;
+  data.buffer_hash = file_key;
+  data.buffer_size = size;
+  data.large_response = true;
+  data.freshness = ResponseFreshness::parse(data.cache_control, data.expires, std::time(nullptr));
+
+  metaDataCache(key).insert(key, data);
+  logMetaData(key, data);
+  if (!data.tags.empty())
+    itsPurgeIndex.addTags(data.etag, data.tags);
+}
+
+bool ResponseCache::hasCachedBuffer(const std::string& etag, const std::string& content_encoding)
+{
+  const auto key = makeKey(etag, content_encoding);
+  return !!findMetaData(key);
+}
+
+std::optional<ResponseCache::CachedResponseMetaData> ResponseCache::findMetaData(
+    const std::string& key)
+{
+  auto mdata = metaDataCache(key).find(key);
+  if (!mdata || mdata->etag.empty())
+    return std::nullopt;
+  return *mdata;
+}
+
+std::size_t ResponseCache::purgeETag(const std::string& etag)
+{
+  try
+  {
+    std::size_t count = 0;
+    for (const auto& content_encoding : cachedEncodings())
+    {
+      const auto key = makeKey(etag, content_encoding);
+      if (!findMetaData(key))
+        continue;
+
+      // Purged entries are replaced by metadata without an ETag, and the buffers are left
+      // to be evicted. A new response with the same ETag replaces the entry again.
+      metaDataCache(key).insert(key, CachedResponseMetaData());
+      if (itsIndexLog.enabled())
+        itsIndexLog.append(purge_record, {key});
+      ++count;
+    }
+    return count;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!").addParameter("ETag", etag);
+  }
+}
+
+std::size_t ResponseCache::purgePrefix(const std::string& prefix)
+{
+  try
+  {
+    std::size_t count = 0;
+    for (const auto& request_key : itsPurgeIndex.removeRequests(prefix))
+    {
+      for (const auto& etag : getKnownETags(request_key))
+        count += purgeETag(etag);
+
+      // Forget the ETags too so that no conditional requests are made for them
+      etagIndex(request_key).insert(request_key, {});
+      if (itsIndexLog.enabled())
+        itsIndexLog.append(etags_record, {request_key});
+    }
+    return count;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!").addParameter("Prefix", prefix);
+  }
+}
+
+std::size_t ResponseCache::purgeTag(const std::string& tag)
+{
+  try
+  {
+    std::size_t count = 0;
+    for (const auto& etag : itsPurgeIndex.removeTag(tag))
+      count += purgeETag(etag);
+    return count;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!").addParameter("Tag", tag);
+  }
+}
+
+std::vector<std::string> ResponseCache::getKnownETags(const std::string& request_key)
+{
+  auto etags = etagIndex(request_key).find(request_key);
+  if (!etags)
+    return {};
+  return *etags;
+}
+
+void ResponseCache::rememberETag(const std::string& request_key, const std::string& etag)
+{
+  // Races between concurrent updates are harmless, the index is only a hint
+  itsPurgeIndex.addRequest(request_key);
+
+  std::vector<std::string> etags;
+  auto old_etags = etagIndex(request_key).find(request_key);
+  if (old_etags)
+    etags = *old_etags;
+
+  auto pos = std::find(etags.begin(), etags.end(), etag);
+  if (pos == etags.begin() && !etags.empty())
+    return;  // Already the most recent one
+  if (pos != etags.end())
+    etags.erase(pos);
+
+  etags.insert(etags.begin(), etag);
+  if (etags.size() > max_etags_per_request)
+    etags.resize(max_etags_per_request);
 
-    return std::make_pair(buffer, *mdata);
+  etagIndex(request_key).insert(request_key, etags);
+
+  if (itsIndexLog.enabled())
+  {
+    CacheIndexLog::Record record{request_key};
+    record.insert(record.end(), etags.begin(), etags.end());
+    itsIndexLog.append(etags_record, record);
   }
+}
+
+void ResponseCache::refreshCachedResponse(const std::string& etag,
+                                          const std::string& cache_control,
+                                          const std::string& expires)
+{
+  for (const auto& content_encoding : cachedEncodings())
+  {
+    const auto key = makeKey(etag, content_encoding);
+    auto mdata = findMetaData(key);
+    if (!mdata)
+      continue;
+
+    const auto now = std::time(nullptr);
+
+    CachedResponseMetaData data = *mdata;
+    if (!cache_control.empty())
+      data.cache_control = cache_control;
+    if (!expires.empty())
+      data.expires = expires;
+    data.freshness = ResponseFreshness::parse(data.cache_control, data.expires, now);
 
-  return {};
+    metaDataCache(key).insert(key, data);
+
+    // Revalidations are frequent, the index records only changes. A deadline extended by
+    // max-age is recorded once the previous one has passed.
+    const auto& old_freshness = mdata->freshness;
+    const auto& new_freshness = data.freshness;
+    if (data.cache_control != mdata->cache_control || data.expires != mdata->expires ||
+        new_freshness.staleWhileRevalidate != old_freshness.staleWhileRevalidate ||
+        new_freshness.staleIfError != old_freshness.staleIfError ||
+        new_freshness.mustRevalidate != old_freshness.mustRevalidate ||
+        (new_freshness.freshUntil != old_freshness.freshUntil && old_freshness.freshUntil <= now))
+      logMetaData(key, data);
+  }
 }
 
-void ResponseCache::insertCachedBuffer(const std::string& etag,
-                                       const std::string& mime_type,
-                                       const std::string& cache_control,
-                                       const std::string& expires,
-                                       const std::string& vary,
-                                       const std::string& access_control_allow_origin,
-                                       const std::string& content_encoding,
-                                       const std::shared_ptr<std::string>& buffer)
+bool ResponseCache::isFresh(const CachedResponseMetaData& metadata, std::time_t now) const
 {
-  boost::hash<std::string> string_hash;
+  return itsSettings.serveFresh && now < metadata.freshness.freshUntil;
+}
 
-  // C++11 does not allow aggregate initialization when the struct has default initializers.
-  CachedResponseMetaData data;
-  data.buffer_hash = string_hash(*buffer);
-  data.mime_type = mime_type;
-  data.etag = etag;
-  data.cache_control = cache_control;
-  data.expires = expires;
-  data.vary = vary;
-  data.access_control_allow_origin = access_control_allow_origin;
-  data.content_encoding = content_encoding;
+bool ResponseCache::isUsableWhileRevalidating(const CachedResponseMetaData& metadata,
+                                              std::time_t now) const
+{
+  const auto& freshness = metadata.freshness;
+  if (!itsSettings.serveFresh || freshness.mustRevalidate)
+    return false;
 
-  itsMetaDataCache.insert(makeKey(etag, content_encoding), data);
+  const int seconds = (freshness.staleWhileRevalidate >= 0 ? freshness.staleWhileRevalidate
+                                                           : itsSettings.staleWhileRevalidate);
+  return now < freshness.freshUntil + seconds;
+}
+
+bool ResponseCache::isUsableOnError(const CachedResponseMetaData& metadata, std::time_t now) const
+{
+  const auto& freshness = metadata.freshness;
+  if (!itsSettings.serveFresh || freshness.mustRevalidate)
+    return false;
 
-  itsBufferCache.insert(data.buffer_hash, buffer);
+  const int seconds =
+      (freshness.staleIfError >= 0 ? freshness.staleIfError : itsSettings.staleIfError);
+  return now < freshness.freshUntil + seconds;
 }
 }  // namespace SmartMet
@@ -1,9 +1,22 @@
 #pragma once
 
+#include "CacheAdmission.h"
+#include "CacheIndexLog.h"
+#include "CachePurgeIndex.h"
+#include "LargeResponseStore.h"
+#include "ResponseFreshness.h"
+#include <atomic>
+#include <cstdint>
+#include <ctime>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <macgyver/Cache.h>
 #include <spine/SmartMetCache.h>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace SmartMet
 {
@@ -13,6 +26,8 @@ class ResponseCache
   struct CachedResponseMetaData
   {
     std::size_t buffer_hash = 0UL;
+    // Size of the cached content, checked on lookup in case the buffer has been replaced
+    std::size_t buffer_size = 0UL;
     std::string mime_type;
     std::string etag;
     std::string cache_control;
@@ -21,47 +36,274 @@ class ResponseCache
     std::string access_control_allow_origin;
     // Content-Encoding of the cached buffer: "" (identity), "gzip", "zstd", ...
     std::string content_encoding;
+    // The buffer is in the large response store instead of the buffer cache
+    bool large_response = false;
+    // Cache partition holding the buffer, empty for the shared partition
+    std::string partition;
+    // Tags from the Surrogate-Key and X-Cache-Tags headers, separated by spaces
+    std::string tags;
+    // Freshness derived from cache_control and expires
+    ResponseFreshness freshness;
   };
 
-  ResponseCache(std::size_t memoryCacheSize,
-                std::size_t filesystemCacheSize,
-                const std::filesystem::path& fileCachePath);
+  // A cached response: a buffer, or a mapped file for responses in the large response
+  // store. Both are null if the content has been evicted.
+  struct CachedContent
+  {
+    std::shared_ptr<std::string> buffer;
+    std::shared_ptr<MappedFile> file;
+    CachedResponseMetaData metadata;
+
+    explicit operator bool() const { return buffer || file; }
+    std::size_t size() const { return buffer ? buffer->size() : (file ? file->size() : 0); }
+  };
+
+  // Settings from the "response_cache" configuration block
+  struct Settings
+  {
+    std::size_t memorySize = 0;
+    std::size_t filesystemSize = 0;
+    std::filesystem::path directory;
+
+    // Number of independently locked parts the caches are split into
+    std::size_t shards = 1;
+
+    // Parts of the buffer caches reserved for the services whose URI begins with the
+    // prefix. The rest of the memory and filesystem sizes is shared by the other services.
+    struct Partition
+    {
+      std::string name;
+      std::string prefix;
+      std::size_t memorySize = 0;
+      std::size_t filesystemSize = 0;
+    };
+    std::vector<Partition> partitions;
+
+    // Which responses are cached once the cache is full
+    CacheAdmission::Settings admission;
+
+    // Serve fresh responses without contacting the backend
+    bool serveFresh = false;
+
+    // Seconds stale responses may be served while revalidating or when the backends fail,
+    // unless the backend gives stale-while-revalidate or stale-if-error itself
+    int staleWhileRevalidate = 0;
+    int staleIfError = 0;
+
+    // Compressed variants created by the frontend for identity responses
+    struct Compression
+    {
+      bool enabled = false;
+      std::size_t minSize = 1024;  // smaller responses are not worth compressing
+      int gzipLevel = 6;
+      int zstdLevel = 3;
+    } compression;
+
+    // Responses too large to be cached in memory
+    LargeResponseStore::Settings largeResponses;
+
+    // Persistent index of the cached responses
+    CacheIndexLog::Settings index;
+  };
+
+  // The persistent index is loaded in the background, cache lookups work meanwhile
+  explicit ResponseCache(const Settings& theSettings);
+  ~ResponseCache();
+
+  ResponseCache(const ResponseCache& other) = delete;
+  ResponseCache(ResponseCache&& other) = delete;
+  ResponseCache& operator=(const ResponseCache& other) = delete;
+  ResponseCache& operator=(ResponseCache&& other) = delete;
+
+  const Settings& getSettings() const { return itsSettings; }
+
+  // Content encodings which may be cached: compressed ones in order of preference, then
+  // identity
+  static const std::vector<std::string>& cachedEncodings();
 
   // Cache variants of the same resource (same ETag) but different Content-Encoding are
   // stored side by side, keyed by (etag, content_encoding). An empty content_encoding
   // means the identity (uncompressed) representation.
-  std::pair<std::shared_ptr<std::string>, CachedResponseMetaData> getCachedBuffer(
-      const std::string& etag, const std::string& content_encoding);
-
-  void insertCachedBuffer(const std::string& etag,
-                          const std::string& mime_type,
-                          const std::string& cache_control,
-                          const std::string& expires,
-                          const std::string& vary,
-                          const std::string& access_control_allow_origin,
-                          const std::string& content_encoding,
-                          const std::shared_ptr<std::string>& buffer);
-
-  Fmi::Cache::CacheStats getMetaDataCacheStats() const { return itsMetaDataCache.statistics(); }
-  Fmi::Cache::CacheStats getMemoryCacheStats() const
-  {
-    return itsBufferCache.getMemoryCacheStats();
-  }
-  Fmi::Cache::CacheStats getFileCacheStats() const { return itsBufferCache.getFileCacheStats(); }
+  CachedContent getCachedContent(const std::string& etag, const std::string& content_encoding);
+
+  // Name of the partition for responses to the backend resource, empty for the shared
+  // partition. The backend resource begins with the URI of the service.
+  std::string findPartition(const std::string& resource) const;
+
+  // Insert a response received from a backend. Returns the metadata stored for the buffer,
+  // with the freshness computed from the headers. The content hash (ContentHash) is
+  // computed by the caller while the response is received. Identical content already in
+  // the cache is shared. A response rejected by the admission policy, or whose content
+  // hash collides with different content, is not cached. A full partition borrows room
+  // from the partition with most of its quota unused.
+  CachedResponseMetaData insertCachedBuffer(const CachedResponseMetaData& metadata,
+                                            const std::shared_ptr<std::string>& buffer,
+                                            std::uint64_t content_hash);
+
+  // Insert another encoding of a cached response. The metadata is copied from the
+  // original, including its freshness.
+  void insertCachedVariant(const CachedResponseMetaData& metadata,
+                           const std::shared_ptr<std::string>& buffer);
+
+  // Insert a response written to a file of the large response store. The file is
+  // discarded if it is not admitted or cannot be stored.
+  void insertCachedFile(const CachedResponseMetaData& metadata,
+                        std::unique_ptr<LargeResponseStore::Writer> writer,
+                        std::uint64_t content_hash);
+
+  LargeResponseStore& getLargeResponseStore() { return itsLargeResponseStore; }
+
+  // True if a buffer for the (etag, content_encoding) variant is known. Only the metadata
+  // is consulted, the buffer itself may still have been evicted.
+  bool hasCachedBuffer(const std::string& etag, const std::string& content_encoding);
+
+  // Request -> ETag index used to make conditional requests to the backends. The key must
+  // identify the request and every input that selects the cached variant. The index is
+  // only a hint: a stale ETag merely makes the backend return the full response.
+  std::vector<std::string> getKnownETags(const std::string& request_key);
+  void rememberETag(const std::string& request_key, const std::string& etag);
+
+  // Remove cached responses: all encodings of a response, the responses to requests whose
+  // key (the backend resource and query string) begins with the prefix, or the responses
+  // with the tag. Returns the number of cached encodings removed.
+  std::size_t purgeETag(const std::string& etag);
+  std::size_t purgePrefix(const std::string& prefix);
+  std::size_t purgeTag(const std::string& tag);
+
+  // Update the freshness of all cached encodings of a response after the backend has
+  // revalidated it
+  void refreshCachedResponse(const std::string& etag,
+                             const std::string& cache_control,
+                             const std::string& expires);
+
+  // Whether a cached response may be served without the backend at the given time:
+  // fresh, stale while being revalidated, or stale because the backends failed
+  bool isFresh(const CachedResponseMetaData& metadata, std::time_t now) const;
+  bool isUsableWhileRevalidating(const CachedResponseMetaData& metadata, std::time_t now) const;
+  bool isUsableOnError(const CachedResponseMetaData& metadata, std::time_t now) const;
+
+  // Statistics summed over the shards
+  Fmi::Cache::CacheStats getMetaDataCacheStats() const;
+  Fmi::Cache::CacheStats getETagIndexStats() const;
+  Fmi::Cache::CacheStats getMemoryCacheStats() const;
+  Fmi::Cache::CacheStats getFileCacheStats() const;
+  Fmi::Cache::CacheStats getIndexLogStats() const { return itsIndexLog.getStats(); }
+
+  // Content shared between responses, buffers and large response files combined: inserts
+  // are the stored contents, hits the inserts which found identical content already
+  // stored, size the bytes saved by sharing it and misses the responses not cached
+  // because of a content hash collision
+  Fmi::Cache::CacheStats getDeduplicationStats() const;
+
+  // Cached responses served (hits) versus cacheable responses fetched from the backends
+  // (misses), counted in responses and in bytes
+  Fmi::Cache::CacheStats getObjectHitStats() const;
+  Fmi::Cache::CacheStats getByteHitStats() const;
+
+  Fmi::Cache::CacheStats getAdmissionStats() const { return itsAdmission.getStats(); }
+
+  // Statistics of each partition by name, the shared partition first with an empty name.
+  // Sizes are memory and filesystem bytes combined, inserts the stored buffers, hits the
+  // cached responses served and misses the responses fetched from the backends.
+  std::vector<std::pair<std::string, Fmi::Cache::CacheStats>> getPartitionStats() const;
 
  private:
   // Metadata cache key combining the ETag and the content encoding, so that all
   // encodings of a resource live in a single cache.
   static std::string makeKey(const std::string& etag, const std::string& content_encoding);
 
-  // Cache (ETag, encoding) -> Bufferhash
-  using MetaDataCache = Fmi::Cache::Cache<std::string, CachedResponseMetaData>;
+  // Metadata of a cached response, nullopt if unknown or purged
+  std::optional<CachedResponseMetaData> findMetaData(const std::string& key);
+
+  // Record index updates in the persistent index, and restore them at startup
+  void logMetaData(const std::string& key, const CachedResponseMetaData& metadata);
+  void loadIndex();
+  void compactIndex(const CacheIndexLog::Replayer& replay,
+                    const CacheIndexLog::RecordHandler& write);
 
   // Cache Bufferhash -> Buffer
   using BufferCache = Spine::SmartMetCache;
 
-  MetaDataCache itsMetaDataCache;
+  // Buffer caches with their own quota, one cache per shard
+  struct Partition
+  {
+    std::string name;
+    std::string prefix;
+    std::vector<std::unique_ptr<BufferCache>> bufferCaches;
+
+    // Statistics
+    std::atomic<std::size_t> inserts{0};
+    std::atomic<std::size_t> hits{0};
+    std::atomic<std::size_t> misses{0};
+  };
+
+  Partition& partition(const std::string& name);
+  BufferCache& bufferCache(Partition& partition, std::size_t buffer_hash);
+
+  // The partition to store a buffer in: the given one if the buffer fits in its quota,
+  // else the one with most room for it. Nullptr if no partition has room.
+  Partition* choosePartition(Partition& home, std::size_t buffer_hash, std::size_t size);
+
+  // Store a buffer under its content hash unless identical content is already stored.
+  // Returns false if different content is stored under the same hash.
+  bool storeBuffer(BufferCache& cache,
+                   std::size_t buffer_hash,
+                   const std::shared_ptr<std::string>& buffer);
+
+  // Cache (ETag, encoding) -> Bufferhash
+  using MetaDataCache = Fmi::Cache::Cache<std::string, CachedResponseMetaData>;
+
+  // Cache request -> most recent ETags
+  using ETagIndex = Fmi::Cache::Cache<std::string, std::vector<std::string>>;
+
+  // The caches are split by key hash so that concurrent lookups and inserts of different
+  // responses seldom contend for the same lock. Metadata, ETag index entries and buffers
+  // are each placed by their own key, the buffers within their partition.
+  struct Shard
+  {
+    explicit Shard(std::size_t theEntries);
+
+    MetaDataCache metaDataCache;
+    ETagIndex etagIndex;
+  };
+
+  MetaDataCache& metaDataCache(const std::string& key);
+  ETagIndex& etagIndex(const std::string& request_key);
+
+  Fmi::Cache::CacheStats combineStats(
+      const std::function<Fmi::Cache::CacheStats(const Shard&)>& getStats) const;
+  Fmi::Cache::CacheStats combineBufferStats(
+      const std::vector<std::unique_ptr<BufferCache>>& bufferCaches,
+      const std::function<Fmi::Cache::CacheStats(const BufferCache&)>& getStats) const;
+
+  const Settings itsSettings;
+
+  std::vector<std::unique_ptr<Shard>> itsShards;
+
+  // The shared partition first
+  std::vector<std::unique_ptr<Partition>> itsPartitions;
+
+  LargeResponseStore itsLargeResponseStore;
+
+  // Deduplication statistics of the buffer caches
+  const Fmi::DateTime itsStartTime;
+  std::atomic<std::size_t> itsBufferInserts{0};
+  std::atomic<std::size_t> itsDuplicateBuffers{0};
+  std::atomic<std::size_t> itsDuplicateBufferSize{0};
+  std::atomic<std::size_t> itsBufferCollisions{0};
+
+  CacheAdmission itsAdmission;
+
+  // Hit statistics
+  std::atomic<std::size_t> itsObjectHits{0};
+  std::atomic<std::size_t> itsObjectMisses{0};
+  std::atomic<std::size_t> itsByteHits{0};
+  std::atomic<std::size_t> itsByteMisses{0};
+
+  CachePurgeIndex itsPurgeIndex;
 
-  BufferCache itsBufferCache;
+  CacheIndexLog itsIndexLog;
+  std::thread itsIndexLoader;
+  std::atomic<bool> itsIndexLoaded{false};
 };
 }  // namespace SmartMet
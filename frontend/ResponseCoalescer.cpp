@@ -0,0 +1,117 @@
+#include "ResponseCoalescer.h"
+#include <macgyver/Exception.h>
+
+namespace SmartMet
+{
+void CoalescedResponse::append(const std::string& theData)
+{
+  if (theData.empty())
+    return;
+
+  std::unique_lock<std::mutex> lock(itsMutex);
+  itsStatus = Status::STREAMING;
+  itsChunks.push_back(theData);
+  itsSize += theData.size();
+  notify(lock);
+}
+
+void CoalescedResponse::end(bool theSuccess)
+{
+  std::unique_lock<std::mutex> lock(itsMutex);
+  if (itsStatus == Status::PENDING)
+    itsStatus = Status::NOT_SHARED;
+  else if (itsStatus == Status::STREAMING)
+    itsStatus = (theSuccess ? Status::FINISHED : Status::FAILED);
+  notify(lock);
+}
+
+CoalescedResponse::Status CoalescedResponse::read(std::size_t& theIndex,
+                                                  std::vector<std::string>& theChunks)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  for (; theIndex < itsChunks.size(); ++theIndex)
+    theChunks.push_back(itsChunks[theIndex]);
+
+  return itsStatus;
+}
+
+void CoalescedResponse::subscribe(std::function<void()> theListener)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsListeners.push_back(std::move(theListener));
+}
+
+// The listeners may read the response, hence they are called after unlocking
+void CoalescedResponse::notify(std::unique_lock<std::mutex>& theLock)
+{
+  const auto listeners = itsListeners;
+  theLock.unlock();
+  for (const auto& listener : listeners)
+    listener();
+}
+
+std::size_t CoalescedResponse::size() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  return itsSize;
+}
+
+ResponseCoalescer::ResponseCoalescer() : itsStartTime(Fmi::MicrosecClock::universal_time()) {}
+
+std::pair<std::shared_ptr<CoalescedResponse>, bool> ResponseCoalescer::join(
+    const std::string& theKey)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    auto pos = itsResponses.find(theKey);
+    if (pos != itsResponses.end())
+    {
+      ++itsFollowerCount;
+      return {pos->second, false};
+    }
+
+    auto response = std::make_shared<CoalescedResponse>();
+    itsResponses.insert(std::make_pair(theKey, response));
+    ++itsLeaderCount;
+    return {response, true};
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void ResponseCoalescer::close(const std::string& theKey,
+                              const std::shared_ptr<CoalescedResponse>& theResponse)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    auto pos = itsResponses.find(theKey);
+    if (pos != itsResponses.end() && pos->second == theResponse)
+      itsResponses.erase(pos);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+Fmi::Cache::CacheStats ResponseCoalescer::getStats() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.size = itsResponses.size();
+  stats.inserts = itsLeaderCount;
+  stats.hits = itsFollowerCount;
+  stats.misses = itsLeaderCount;
+  return stats;
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <macgyver/CacheStats.h>
+#include <macgyver/DateTime.h>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace SmartMet
+{
+// A backend response being streamed by one LowLatencyGatewayStreamer (the leader) which
+// other streamers requesting the same content (the followers) replay to their clients.
+// All data is kept until the last follower is done, so followers joining late still
+// receive the response from the beginning. The followers are told about new data and the
+// end of the response instead of polling for them.
+
+class CoalescedResponse
+{
+ public:
+  enum class Status
+  {
+    PENDING,     // the leader has not received a shareable response yet
+    STREAMING,   // data is being received
+    FINISHED,    // the whole response has been received
+    FAILED,      // the backend connection failed after data was shared
+    NOT_SHARED   // the leader got a response which cannot be shared
+  };
+
+  // Leader: add more response data
+  void append(const std::string& theData);
+
+  // Leader: the response ended. Before any data this means the response was not shared.
+  void end(bool theSuccess);
+
+  // Follower: copy chunks starting from theIndex without waiting. theIndex is advanced
+  // past the returned chunks.
+  Status read(std::size_t& theIndex, std::vector<std::string>& theChunks);
+
+  // Follower: call the listener whenever data is appended or the response ends. The
+  // listener is called without any locks held by the response, but possibly while the
+  // leader holds its own, and must hence not block.
+  void subscribe(std::function<void()> theListener);
+
+  std::size_t size() const;
+
+ private:
+  void notify(std::unique_lock<std::mutex>& theLock);
+
+  mutable std::mutex itsMutex;
+  std::vector<std::function<void()>> itsListeners;
+  Status itsStatus = Status::PENDING;
+  std::vector<std::string> itsChunks;
+  std::size_t itsSize = 0;
+};
+
+// Registry of in-flight responses which new identical requests may attach to
+
+class ResponseCoalescer
+{
+ public:
+  ResponseCoalescer();
+
+  // Return the in-flight response for the key, and true if the caller is the first one
+  // and hence responsible for fetching it
+  std::pair<std::shared_ptr<CoalescedResponse>, bool> join(const std::string& theKey);
+
+  // Stop new requests from attaching to the response
+  void close(const std::string& theKey, const std::shared_ptr<CoalescedResponse>& theResponse);
+
+  // Hits are requests attached to an in-flight response, misses are leaders
+  Fmi::Cache::CacheStats getStats() const;
+
+ private:
+  mutable std::mutex itsMutex;
+  std::map<std::string, std::shared_ptr<CoalescedResponse>> itsResponses;
+
+  // Statistics
+  const Fmi::DateTime itsStartTime;
+  std::size_t itsLeaderCount = 0;
+  std::size_t itsFollowerCount = 0;
+};
+
+}  // namespace SmartMet
@@ -0,0 +1,180 @@
+#include "ResponseCompressor.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <macgyver/Exception.h>
+
+namespace SmartMet
+{
+std::string compressContent(const std::string& theData, const std::string& theEncoding, int theLevel)
+{
+  try
+  {
+    namespace io = boost::iostreams;
+
+    std::string result;
+    {
+      io::filtering_ostream out;
+      if (theEncoding == "gzip")
+        out.push(io::gzip_compressor(io::gzip_params(theLevel)));
+      else if (theEncoding == "zstd")
+        out.push(io::zstd_compressor(io::zstd_params(theLevel)));
+      else
+        throw Fmi::Exception(BCP, "Unsupported content encoding")
+            .addParameter("Encoding", theEncoding);
+
+      out.push(io::back_inserter(result));
+      out.write(theData.data(), static_cast<std::streamsize>(theData.size()));
+    }  // Destroying the stream flushes the compressor
+    return result;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::optional<std::string> decompressContent(std::string_view theData,
+                                             const std::string& theEncoding,
+                                             std::size_t theMaxSize)
+{
+  try
+  {
+    namespace io = boost::iostreams;
+
+    io::filtering_istream in;
+    if (theEncoding == "gzip")
+      in.push(io::gzip_decompressor());
+    else if (theEncoding == "zstd")
+      in.push(io::zstd_decompressor());
+    else
+      throw Fmi::Exception(BCP, "Unsupported content encoding")
+          .addParameter("Encoding", theEncoding);
+    in.push(io::array_source(theData.data(), theData.size()));
+
+    // Decoded in blocks so that a large result is noticed before it has been allocated
+    std::string result;
+    char block[65536];
+    while (in.read(block, sizeof(block)) || in.gcount() > 0)
+    {
+      result.append(block, static_cast<std::size_t>(in.gcount()));
+      if (result.size() > theMaxSize)
+        return std::nullopt;
+    }
+    return result;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+ResponseCompressor::ResponseCompressor(boost::asio::io_context& theIoContext,
+                                       ResponseCache& theCache)
+    : itsIoContext(theIoContext),
+      itsCache(theCache),
+      itsSettings(theCache.getSettings().compression),
+      itsStartTime(Fmi::MicrosecClock::universal_time())
+{
+}
+
+bool ResponseCompressor::isCompressible(const std::string& theMimeType)
+{
+  // Images, archives and the like are compressed already
+  return (boost::algorithm::istarts_with(theMimeType, "text/") ||
+          boost::algorithm::icontains(theMimeType, "json") ||
+          boost::algorithm::icontains(theMimeType, "xml") ||
+          boost::algorithm::icontains(theMimeType, "javascript") ||
+          boost::algorithm::icontains(theMimeType, "csv"));
+}
+
+void ResponseCompressor::compress(const ResponseCache::CachedResponseMetaData& theMetaData,
+                                  const std::shared_ptr<std::string>& theBuffer)
+{
+  try
+  {
+    if (!itsSettings.enabled || !theBuffer || theBuffer->size() < itsSettings.minSize ||
+        theMetaData.large_response || !theMetaData.content_encoding.empty() ||
+        !isCompressible(theMetaData.mime_type))
+      return;
+
+    {
+      // Concurrent responses with the same ETag need to be compressed only once
+      std::lock_guard<std::mutex> lock(itsMutex);
+      if (!itsPending.insert(theMetaData.etag).second)
+        return;
+    }
+
+    boost::asio::post(itsIoContext,
+                      [this, theMetaData, theBuffer] { run(theMetaData, theBuffer); });
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void ResponseCompressor::run(const ResponseCache::CachedResponseMetaData& theMetaData,
+                             const std::shared_ptr<std::string>& theBuffer)
+{
+  try
+  {
+    for (const auto& encoding : ResponseCache::cachedEncodings())
+    {
+      if (encoding.empty())
+        continue;
+
+      if (itsCache.hasCachedBuffer(theMetaData.etag, encoding))
+      {
+        std::lock_guard<std::mutex> lock(itsMutex);
+        ++itsSkipCount;
+        continue;
+      }
+
+      const int level = (encoding == "gzip" ? itsSettings.gzipLevel : itsSettings.zstdLevel);
+      auto buffer = std::make_shared<std::string>(compressContent(*theBuffer, encoding, level));
+
+      // The response now depends on Accept-Encoding even if the backend's did not
+      ResponseCache::CachedResponseMetaData metadata = theMetaData;
+      metadata.content_encoding = encoding;
+      if (!metadata.vary.empty() && !boost::algorithm::icontains(metadata.vary, "Accept-Encoding"))
+        metadata.vary += ", Accept-Encoding";
+
+      itsCache.insertCachedVariant(metadata, buffer);
+
+      std::lock_guard<std::mutex> lock(itsMutex);
+      ++itsVariantCount;
+    }
+  }
+  catch (...)
+  {
+    // Runs on the backend threads, the identity response is still usable
+    Fmi::Exception ex(BCP, "Response compression failed", nullptr);
+    ex.addParameter("ETag", theMetaData.etag);
+    ex.printError();
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    ++itsFailureCount;
+  }
+
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsPending.erase(theMetaData.etag);
+}
+
+Fmi::Cache::CacheStats ResponseCompressor::getStats() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.size = itsPending.size();
+  stats.inserts = itsVariantCount;
+  stats.hits = itsSkipCount;
+  stats.misses = itsFailureCount;
+  return stats;
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "ResponseCache.h"
+#include <boost/asio.hpp>
+#include <macgyver/CacheStats.h>
+#include <macgyver/DateTime.h>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+
+namespace SmartMet
+{
+// Encode or decode content in the given Content-Encoding ("gzip" or "zstd"). Decoding
+// gives up and returns nothing once the result would exceed theMaxSize.
+std::string compressContent(const std::string& theData, const std::string& theEncoding, int theLevel);
+std::optional<std::string> decompressContent(std::string_view theData,
+                                             const std::string& theEncoding,
+                                             std::size_t theMaxSize);
+
+// Creates gzip and zstd variants of cached identity responses on the backend threads, so
+// that clients accepting compression get compressed content even when the backend did
+// not compress the response itself.
+
+class ResponseCompressor
+{
+ public:
+  ResponseCompressor(boost::asio::io_context& theIoContext, ResponseCache& theCache);
+
+  ResponseCompressor(const ResponseCompressor& other) = delete;
+  ResponseCompressor(ResponseCompressor&& other) = delete;
+  ResponseCompressor& operator=(const ResponseCompressor& other) = delete;
+  ResponseCompressor& operator=(ResponseCompressor&& other) = delete;
+
+  bool enabled() const { return itsSettings.enabled; }
+
+  // Schedule the creation of the missing compressed variants of a cached identity response
+  void compress(const ResponseCache::CachedResponseMetaData& theMetaData,
+                const std::shared_ptr<std::string>& theBuffer);
+
+  // Inserts are created variants, hits skipped ones which already existed and misses
+  // failed compressions
+  Fmi::Cache::CacheStats getStats() const;
+
+  // True for content types which benefit from compression
+  static bool isCompressible(const std::string& theMimeType);
+
+ private:
+  void run(const ResponseCache::CachedResponseMetaData& theMetaData,
+           const std::shared_ptr<std::string>& theBuffer);
+
+  boost::asio::io_context& itsIoContext;
+  ResponseCache& itsCache;
+  const ResponseCache::Settings::Compression itsSettings;
+
+  // ETags being compressed
+  mutable std::mutex itsMutex;
+  std::set<std::string> itsPending;
+
+  // Statistics
+  const Fmi::DateTime itsStartTime;
+  std::size_t itsVariantCount = 0;
+  std::size_t itsSkipCount = 0;
+  std::size_t itsFailureCount = 0;
+};
+
+}  // namespace SmartMet
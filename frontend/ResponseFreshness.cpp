@@ -0,0 +1,112 @@
+#include "ResponseFreshness.h"
+#include <boost/algorithm/string.hpp>
+#include <macgyver/Exception.h>
+#include <cstdlib>
+#include <vector>
+
+namespace SmartMet
+{
+namespace
+{
+// Parse a delta-seconds directive value. Returns -1 on failure.
+int parse_seconds(const std::string& value)
+{
+  auto str = boost::algorithm::trim_copy_if(value, boost::algorithm::is_any_of(" \t\""));
+  if (str.empty())
+    return -1;
+
+  char* end = nullptr;
+  const auto seconds = std::strtol(str.c_str(), &end, 10);
+  if (end == nullptr || *end != '\0' || seconds < 0)
+    return -1;
+
+  // Clamp to about 68 years, RFC 9111 requires accepting large values
+  return static_cast<int>(std::min(seconds, 2147483647L));
+}
+}  // namespace
+
+ResponseFreshness ResponseFreshness::parse(const std::string& theCacheControl,
+                                           const std::string& theExpires,
+                                           std::time_t theNow)
+{
+  try
+  {
+    ResponseFreshness freshness;
+
+    // Without other information the response is stale as soon as it is received
+    freshness.freshUntil = theNow;
+
+    int max_age = -1;
+    int s_maxage = -1;
+    bool no_cache = false;
+
+    std::vector<std::string> directives;
+    boost::algorithm::split(directives, theCacheControl, boost::algorithm::is_any_of(","));
+
+    for (const auto& directive : directives)
+    {
+      std::string name = directive;
+      std::string value;
+      const auto pos = directive.find('=');
+      if (pos != std::string::npos)
+      {
+        name = directive.substr(0, pos);
+        value = directive.substr(pos + 1);
+      }
+      boost::algorithm::trim(name);
+      boost::algorithm::to_lower(name);
+
+      if (name == "max-age")
+        max_age = parse_seconds(value);
+      else if (name == "s-maxage")
+        s_maxage = parse_seconds(value);
+      else if (name == "stale-while-revalidate")
+        freshness.staleWhileRevalidate = parse_seconds(value);
+      else if (name == "stale-if-error")
+        freshness.staleIfError = parse_seconds(value);
+      else if (name == "no-cache")
+        no_cache = true;
+      else if (name == "must-revalidate" || name == "proxy-revalidate")
+        freshness.mustRevalidate = true;
+      else if (name == "no-store" || name == "private")
+      {
+        // Not meant for a shared cache, always ask the backend
+        no_cache = true;
+        freshness.mustRevalidate = true;
+      }
+    }
+
+    if (no_cache)
+      return freshness;
+
+    // A shared cache prefers s-maxage, and max-age overrides Expires
+    if (s_maxage >= 0)
+      freshness.freshUntil = theNow + s_maxage;
+    else if (max_age >= 0)
+      freshness.freshUntil = theNow + max_age;
+    else if (!theExpires.empty())
+    {
+      // Invalid dates such as "0" mean already expired
+      const auto expires = parseHttpDate(theExpires);
+      if (expires > theNow)
+        freshness.freshUntil = expires;
+    }
+
+    return freshness;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::time_t ResponseFreshness::parseHttpDate(const std::string& theDate)
+{
+  std::tm tm{};
+  const char* end = strptime(theDate.c_str(), "%a, %d %b %Y %H:%M:%S", &tm);
+  if (end == nullptr)
+    return -1;
+  return timegm(&tm);
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <ctime>
+#include <string>
+
+namespace SmartMet
+{
+// Freshness of a cached response as given by the backend in the Cache-Control and Expires
+// headers (RFC 9111), including the stale-while-revalidate and stale-if-error extensions
+// (RFC 5861).
+
+struct ResponseFreshness
+{
+  // The response may be served without contacting the backend until this time
+  std::time_t freshUntil = 0;
+
+  // Seconds a stale response may be served while revalidating, or on backend errors.
+  // Negative if the backend did not say.
+  int staleWhileRevalidate = -1;
+  int staleIfError = -1;
+
+  // Stale responses must never be served (must-revalidate, no-store, private)
+  bool mustRevalidate = false;
+
+  // Parse the headers of a response received at the given time
+  static ResponseFreshness parse(const std::string& theCacheControl,
+                                 const std::string& theExpires,
+                                 std::time_t theNow);
+
+  // Parse an HTTP date such as "Sun, 06 Nov 1994 08:49:37 GMT". Returns -1 on failure.
+  static std::time_t parseHttpDate(const std::string& theDate);
+};
+
+}  // namespace SmartMet
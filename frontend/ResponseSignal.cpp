@@ -0,0 +1,24 @@
+#include "ResponseSignal.h"
+
+namespace SmartMet
+{
+void ResponseSignal::notify()
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsRaised = true;
+  itsCondition.notify_all();
+}
+
+void ResponseSignal::reset()
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsRaised = false;
+}
+
+bool ResponseSignal::waitUntil(std::chrono::steady_clock::time_point theDeadline)
+{
+  std::unique_lock<std::mutex> lock(itsMutex);
+  return itsCondition.wait_until(lock, theDeadline, [this] { return itsRaised; });
+}
+
+}  // namespace SmartMet
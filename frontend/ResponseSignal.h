@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace SmartMet
+{
+// Raised by a streamer when its response starts or fails. Shared by the copies of a
+// hedged request so that the server thread can wait for whichever responds first. The
+// flag is reset before the streamers are inspected, hence a response arriving between
+// the inspection and the wait is not missed.
+
+class ResponseSignal
+{
+ public:
+  ResponseSignal() = default;
+
+  ResponseSignal(const ResponseSignal& other) = delete;
+  ResponseSignal(ResponseSignal&& other) = delete;
+  ResponseSignal& operator=(const ResponseSignal& other) = delete;
+  ResponseSignal& operator=(ResponseSignal&& other) = delete;
+
+  void notify();
+  void reset();
+
+  // Returns false on timeout
+  bool waitUntil(std::chrono::steady_clock::time_point theDeadline);
+
+ private:
+  std::mutex itsMutex;
+  std::condition_variable itsCondition;
+  bool itsRaised = false;
+};
+
+}  // namespace SmartMet
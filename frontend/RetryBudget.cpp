@@ -0,0 +1,72 @@
+#include "RetryBudget.h"
+#include <macgyver/Exception.h>
+
+namespace SmartMet
+{
+namespace
+{
+enum Counter : std::size_t
+{
+  REQUESTS,
+  RETRIES
+};
+}  // namespace
+
+RetryBudget::RetryBudget(const Settings& theSettings)
+    : itsSettings(theSettings),
+      itsCounts(theSettings.window, 2),
+      itsStartTime(Fmi::MicrosecClock::universal_time())
+{
+}
+
+void RetryBudget::recordRequest(Clock::time_point theTime)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsCounts.add(REQUESTS, theTime);
+}
+
+bool RetryBudget::canRetry(Clock::time_point theTime)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+    const auto requests = itsCounts.total(REQUESTS, theTime);
+    const auto retries = itsCounts.total(RETRIES, theTime);
+
+    const double allowed = itsSettings.minRetries + itsSettings.percent / 100.0 * requests;
+    return (retries + 1 <= allowed);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void RetryBudget::recordRetry(Clock::time_point theTime)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsCounts.add(RETRIES, theTime);
+  ++itsRetries;
+}
+
+void RetryBudget::recordRefusal()
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  ++itsRefusals;
+}
+
+Fmi::Cache::CacheStats RetryBudget::getStats() const
+{
+  const auto now = Clock::now();
+
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.size = itsCounts.total(REQUESTS, now);
+  stats.hits = itsRetries;
+  stats.misses = itsRefusals;
+  return stats;
+}
+
+}  // namespace SmartMet
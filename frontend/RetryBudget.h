@@ -0,0 +1,68 @@
+#pragma once
+
+#include "SlidingWindowCounter.h"
+#include <macgyver/CacheStats.h>
+#include <macgyver/DateTime.h>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+namespace SmartMet
+{
+// Limits the GET requests resent to another backend after a connect failure or a failure
+// before any response was received. Retries may make up only a percentage of the requests
+// during the last few seconds, with a small allowance for low traffic. A transient failure
+// of one backend then costs only latency, while a failing cluster does not get a second
+// wave of requests on top of the first.
+
+class RetryBudget
+{
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Settings
+  {
+    bool enabled = false;
+    std::size_t maxRetries = 2;   // retries of a single request
+    double percent = 10;          // retries relative to requests
+    std::size_t minRetries = 10;  // retries allowed in the window regardless of traffic
+    int window = 10;              // seconds
+  };
+
+  explicit RetryBudget(const Settings& theSettings);
+
+  RetryBudget(const RetryBudget& other) = delete;
+  RetryBudget(RetryBudget&& other) = delete;
+  RetryBudget& operator=(const RetryBudget& other) = delete;
+  RetryBudget& operator=(RetryBudget&& other) = delete;
+
+  const Settings& getSettings() const { return itsSettings; }
+
+  // A retriable request arrived
+  void recordRequest(Clock::time_point theTime = Clock::now());
+
+  // True if one more retry fits in the budget
+  bool canRetry(Clock::time_point theTime = Clock::now());
+
+  void recordRetry(Clock::time_point theTime = Clock::now());
+
+  // A failed request could not be retried since the budget was used up
+  void recordRefusal();
+
+  // Size is the number of requests in the window, hits are the retries and misses the
+  // retries refused
+  Fmi::Cache::CacheStats getStats() const;
+
+ private:
+  const Settings itsSettings;
+
+  mutable std::mutex itsMutex;
+  SlidingWindowCounter itsCounts;  // requests and retries in the window
+
+  // Statistics
+  const Fmi::DateTime itsStartTime;
+  std::size_t itsRetries = 0;
+  std::size_t itsRefusals = 0;
+};
+
+}  // namespace SmartMet
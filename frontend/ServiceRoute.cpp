@@ -0,0 +1,37 @@
+#include "ServiceRoute.h"
+
+namespace SmartMet
+{
+namespace
+{
+bool starts_with(std::string_view theString, std::string_view thePrefix)
+{
+  return theString.substr(0, thePrefix.size()) == thePrefix;
+}
+}  // namespace
+
+std::optional<std::size_t> ServiceRoute::match(std::string_view theResource,
+                                               std::string_view theServiceURI,
+                                               bool thePrefix,
+                                               std::string_view theHostName)
+{
+  if (thePrefix ? starts_with(theResource, theServiceURI) : theResource == theServiceURI)
+    return 0;
+
+  // "/host" followed by the service URI. A prefix service needs the '/' after the host
+  // name even if its URI does not begin with one.
+  const auto strip = theHostName.size() + 1;
+  if (theResource.size() < strip || theResource[0] != '/' ||
+      theResource.substr(1, theHostName.size()) != theHostName)
+    return {};
+
+  const auto rest = theResource.substr(strip);
+  const bool matches = (thePrefix ? starts_with(rest, "/") && starts_with(rest, theServiceURI)
+                                  : rest == theServiceURI);
+  if (!matches)
+    return {};
+
+  return strip;
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+namespace SmartMet
+{
+// Matching of a request resource to the service Sputnik selected for it. The resource may
+// be given either as is or prefixed with the backend host name ("/host/service"), in which
+// case the prefix is removed before sending the request to the backend. The matching is
+// done on views of the strings and does not allocate memory.
+
+struct ServiceRoute
+{
+  // Number of leading characters to remove from the resource, or nothing if the resource
+  // does not match the service. A prefix service matches any resource beginning with the
+  // URI, otherwise the resource must equal it.
+  static std::optional<std::size_t> match(std::string_view theResource,
+                                          std::string_view theServiceURI,
+                                          bool thePrefix,
+                                          std::string_view theHostName);
+};
+
+}  // namespace SmartMet
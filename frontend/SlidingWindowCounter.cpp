@@ -0,0 +1,51 @@
+#include "SlidingWindowCounter.h"
+#include <algorithm>
+
+namespace SmartMet
+{
+namespace
+{
+long seconds(SlidingWindowCounter::Clock::time_point theTime)
+{
+  return std::chrono::duration_cast<std::chrono::seconds>(theTime.time_since_epoch()).count();
+}
+}  // namespace
+
+SlidingWindowCounter::SlidingWindowCounter(int theWindow, std::size_t theCounters)
+    : itsCounters(theCounters),
+      itsSeconds(std::max(1, theWindow), -1),
+      itsCounts(itsSeconds.size() * theCounters, 0)
+{
+}
+
+void SlidingWindowCounter::add(std::size_t theCounter, Clock::time_point theTime)
+{
+  const auto second = seconds(theTime);
+  const auto slot = static_cast<std::size_t>(second) % itsSeconds.size();
+  auto counts = itsCounts.begin() + static_cast<long>(slot * itsCounters);
+  if (itsSeconds[slot] != second)
+  {
+    itsSeconds[slot] = second;
+    std::fill(counts, counts + static_cast<long>(itsCounters), 0);
+  }
+  ++counts[static_cast<long>(theCounter)];
+}
+
+std::size_t SlidingWindowCounter::total(std::size_t theCounter, Clock::time_point theTime) const
+{
+  const auto oldest = seconds(theTime) - static_cast<long>(itsSeconds.size());
+
+  std::size_t sum = 0;
+  for (std::size_t slot = 0; slot < itsSeconds.size(); slot++)
+    if (itsSeconds[slot] > oldest)
+      sum += itsCounts[slot * itsCounters + theCounter];
+  return sum;
+}
+
+void SlidingWindowCounter::clear()
+{
+  std::fill(itsSeconds.begin(), itsSeconds.end(), -1);
+  std::fill(itsCounts.begin(), itsCounts.end(), 0);
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace SmartMet
+{
+// Counts events over the last few seconds. Each second of the window has its own slot of
+// counters, reused once the second has left the window. The callers hold their own locks.
+
+class SlidingWindowCounter
+{
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  SlidingWindowCounter(int theWindow, std::size_t theCounters);
+
+  void add(std::size_t theCounter, Clock::time_point theTime);
+
+  // Sum of the counter over the window ending at the given time
+  std::size_t total(std::size_t theCounter, Clock::time_point theTime) const;
+
+  void clear();
+
+ private:
+  const std::size_t itsCounters;
+  std::vector<long> itsSeconds;        // the second of each slot
+  std::vector<std::size_t> itsCounts;  // the counters of the slots one after another
+};
+
+}  // namespace SmartMet
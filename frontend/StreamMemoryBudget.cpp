@@ -0,0 +1,38 @@
+#include "StreamMemoryBudget.h"
+
+namespace SmartMet
+{
+StreamMemoryBudget::StreamMemoryBudget(const Settings& theSettings)
+    : itsSettings(theSettings), itsStartTime(Fmi::MicrosecClock::universal_time())
+{
+}
+
+bool StreamMemoryBudget::mustPause(std::size_t theQueuedSize)
+{
+  if (theQueuedSize > itsSettings.window)
+  {
+    ++itsWindowPauses;
+    return true;
+  }
+
+  if (theQueuedSize > itsSettings.throttleWindow && exceeded())
+  {
+    ++itsBudgetPauses;
+    return true;
+  }
+
+  return false;
+}
+
+Fmi::Cache::CacheStats StreamMemoryBudget::getStats() const
+{
+  Fmi::Cache::CacheStats stats;
+  stats.starttime = itsStartTime;
+  stats.maxsize = itsSettings.totalSize;
+  stats.size = itsUsed.load(std::memory_order_relaxed);
+  stats.hits = itsWindowPauses.load();
+  stats.misses = itsBudgetPauses.load();
+  return stats;
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <macgyver/CacheStats.h>
+#include <macgyver/DateTime.h>
+#include <atomic>
+#include <cstddef>
+
+namespace SmartMet
+{
+// Flow control between backend reads and client writes. Each stream stops reading from
+// the backend once its client has fallen a window behind. In addition the data queued
+// for all clients together is limited: when the total exceeds the budget, streams whose
+// clients are not keeping up stop reading first, while streams to fast clients, whose
+// queues stay short, continue.
+
+class StreamMemoryBudget
+{
+ public:
+  struct Settings
+  {
+    std::size_t window = 1048576;         // data queued per stream
+    std::size_t throttleWindow = 65536;   // data queued per stream when over the budget
+    std::size_t totalSize = 1073741824;   // data queued for all streams
+  };
+
+  explicit StreamMemoryBudget(const Settings& theSettings);
+
+  StreamMemoryBudget(const StreamMemoryBudget& other) = delete;
+  StreamMemoryBudget(StreamMemoryBudget&& other) = delete;
+  StreamMemoryBudget& operator=(const StreamMemoryBudget& other) = delete;
+  StreamMemoryBudget& operator=(StreamMemoryBudget&& other) = delete;
+
+  const Settings& getSettings() const { return itsSettings; }
+
+  // Data was queued for a client, or taken by it
+  void add(std::size_t theSize) { itsUsed.fetch_add(theSize, std::memory_order_relaxed); }
+  void release(std::size_t theSize) { itsUsed.fetch_sub(theSize, std::memory_order_relaxed); }
+
+  bool exceeded() const { return itsUsed.load(std::memory_order_relaxed) > itsSettings.totalSize; }
+
+  // True if a stream with the given amount of queued data must wait for its client
+  // before reading more from the backend
+  bool mustPause(std::size_t theQueuedSize);
+
+  // Size is the queued data, hits are pauses due to the window and misses those due to
+  // the budget
+  Fmi::Cache::CacheStats getStats() const;
+
+ private:
+  const Settings itsSettings;
+  std::atomic<std::size_t> itsUsed{0};
+
+  // Statistics
+  const Fmi::DateTime itsStartTime;
+  std::atomic<std::size_t> itsWindowPauses{0};
+  std::atomic<std::size_t> itsBudgetPauses{0};
+};
+
+}  // namespace SmartMet
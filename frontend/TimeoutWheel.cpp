@@ -0,0 +1,172 @@
+#include "TimeoutWheel.h"
+#include <macgyver/Exception.h>
+#include <algorithm>
+
+namespace SmartMet
+{
+void TimeoutWheel::Timeout::arm(std::chrono::seconds theTimeout)
+{
+  itsLastActivity.store(now(), std::memory_order_relaxed);
+  itsTimeout.store(theTimeout.count(), std::memory_order_relaxed);
+  if (theTimeout.count() > 0)
+  {
+    std::lock_guard<std::mutex> lock(itsWheel->itsMutex);
+    if (!itsWheel->itsShutdown)
+      itsWheel->schedule(shared_from_this(), Clock::now() + theTimeout);
+  }
+}
+
+TimeoutWheel::Clock::time_point TimeoutWheel::Timeout::deadline() const
+{
+  return Clock::time_point(Clock::duration(itsLastActivity.load(std::memory_order_relaxed))) +
+         timeout();
+}
+
+bool TimeoutWheel::Timeout::expired() const
+{
+  return armed() && deadline() <= Clock::now();
+}
+
+TimeoutWheel::TimeoutWheel(boost::asio::io_context& theIoContext,
+                           std::chrono::milliseconds theTickInterval,
+                           std::size_t theSlotCount)
+    : itsStartTime(Clock::now()),
+      itsTickInterval(theTickInterval),
+      itsSlots(std::max<std::size_t>(theSlotCount, 1)),
+      itsTimer(theIoContext)
+{
+  scheduleTick();
+}
+
+std::shared_ptr<TimeoutWheel::Timeout> TimeoutWheel::create(std::function<void()> theHandler)
+{
+  auto timeout = std::make_shared<Timeout>();
+  timeout->itsWheel = this;
+  timeout->itsHandler = std::move(theHandler);
+  return timeout;
+}
+
+std::size_t TimeoutWheel::size() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  return itsCount;
+}
+
+// Put the timeout into the slot of the deadline unless it is already in an earlier slot,
+// where it will be rescheduled anyway. Requires itsMutex to be held.
+void TimeoutWheel::schedule(const std::shared_ptr<Timeout>& theTimeout,
+                            Clock::time_point theDeadline)
+{
+  const auto elapsed =
+      std::chrono::duration_cast<std::chrono::milliseconds>(theDeadline - itsStartTime).count();
+  const auto interval = itsTickInterval.count();
+
+  auto tick = static_cast<std::uint64_t>((elapsed + interval - 1) / interval);
+  tick = std::max(tick, itsCurrentTick + 1);
+
+  if (theTimeout->itsScheduledTick != 0 && theTimeout->itsScheduledTick <= tick)
+    return;
+
+  if (theTimeout->itsScheduledTick == 0)
+    ++itsCount;
+
+  // A copy left in a later slot is recognized as stale by its tick
+  theTimeout->itsScheduledTick = tick;
+  itsSlots[tick % itsSlots.size()].push_back(theTimeout);
+}
+
+void TimeoutWheel::scheduleTick()
+{
+  itsTimer.expires_after(itsTickInterval);
+  itsTimer.async_wait(
+      [this](const boost::system::error_code& err)
+      {
+        if (err != boost::asio::error::operation_aborted)
+          tick();
+      });
+}
+
+void TimeoutWheel::tick()
+{
+  std::vector<std::function<void()>> handlers;
+
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+    if (itsShutdown)
+      return;
+
+    const auto now = Clock::now();
+    const auto target = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(now - itsStartTime).count() /
+        itsTickInterval.count());
+
+    while (itsCurrentTick < target)
+    {
+      ++itsCurrentTick;
+
+      std::vector<std::shared_ptr<Timeout>> entries;
+      auto& slot = itsSlots[itsCurrentTick % itsSlots.size()];
+      entries.swap(slot);
+
+      for (auto& timeout : entries)
+      {
+        if (timeout->itsScheduledTick != itsCurrentTick)
+        {
+          // Keep entries due on a later round, drop stale copies
+          if (timeout->itsScheduledTick > itsCurrentTick &&
+              timeout->itsScheduledTick % itsSlots.size() == itsCurrentTick % itsSlots.size())
+            slot.push_back(timeout);
+          continue;
+        }
+
+        timeout->itsScheduledTick = 0;
+        --itsCount;
+
+        if (!timeout->armed())
+          continue;
+
+        const auto deadline = timeout->deadline();
+        if (deadline <= now)
+          handlers.push_back(timeout->itsHandler);
+        else
+          schedule(timeout, deadline);
+      }
+    }
+  }
+
+  // The handlers may arm the timeouts again
+  for (const auto& handler : handlers)
+  {
+    try
+    {
+      handler();
+    }
+    catch (...)
+    {
+      Fmi::Exception ex(BCP, "Timeout handler failed", nullptr);
+      ex.printError();
+    }
+  }
+
+  scheduleTick();
+}
+
+void TimeoutWheel::shutdown()
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+    itsShutdown = true;
+    itsTimer.cancel();
+
+    for (auto& slot : itsSlots)
+      slot.clear();
+    itsCount = 0;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace SmartMet
+{
+// Inactivity timeouts of all backend streams, checked in coarse ticks by a single ASIO
+// timer. A stream records activity with a plain timestamp store. The wheel looks at a
+// stream only when its timeout could have expired, and then either fires the handler or
+// moves the entry to the slot of the new deadline. Deadlines beyond one revolution of the
+// wheel stay in their slot for the required number of rounds.
+
+class TimeoutWheel
+{
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  class Timeout : public std::enable_shared_from_this<Timeout>
+  {
+   public:
+    // (Re)start the timeout, counting from now
+    void arm(std::chrono::seconds theTimeout);
+
+    // Record activity, pushing the deadline forward. Cheap enough to call on every read.
+    void touch() { itsLastActivity.store(now(), std::memory_order_relaxed); }
+
+    // Stop the timeout until armed again
+    void disarm() { itsTimeout.store(0, std::memory_order_relaxed); }
+
+    bool armed() const { return itsTimeout.load(std::memory_order_relaxed) != 0; }
+    std::chrono::seconds timeout() const
+    {
+      return std::chrono::seconds(itsTimeout.load(std::memory_order_relaxed));
+    }
+
+    // True if armed and the timeout has passed since the last activity
+    bool expired() const;
+
+   private:
+    friend class TimeoutWheel;
+    static Clock::rep now() { return Clock::now().time_since_epoch().count(); }
+    Clock::time_point deadline() const;
+
+    TimeoutWheel* itsWheel = nullptr;
+    std::function<void()> itsHandler;
+    std::atomic<Clock::rep> itsLastActivity{0};
+    std::atomic<std::int64_t> itsTimeout{0};  // seconds, zero if disarmed
+
+    // Tick of the slot the entry is in, zero if none. Guarded by the wheel mutex.
+    std::uint64_t itsScheduledTick = 0;
+  };
+
+  TimeoutWheel(boost::asio::io_context& theIoContext,
+               std::chrono::milliseconds theTickInterval,
+               std::size_t theSlotCount);
+
+  TimeoutWheel(const TimeoutWheel& other) = delete;
+  TimeoutWheel(TimeoutWheel&& other) = delete;
+  TimeoutWheel& operator=(const TimeoutWheel& other) = delete;
+  TimeoutWheel& operator=(TimeoutWheel&& other) = delete;
+
+  // Create a disarmed timeout. The handler is called on the io_context threads, and must
+  // not own whatever owns the timeout.
+  std::shared_ptr<Timeout> create(std::function<void()> theHandler);
+
+  // Number of armed timeouts in the wheel
+  std::size_t size() const;
+
+  void shutdown();
+
+ private:
+  void schedule(const std::shared_ptr<Timeout>& theTimeout, Clock::time_point theDeadline);
+  void scheduleTick();
+  void tick();
+
+  const Clock::time_point itsStartTime;
+  const std::chrono::milliseconds itsTickInterval;
+
+  mutable std::mutex itsMutex;
+  std::vector<std::vector<std::shared_ptr<Timeout>>> itsSlots;
+  std::uint64_t itsCurrentTick = 0;
+  std::size_t itsCount = 0;
+  bool itsShutdown = false;
+
+  boost::asio::steady_timer itsTimer;
+};
+
+}  // namespace SmartMet
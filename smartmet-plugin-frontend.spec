@@ -42,6 +42,7 @@ Requires: smartmet-library-grid-files >= 26.7.14
 Requires: jsoncpp
 Requires: jemalloc
 %if 0%{rhel} >= 7
+Requires: %{smartmet_boost}-iostreams
 Requires: %{smartmet_boost}-thread
 %endif
 
@@ -0,0 +1,116 @@
+#include "../frontend/AdaptiveReadSize.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::AdaptiveReadSize;
+using SmartMet::ReceiveBufferBudget;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Adaptive read size tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+AdaptiveReadSize::Settings settings()
+{
+  AdaptiveReadSize::Settings s;
+  s.minSize = 1000;
+  s.maxSize = 8000;
+  s.totalSize = 10000;
+  return s;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(AdaptiveReadSizeTests)
+
+BOOST_AUTO_TEST_CASE(full_reads_grow_up_to_the_limit)
+{
+  AdaptiveReadSize size(settings());
+  BOOST_CHECK_EQUAL(size.next(0), 1000);
+
+  size.update(1000, 1000);
+  BOOST_CHECK_EQUAL(size.next(0), 2000);
+  size.update(2000, 2000);
+  size.update(4000, 4000);
+  BOOST_CHECK_EQUAL(size.next(0), 8000);
+  size.update(8000, 8000);
+  BOOST_CHECK_EQUAL(size.next(0), 8000);
+}
+
+BOOST_AUTO_TEST_CASE(short_reads_do_not_grow)
+{
+  AdaptiveReadSize size(settings());
+  size.update(1000, 999);
+  BOOST_CHECK_EQUAL(size.next(0), 1000);
+
+  // A full read smaller than the current size, for example near the end of the content
+  size.update(1000, 1000);
+  size.update(500, 500);
+  BOOST_CHECK_EQUAL(size.next(0), 2000);
+}
+
+BOOST_AUTO_TEST_CASE(slow_reads_shrink_down_to_the_minimum)
+{
+  AdaptiveReadSize size(settings());
+  size.update(1000, 1000);
+  size.update(2000, 2000);
+  size.update(4000, 4000);
+  BOOST_CHECK_EQUAL(size.next(0), 8000);
+
+  // Less than a quarter of the buffer
+  size.update(8000, 1999);
+  BOOST_CHECK_EQUAL(size.next(0), 4000);
+
+  // At least a quarter keeps the size
+  size.update(4000, 1000);
+  BOOST_CHECK_EQUAL(size.next(0), 4000);
+
+  size.update(4000, 10);
+  size.update(2000, 10);
+  size.update(1000, 10);
+  BOOST_CHECK_EQUAL(size.next(0), 1000);
+}
+
+BOOST_AUTO_TEST_CASE(remaining_content_limits_the_read)
+{
+  AdaptiveReadSize size(settings());
+  size.update(1000, 1000);
+  BOOST_CHECK_EQUAL(size.next(500), 500);
+  BOOST_CHECK_EQUAL(size.next(5000), 2000);
+  BOOST_CHECK_EQUAL(size.next(0), 2000);
+}
+
+BOOST_AUTO_TEST_CASE(budget_exhaustion_falls_back_to_the_minimum)
+{
+  ReceiveBufferBudget budget(settings());
+
+  BOOST_CHECK_EQUAL(budget.reserve(8000), 8000);
+  BOOST_CHECK_EQUAL(budget.used(), 8000);
+
+  // Would exceed the total
+  BOOST_CHECK_EQUAL(budget.reserve(4000), 1000);
+  BOOST_CHECK_EQUAL(budget.used(), 9000);
+
+  // The minimum is granted even over the budget
+  BOOST_CHECK_EQUAL(budget.reserve(1000), 1000);
+  BOOST_CHECK_EQUAL(budget.reserve(2000), 1000);
+  BOOST_CHECK_EQUAL(budget.used(), 11000);
+
+  budget.release(8000);
+  budget.release(1000);
+  budget.release(1000);
+  budget.release(1000);
+  BOOST_CHECK_EQUAL(budget.used(), 0);
+  BOOST_CHECK_EQUAL(budget.reserve(4000), 4000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
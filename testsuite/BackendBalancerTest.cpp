@@ -0,0 +1,104 @@
+#include "../frontend/BackendBalancer.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::BackendBalancer;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Backend balancer tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+BackendBalancer::Settings settings()
+{
+  BackendBalancer::Settings settings;
+  settings.enabled = true;
+  return settings;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(BackendBalancerTests)
+
+BOOST_AUTO_TEST_CASE(prefers_fewer_requests_in_flight)
+{
+  BackendBalancer balancer(settings());
+  balancer.start("a", 8080);
+  balancer.start("a", 8080);
+  balancer.start("b", 8080);
+
+  BOOST_CHECK(balancer.preferSecond("a", 8080, "b", 8080));
+  BOOST_CHECK(!balancer.preferSecond("b", 8080, "a", 8080));
+
+  // Equal costs keep the first candidate
+  balancer.finish("a", 8080);
+  BOOST_CHECK(!balancer.preferSecond("a", 8080, "b", 8080));
+  BOOST_CHECK(!balancer.preferSecond("b", 8080, "a", 8080));
+
+  // Different ports are different backends
+  BOOST_CHECK(balancer.preferSecond("a", 8080, "a", 8081));
+  BOOST_CHECK(!balancer.preferSecond("a", 8080, "a", 8080));
+}
+
+BOOST_AUTO_TEST_CASE(weights_by_time_to_first_byte)
+{
+  BackendBalancer balancer(settings());
+  balancer.recordFirstByte("slow", 80, std::chrono::milliseconds(300));
+  balancer.recordFirstByte("fast", 80, std::chrono::milliseconds(100));
+
+  BOOST_CHECK(balancer.preferSecond("slow", 80, "fast", 80));
+
+  // A request in flight on the fast backend still costs less than none on the slow one
+  balancer.start("fast", 80);
+  BOOST_CHECK(balancer.preferSecond("slow", 80, "fast", 80));
+
+  balancer.start("fast", 80);
+  BOOST_CHECK(!balancer.preferSecond("slow", 80, "fast", 80));
+
+  // Unmeasured backends are assumed to be average
+  BOOST_CHECK(balancer.preferSecond("slow", 80, "new", 80));
+  BOOST_CHECK(!balancer.preferSecond("new", 80, "slow", 80));
+}
+
+BOOST_AUTO_TEST_CASE(moving_average)
+{
+  BackendBalancer balancer(settings());
+  balancer.recordFirstByte("a", 80, std::chrono::milliseconds(100));
+  balancer.recordFirstByte("b", 80, std::chrono::milliseconds(150));
+  BOOST_CHECK(balancer.preferSecond("b", 80, "a", 80));
+
+  // One slow response moves the average by the smoothing factor only: 100 + 0.2 * 200
+  balancer.recordFirstByte("a", 80, std::chrono::milliseconds(300));
+  BOOST_CHECK(balancer.preferSecond("b", 80, "a", 80));
+
+  for (int i = 0; i < 10; i++)
+    balancer.recordFirstByte("a", 80, std::chrono::milliseconds(300));
+  BOOST_CHECK(!balancer.preferSecond("b", 80, "a", 80));
+}
+
+BOOST_AUTO_TEST_CASE(retired_backends)
+{
+  BackendBalancer balancer(settings());
+  balancer.start("a", 80);
+  balancer.start("b", 80);
+  balancer.start("b", 80);
+  balancer.remove("b", 80);
+
+  // Requests still running on a retired backend do not count again when it returns
+  balancer.finish("b", 80);
+  BOOST_CHECK(balancer.preferSecond("a", 80, "b", 80));
+  BOOST_CHECK_EQUAL(balancer.getStats().size, 1);
+  BOOST_CHECK_EQUAL(balancer.getStats().hits, 0);
+  BOOST_CHECK_EQUAL(balancer.getStats().misses, 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,109 @@
+#include "../frontend/CacheAdmission.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::CacheAdmission;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Cache admission tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+CacheAdmission::Settings tinylfu()
+{
+  CacheAdmission::Settings s;
+  s.policy = CacheAdmission::Policy::TINY_LFU;
+  s.minFrequency = 2;
+  s.sizeUnit = 65536;
+  return s;
+}
+
+// Needs two more requests than a small response
+const std::size_t large = 4 * 65536;
+
+// The smallest sketch is aged after this many requests
+const std::size_t sample_size = 10 * 1024;
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(CacheAdmissionTests)
+
+BOOST_AUTO_TEST_CASE(parse_policy)
+{
+  BOOST_CHECK(CacheAdmission::parsePolicy("lru") == CacheAdmission::Policy::ADMIT_ALL);
+  BOOST_CHECK(CacheAdmission::parsePolicy("tinylfu") == CacheAdmission::Policy::TINY_LFU);
+  BOOST_CHECK_THROW(CacheAdmission::parsePolicy("lfu"), std::exception);
+}
+
+BOOST_AUTO_TEST_CASE(lru_admits_everything)
+{
+  CacheAdmission admission(CacheAdmission::Settings(), 1000);
+  BOOST_CHECK(admission.admit("a", large, true));
+  BOOST_CHECK(admission.admit("b", 1, true));
+  BOOST_CHECK_EQUAL(admission.getStats().inserts, 2);
+  BOOST_CHECK_EQUAL(admission.getStats().size, 0);
+}
+
+BOOST_AUTO_TEST_CASE(cache_with_room_admits_everything)
+{
+  CacheAdmission admission(tinylfu(), 1000);
+  BOOST_CHECK(admission.admit("a", large, false));
+  BOOST_CHECK(admission.admit("b", 1, false));
+}
+
+BOOST_AUTO_TEST_CASE(full_cache_rejects_one_off_requests)
+{
+  CacheAdmission admission(tinylfu(), 1000);
+
+  BOOST_CHECK(!admission.admit("a", 1000, true));
+  BOOST_CHECK(admission.admit("a", 1000, true));
+
+  // Requests which were not cached count too
+  admission.record("b");
+  BOOST_CHECK(admission.admit("b", 1000, true));
+
+  const auto stats = admission.getStats();
+  BOOST_CHECK_EQUAL(stats.inserts, 2);
+  BOOST_CHECK_EQUAL(stats.misses, 1);
+  BOOST_CHECK_EQUAL(stats.size, 4 * 1024);
+}
+
+BOOST_AUTO_TEST_CASE(large_responses_need_more_requests)
+{
+  CacheAdmission admission(tinylfu(), 1000);
+
+  BOOST_CHECK(!admission.admit("a", large, true));
+  BOOST_CHECK(!admission.admit("a", large, true));
+  BOOST_CHECK(!admission.admit("a", large, true));
+  BOOST_CHECK(admission.admit("a", large, true));
+}
+
+BOOST_AUTO_TEST_CASE(old_popularity_fades)
+{
+  CacheAdmission fresh(tinylfu(), 1000);
+  CacheAdmission aged(tinylfu(), 1000);
+
+  for (int i = 0; i < 3; i++)
+  {
+    fresh.record("a");
+    aged.record("a");
+  }
+
+  // Other traffic until the counters are halved
+  for (std::size_t i = 3; i < sample_size; i++)
+    aged.record("b");
+
+  BOOST_CHECK(fresh.admit("a", large, true));
+  BOOST_CHECK(!aged.admit("a", large, true));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,124 @@
+#include "../frontend/CacheIndexLog.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <map>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::CacheIndexLog;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Cache index log tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+// A small log in an empty directory, rotated after some tens of records
+CacheIndexLog::Settings settings(const std::string& theName)
+{
+  const auto directory = std::filesystem::temp_directory_path() / "CacheIndexLogTest" / theName;
+  std::filesystem::remove_all(directory);
+
+  CacheIndexLog::Settings s;
+  s.enabled = true;
+  s.directory = directory;
+  s.maxSize = 1000;
+  return s;
+}
+
+// The latest value of each key, 'D' records delete the key
+using State = std::map<std::string, std::string>;
+
+void apply(State& theState, char theType, const CacheIndexLog::Record& theFields)
+{
+  if (theType == 'D')
+    theState.erase(theFields.at(0));
+  else
+    theState[theFields.at(0)] = theFields.at(1);
+}
+
+State replay(const CacheIndexLog::Settings& theSettings)
+{
+  State state;
+  CacheIndexLog log(theSettings);
+  log.replay([&state](char theType, const CacheIndexLog::Record& theFields)
+             { apply(state, theType, theFields); });
+  return state;
+}
+
+// Writes the state as is
+void compact(const CacheIndexLog::Replayer& theReplay,
+             const CacheIndexLog::RecordHandler& theWriter)
+{
+  State state;
+  theReplay([&state](char theType, const CacheIndexLog::Record& theFields)
+            { apply(state, theType, theFields); });
+  for (const auto& item : state)
+    theWriter('V', {item.first, item.second});
+}
+
+void write_traffic(CacheIndexLog& theLog, int theCount)
+{
+  for (int i = 0; i < theCount; i++)
+    theLog.append('V', {"key" + std::to_string(i % 5), std::to_string(i)});
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(CacheIndexLogTests)
+
+BOOST_AUTO_TEST_CASE(records_are_replayed_in_order)
+{
+  const auto s = settings("replay");
+  {
+    CacheIndexLog log(s);
+    log.append('V', {"a", "1"});
+    log.append('V', {"b", "2"});
+    log.append('V', {"a", "3"});
+    log.append('D', {"b"});
+  }
+  BOOST_CHECK(replay(s) == State({{"a", "3"}}));
+}
+
+BOOST_AUTO_TEST_CASE(rotation_without_compaction_forgets_old_entries)
+{
+  const auto s = settings("plain");
+  {
+    CacheIndexLog log(s);
+    log.append('V', {"old", "1"});
+    write_traffic(log, 1000);
+  }
+  BOOST_CHECK(replay(s).count("old") == 0);
+}
+
+BOOST_AUTO_TEST_CASE(compaction_keeps_live_entries)
+{
+  const auto s = settings("compacted");
+  {
+    CacheIndexLog log(s);
+    log.setCompactor(compact);
+    log.append('V', {"old", "1"});
+    log.append('V', {"deleted", "1"});
+    log.append('D', {"deleted"});
+    write_traffic(log, 1000);
+  }
+
+  const auto state = replay(s);
+  BOOST_CHECK_EQUAL(state.size(), 6);
+  BOOST_CHECK_EQUAL(state.at("old"), "1");
+  BOOST_CHECK_EQUAL(state.at("key4"), "999");
+  BOOST_CHECK_EQUAL(state.count("deleted"), 0);
+
+  // The snapshot replaces the earlier generations
+  BOOST_CHECK(!std::filesystem::exists(s.directory / "index.log.1"));
+  BOOST_CHECK(std::filesystem::file_size(s.directory / "index.log") < 2 * s.maxSize);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,162 @@
+#include "../frontend/CachePurgeIndex.h"
+#include "../frontend/ResponseCache.h"
+#include <boost/test/included/unit_test.hpp>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+using namespace boost::unit_test;
+using SmartMet::CachePurgeIndex;
+using SmartMet::ResponseCache;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Cache purge index tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+using Strings = std::vector<std::string>;
+
+// A cache with a persistent index in an empty directory
+ResponseCache::Settings settings(const std::string& theName)
+{
+  const auto directory = std::filesystem::temp_directory_path() / "CachePurgeIndexTest" / theName;
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory);
+
+  ResponseCache::Settings s;
+  s.memorySize = 1048576;
+  s.index.enabled = true;
+  s.index.directory = directory;
+  return s;
+}
+
+void insert(ResponseCache& theCache,
+            const std::string& theETag,
+            const std::string& theTags,
+            std::uint64_t theHash)
+{
+  ResponseCache::CachedResponseMetaData metadata;
+  metadata.mime_type = "text/plain";
+  metadata.etag = theETag;
+  metadata.tags = theTags;
+  theCache.insertCachedBuffer(
+      metadata, std::make_shared<std::string>("response " + theETag), theHash);
+}
+
+// The index is loaded in the background
+bool wait_for_response(ResponseCache& theCache, const std::string& theETag)
+{
+  for (int i = 0; i < 500; i++)
+  {
+    if (theCache.hasCachedBuffer(theETag, ""))
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return false;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(CachePurgeIndexTests)
+
+BOOST_AUTO_TEST_CASE(split_tags)
+{
+  BOOST_CHECK(CachePurgeIndex::splitTags("a b,c ,\td") == Strings({"a", "b", "c", "d"}));
+  BOOST_CHECK(CachePurgeIndex::splitTags(" , ").empty());
+}
+
+BOOST_AUTO_TEST_CASE(remove_requests_by_prefix)
+{
+  CachePurgeIndex index(100);
+  index.addRequest("/wms?layers=a");
+  index.addRequest("/wms?layers=b");
+  index.addRequest("/wfs?x=1");
+  index.addRequest("/w");
+  BOOST_CHECK_EQUAL(index.size(), 4);
+
+  BOOST_CHECK(index.removeRequests("/wms") == Strings({"/wms?layers=a", "/wms?layers=b"}));
+  BOOST_CHECK(index.removeRequests("/wms").empty());
+  BOOST_CHECK_EQUAL(index.size(), 2);
+
+  BOOST_CHECK(index.removeRequests("/w") == Strings({"/w", "/wfs?x=1"}));
+  BOOST_CHECK_EQUAL(index.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(remove_tag)
+{
+  CachePurgeIndex index(100);
+  index.addTags("etag1", "radar obs");
+  index.addTags("etag2", "obs");
+  BOOST_CHECK_EQUAL(index.size(), 3);
+
+  BOOST_CHECK(index.removeTag("obs") == Strings({"etag1", "etag2"}));
+  BOOST_CHECK(index.removeTag("obs").empty());
+  BOOST_CHECK(index.removeTag("radar") == Strings({"etag1"}));
+  BOOST_CHECK_EQUAL(index.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(old_generation_ages_out)
+{
+  CachePurgeIndex index(2);
+  index.addRequest("/a");
+  index.addRequest("/b");  // the first generation is full
+  index.addRequest("/c");
+  BOOST_CHECK_EQUAL(index.size(), 3);
+
+  // Entries still in use are added again and survive
+  index.addRequest("/a");  // the second generation replaces the first one
+  BOOST_CHECK_EQUAL(index.size(), 2);
+  BOOST_CHECK(index.removeRequests("/") == Strings({"/a", "/c"}));
+}
+
+BOOST_AUTO_TEST_CASE(purge_cache_by_etag_prefix_and_tag)
+{
+  ResponseCache cache(settings("purge"));
+  insert(cache, "a", "radar obs", 1);
+  insert(cache, "b", "obs", 2);
+  insert(cache, "c", "", 3);
+  cache.rememberETag("/wms?layers=a", "a");
+  cache.rememberETag("/timeseries?place=x", "c");
+
+  BOOST_CHECK_EQUAL(cache.purgeETag("x"), 0);
+
+  BOOST_CHECK_EQUAL(cache.purgePrefix("/wms"), 1);
+  BOOST_CHECK(!cache.hasCachedBuffer("a", ""));
+  BOOST_CHECK(cache.getKnownETags("/wms?layers=a").empty());
+
+  // The already purged response is not counted again
+  BOOST_CHECK_EQUAL(cache.purgeTag("obs"), 1);
+  BOOST_CHECK(!cache.hasCachedBuffer("b", ""));
+
+  BOOST_CHECK_EQUAL(cache.purgeETag("c"), 1);
+  BOOST_CHECK(!cache.hasCachedBuffer("c", ""));
+  BOOST_CHECK(!cache.getCachedContent("c", ""));
+}
+
+BOOST_AUTO_TEST_CASE(purged_responses_stay_purged_after_restart)
+{
+  const auto s = settings("restart");
+  {
+    ResponseCache cache(s);
+    insert(cache, "a", "", 1);
+    insert(cache, "b", "", 2);
+    BOOST_CHECK_EQUAL(cache.purgeETag("a"), 1);
+  }
+
+  // The 'P' record written for "a" overrides its earlier metadata record
+  ResponseCache cache(s);
+  BOOST_REQUIRE(wait_for_response(cache, "b"));
+  BOOST_CHECK(!cache.hasCachedBuffer("a", ""));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
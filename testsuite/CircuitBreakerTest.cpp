@@ -0,0 +1,163 @@
+#include "../frontend/CircuitBreaker.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::CircuitBreaker;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Circuit breaker tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+using State = CircuitBreaker::State;
+
+CircuitBreaker::Settings settings()
+{
+  CircuitBreaker::Settings settings;
+  settings.enabled = true;
+  settings.window = 10;
+  settings.minRequests = 4;
+  settings.failureRate = 50;
+  settings.openTime = 5;
+  settings.probes = 2;
+  return settings;
+}
+
+const auto t0 = CircuitBreaker::Clock::time_point() + std::chrono::hours(1);
+const auto fast = std::chrono::milliseconds(10);
+
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(CircuitBreakerTests)
+
+BOOST_AUTO_TEST_CASE(single_failure_keeps_circuit_closed)
+{
+  CircuitBreaker breaker(settings());
+  BOOST_CHECK(!breaker.recordFailure("a", 80, t0));
+  BOOST_CHECK(breaker.getState("a", 80, t0) == State::CLOSED);
+  BOOST_CHECK(breaker.allow("a", 80, t0));
+
+  // Unknown backends are allowed
+  BOOST_CHECK(breaker.allow("b", 80, t0));
+}
+
+BOOST_AUTO_TEST_CASE(error_rate_opens_circuit)
+{
+  CircuitBreaker breaker(settings());
+  breaker.recordSuccess("a", 80, fast, t0);
+  breaker.recordSuccess("a", 80, fast, t0);
+  BOOST_CHECK(!breaker.recordFailure("a", 80, t0));
+  BOOST_CHECK(breaker.recordFailure("a", 80, t0));
+
+  BOOST_CHECK(breaker.getState("a", 80, t0) == State::OPEN);
+  BOOST_CHECK(!breaker.allow("a", 80, t0 + std::chrono::seconds(4)));
+  BOOST_CHECK_EQUAL(breaker.getStats().size, 1);
+  BOOST_CHECK_EQUAL(breaker.getStats().inserts, 1);
+}
+
+BOOST_AUTO_TEST_CASE(old_failures_leave_window)
+{
+  CircuitBreaker breaker(settings());
+  breaker.recordFailure("a", 80, t0);
+  breaker.recordFailure("a", 80, t0);
+  breaker.recordFailure("a", 80, t0);
+
+  const auto later = t0 + std::chrono::seconds(11);
+  breaker.recordSuccess("a", 80, fast, later);
+  breaker.recordSuccess("a", 80, fast, later);
+  breaker.recordSuccess("a", 80, fast, later);
+  BOOST_CHECK(!breaker.recordFailure("a", 80, later));
+  BOOST_CHECK(breaker.getState("a", 80, later) == State::CLOSED);
+}
+
+BOOST_AUTO_TEST_CASE(half_open_probes_close_circuit)
+{
+  CircuitBreaker breaker(settings());
+  for (int i = 0; i < 4; i++)
+    breaker.recordFailure("a", 80, t0);
+  BOOST_CHECK(breaker.getState("a", 80, t0) == State::OPEN);
+
+  // Only the probes are let through
+  const auto t1 = t0 + std::chrono::seconds(5);
+  BOOST_CHECK(breaker.allow("a", 80, t1));
+  breaker.start("a", 80, t1);
+  BOOST_CHECK(breaker.allow("a", 80, t1));
+  breaker.start("a", 80, t1);
+  BOOST_CHECK(!breaker.allow("a", 80, t1));
+  BOOST_CHECK(breaker.getState("a", 80, t1) == State::HALF_OPEN);
+
+  BOOST_CHECK(!breaker.recordSuccess("a", 80, fast, t1));
+  BOOST_CHECK(breaker.recordSuccess("a", 80, fast, t1));
+  BOOST_CHECK(breaker.getState("a", 80, t1) == State::CLOSED);
+  BOOST_CHECK(breaker.allow("a", 80, t1));
+
+  // The failures before opening are forgotten
+  BOOST_CHECK(!breaker.recordFailure("a", 80, t1));
+  BOOST_CHECK_EQUAL(breaker.getStats().hits, 1);
+}
+
+BOOST_AUTO_TEST_CASE(failed_probe_reopens_circuit)
+{
+  CircuitBreaker breaker(settings());
+  for (int i = 0; i < 4; i++)
+    breaker.recordFailure("a", 80, t0);
+
+  const auto t1 = t0 + std::chrono::seconds(5);
+  breaker.start("a", 80, t1);
+  BOOST_CHECK(breaker.recordFailure("a", 80, t1));
+  BOOST_CHECK(breaker.getState("a", 80, t1) == State::OPEN);
+  BOOST_CHECK(!breaker.allow("a", 80, t1 + std::chrono::seconds(4)));
+  BOOST_CHECK(breaker.allow("a", 80, t1 + std::chrono::seconds(5)));
+}
+
+BOOST_AUTO_TEST_CASE(released_probe_may_be_sent_again)
+{
+  CircuitBreaker breaker(settings());
+  for (int i = 0; i < 4; i++)
+    breaker.recordFailure("a", 80, t0);
+
+  const auto t1 = t0 + std::chrono::seconds(5);
+  breaker.start("a", 80, t1);
+  breaker.start("a", 80, t1);
+  BOOST_CHECK(!breaker.allow("a", 80, t1));
+
+  // An abandoned probe neither closes nor opens the circuit
+  breaker.release("a", 80, t1);
+  BOOST_CHECK(breaker.allow("a", 80, t1));
+  BOOST_CHECK(breaker.getState("a", 80, t1) == State::HALF_OPEN);
+
+  // Probes which already succeeded are not given back
+  BOOST_CHECK(!breaker.recordSuccess("a", 80, fast, t1));
+  breaker.release("a", 80, t1);
+  breaker.release("a", 80, t1);
+  breaker.start("a", 80, t1);
+  BOOST_CHECK(!breaker.allow("a", 80, t1));
+}
+
+BOOST_AUTO_TEST_CASE(slow_responses_open_circuit)
+{
+  auto s = settings();
+  s.slowTime = 1000;
+  s.slowRate = 75;
+  CircuitBreaker breaker(s);
+
+  const auto slow = std::chrono::seconds(2);
+  breaker.recordSuccess("a", 80, fast, t0);
+  breaker.recordSuccess("a", 80, slow, t0);
+  breaker.recordSuccess("a", 80, slow, t0);
+  BOOST_CHECK(breaker.getState("a", 80, t0) == State::CLOSED);
+  breaker.recordSuccess("a", 80, slow, t0);
+  BOOST_CHECK(breaker.getState("a", 80, t0) == State::OPEN);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
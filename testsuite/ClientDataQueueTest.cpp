@@ -0,0 +1,78 @@
+#include "../frontend/ClientDataQueue.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+#include <thread>
+
+using namespace boost::unit_test;
+using SmartMet::ClientDataQueue;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Client data queue tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+BOOST_AUTO_TEST_SUITE(ClientDataQueueTests)
+
+BOOST_AUTO_TEST_CASE(empty_queue)
+{
+  ClientDataQueue queue;
+  BOOST_CHECK(queue.empty());
+  BOOST_CHECK_EQUAL(queue.popAll(), "");
+  BOOST_CHECK_EQUAL(queue.peek(0, 10), "");
+
+  queue.push(std::string());
+  BOOST_CHECK(queue.empty());
+}
+
+BOOST_AUTO_TEST_CASE(push_and_pop)
+{
+  ClientDataQueue queue;
+  queue.push("HTTP/1.1 200 OK\r\n");
+  queue.push("\r\n");
+  queue.push("body");
+  BOOST_CHECK_EQUAL(queue.size(), 23U);
+
+  BOOST_CHECK_EQUAL(queue.peek(9, 3), "200");
+  BOOST_CHECK_EQUAL(queue.peek(15, 6), "\r\n\r\nbo");
+  BOOST_CHECK_EQUAL(queue.size(), 23U);
+
+  BOOST_CHECK_EQUAL(queue.popAll(), "HTTP/1.1 200 OK\r\n\r\nbody");
+  BOOST_CHECK(queue.empty());
+
+  queue.push("more");
+  BOOST_CHECK_EQUAL(queue.popAll(), "more");
+  BOOST_CHECK(queue.empty());
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_producer)
+{
+  ClientDataQueue queue;
+  const int count = 100000;
+
+  std::thread producer(
+      [&queue]
+      {
+        for (int i = 0; i < count; ++i)
+          queue.push(std::to_string(i % 10));
+      });
+
+  std::string received;
+  while (received.size() < static_cast<std::size_t>(count))
+    received += queue.popAll();
+  producer.join();
+
+  BOOST_CHECK(queue.empty());
+  bool ordered = true;
+  for (int i = 0; i < count; ++i)
+    ordered = ordered && (received[i] == '0' + (i % 10));
+  BOOST_CHECK(ordered);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,69 @@
+#include "../frontend/ClientHandle.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::make_client_handle;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Client handle tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+// Records the order of the calls into a shared log
+struct Leader
+{
+  explicit Leader(std::string& theLog) : itsLog(theLog) {}
+  ~Leader() { itsLog += "destroyed;"; }
+
+  void detachClient() { itsLog += "detached;"; }
+
+  std::string& itsLog;
+};
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(ClientHandleTests)
+
+BOOST_AUTO_TEST_CASE(detach_before_release)
+{
+  std::string log;
+  {
+    auto handle = make_client_handle(std::make_shared<Leader>(log), &Leader::detachClient);
+    auto copy = handle;
+    handle.reset();
+    BOOST_CHECK(log.empty());
+  }
+  BOOST_CHECK_EQUAL(log, "detached;destroyed;");
+}
+
+BOOST_AUTO_TEST_CASE(object_outlives_its_client)
+{
+  std::string log;
+  auto leader = std::make_shared<Leader>(log);
+  std::weak_ptr<Leader> weak = leader;
+
+  auto handle = make_client_handle(leader, &Leader::detachClient);
+  BOOST_CHECK(handle.get() == leader.get());
+  leader.reset();
+  BOOST_CHECK(!weak.expired());
+
+  // The client disconnects while the object still has work to do for others
+  leader = weak.lock();
+  handle.reset();
+  BOOST_CHECK_EQUAL(log, "detached;");
+  BOOST_CHECK(!weak.expired());
+
+  leader.reset();
+  BOOST_CHECK_EQUAL(log, "detached;destroyed;");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,51 @@
+#include "../frontend/ContentHash.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::ContentHash;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Content hash tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+BOOST_AUTO_TEST_SUITE(ContentHashTests)
+
+BOOST_AUTO_TEST_CASE(reference_values)
+{
+  // XXH64 with seed zero
+  BOOST_CHECK_EQUAL(ContentHash::of(""), 0xef46db3751d8e999UL);
+  BOOST_CHECK_EQUAL(ContentHash::of("a"), 0xd24ec4f1a98c6e5bUL);
+  BOOST_CHECK_EQUAL(ContentHash::of("abc"), 0x44bc2cf5ad770999UL);
+}
+
+BOOST_AUTO_TEST_CASE(incremental_updates)
+{
+  std::string data;
+  for (int i = 0; i < 1000; i++)
+    data += static_cast<char>(i * 7 + i / 13);
+
+  const auto expected = ContentHash::of(data);
+
+  // Chunk boundaries must not matter, whether inside or across stripes
+  for (std::size_t chunk : {1U, 3U, 31U, 32U, 33U, 100U, 999U})
+  {
+    ContentHash hash;
+    for (std::size_t pos = 0; pos < data.size(); pos += chunk)
+      hash.update(data.substr(pos, chunk));
+    BOOST_CHECK_EQUAL(hash.digest(), expected);
+    BOOST_CHECK_EQUAL(hash.size(), data.size());
+  }
+
+  BOOST_CHECK(ContentHash::of(data.substr(1)) != expected);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
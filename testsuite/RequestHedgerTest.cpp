@@ -0,0 +1,114 @@
+#include "../frontend/RequestHedger.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::RequestHedger;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Request hedger tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+RequestHedger::Settings settings()
+{
+  RequestHedger::Settings s;
+  s.enabled = true;
+  s.percentile = 90;
+  s.samples = 100;
+  s.minSamples = 10;
+  s.minDelay = 5;
+  s.maxPercent = 10;
+  return s;
+}
+
+std::chrono::milliseconds ms(int theValue)
+{
+  return std::chrono::milliseconds(theValue);
+}
+
+bool delay_is(const std::optional<RequestHedger::Clock::duration>& theDelay, int theMilliseconds)
+{
+  return theDelay &&
+         std::chrono::duration_cast<std::chrono::milliseconds>(*theDelay) == ms(theMilliseconds);
+}
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(RequestHedgerTests)
+
+BOOST_AUTO_TEST_CASE(no_hedging_before_enough_samples)
+{
+  RequestHedger hedger(settings());
+  BOOST_CHECK(!hedger.delay("/wms"));
+
+  for (int i = 0; i < 9; i++)
+    hedger.recordFirstByte("/wms", ms(100));
+  BOOST_CHECK(!hedger.delay("/wms"));
+
+  hedger.recordFirstByte("/wms", ms(100));
+  BOOST_CHECK(delay_is(hedger.delay("/wms"), 100));
+
+  // Services are followed separately
+  BOOST_CHECK(!hedger.delay("/timeseries"));
+  BOOST_CHECK_EQUAL(hedger.getStats().size, 1);
+}
+
+BOOST_AUTO_TEST_CASE(delay_is_the_percentile)
+{
+  RequestHedger hedger(settings());
+  for (int i = 1; i <= 100; i++)
+    hedger.recordFirstByte("/wms", ms(i));
+  BOOST_CHECK(delay_is(hedger.delay("/wms"), 90));
+
+  // Only the most recent samples count
+  for (int i = 1; i <= 100; i++)
+    hedger.recordFirstByte("/wms", ms(1000 + i));
+  BOOST_CHECK(delay_is(hedger.delay("/wms"), 1090));
+}
+
+BOOST_AUTO_TEST_CASE(delay_has_a_minimum)
+{
+  RequestHedger hedger(settings());
+  for (int i = 0; i < 10; i++)
+    hedger.recordFirstByte("/wms", ms(1));
+  BOOST_CHECK(delay_is(hedger.delay("/wms"), 5));
+}
+
+BOOST_AUTO_TEST_CASE(hedges_are_limited_to_a_percentage)
+{
+  RequestHedger hedger(settings());
+  BOOST_CHECK(!hedger.tryHedge());
+
+  // Each request asks for the delay
+  for (int i = 0; i < 100; i++)
+    hedger.delay("/wms");
+
+  std::size_t hedges = 0;
+  while (hedger.tryHedge())
+    ++hedges;
+  BOOST_CHECK_EQUAL(hedges, 10);
+
+  for (int i = 0; i < 10; i++)
+    hedger.delay("/wms");
+  BOOST_CHECK(hedger.tryHedge());
+  BOOST_CHECK(!hedger.tryHedge());
+
+  hedger.recordResult(true);
+  hedger.recordResult(false);
+  hedger.recordResult(false);
+  const auto stats = hedger.getStats();
+  BOOST_CHECK_EQUAL(stats.inserts, 11);
+  BOOST_CHECK_EQUAL(stats.hits, 1);
+  BOOST_CHECK_EQUAL(stats.misses, 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,91 @@
+#include "../frontend/ResponseBodyFraming.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::ResponseBodyFraming;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Response body framing tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+bool feed(ResponseBodyFraming& framing, const std::string& data)
+{
+  return framing.consume(data.data(), data.size());
+}
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(ResponseBodyFramingTests)
+
+BOOST_AUTO_TEST_CASE(no_body)
+{
+  ResponseBodyFraming framing(ResponseBodyFraming::Mode::NO_BODY, 0);
+  BOOST_CHECK(framing.complete());
+  BOOST_CHECK(framing.delimited());
+  BOOST_CHECK(!framing.overrun());
+}
+
+BOOST_AUTO_TEST_CASE(content_length)
+{
+  ResponseBodyFraming framing(ResponseBodyFraming::Mode::CONTENT_LENGTH, 10);
+  BOOST_CHECK(!framing.complete());
+  BOOST_CHECK(!feed(framing, "12345"));
+  BOOST_CHECK(!feed(framing, "6789"));
+  BOOST_CHECK(feed(framing, "0"));
+  BOOST_CHECK(!framing.overrun());
+
+  ResponseBodyFraming empty(ResponseBodyFraming::Mode::CONTENT_LENGTH, 0);
+  BOOST_CHECK(empty.complete());
+}
+
+BOOST_AUTO_TEST_CASE(content_length_overrun)
+{
+  ResponseBodyFraming framing(ResponseBodyFraming::Mode::CONTENT_LENGTH, 3);
+  BOOST_CHECK(feed(framing, "12345"));
+  BOOST_CHECK(framing.overrun());
+}
+
+BOOST_AUTO_TEST_CASE(until_close)
+{
+  ResponseBodyFraming framing;
+  BOOST_CHECK(!framing.delimited());
+  BOOST_CHECK(!feed(framing, "anything"));
+  BOOST_CHECK(!framing.complete());
+}
+
+BOOST_AUTO_TEST_CASE(chunked_in_one_piece)
+{
+  ResponseBodyFraming framing(ResponseBodyFraming::Mode::CHUNKED, 0);
+  BOOST_CHECK(feed(framing, "5\r\nhello\r\n6;ext=1\r\n world\r\n0\r\n\r\n"));
+  BOOST_CHECK(!framing.overrun());
+}
+
+BOOST_AUTO_TEST_CASE(chunked_byte_by_byte)
+{
+  const std::string body = "a\r\n0123456789\r\n1A\r\nabcdefghijklmnopqrstuvwxyz\r\n0\r\nX-Trailer: "
+                           "yes\r\n\r\n";
+  ResponseBodyFraming framing(ResponseBodyFraming::Mode::CHUNKED, 0);
+  for (std::size_t i = 0; i + 1 < body.size(); i++)
+    BOOST_CHECK(!framing.consume(&body[i], 1));
+  BOOST_CHECK(framing.consume(&body.back(), 1));
+  BOOST_CHECK(!framing.overrun());
+}
+
+BOOST_AUTO_TEST_CASE(chunked_garbled)
+{
+  ResponseBodyFraming framing(ResponseBodyFraming::Mode::CHUNKED, 0);
+  BOOST_CHECK(!feed(framing, "xyz\r\n"));
+  BOOST_CHECK(!framing.delimited());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
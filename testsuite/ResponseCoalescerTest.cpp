@@ -0,0 +1,167 @@
+#include "../frontend/ResponseCoalescer.h"
+#include <boost/test/included/unit_test.hpp>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace boost::unit_test;
+using SmartMet::CoalescedResponse;
+using SmartMet::ResponseCoalescer;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Response coalescer tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+using Status = CoalescedResponse::Status;
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(ResponseCoalescerTests)
+
+BOOST_AUTO_TEST_CASE(first_request_leads)
+{
+  ResponseCoalescer coalescer;
+  auto leader = coalescer.join("a");
+  auto follower = coalescer.join("a");
+  auto other = coalescer.join("b");
+
+  BOOST_CHECK(leader.second);
+  BOOST_CHECK(!follower.second);
+  BOOST_CHECK(other.second);
+  BOOST_CHECK(leader.first == follower.first);
+
+  // A closed response is not joined any more
+  coalescer.close("a", leader.first);
+  auto late = coalescer.join("a");
+  BOOST_CHECK(late.second);
+  BOOST_CHECK(late.first != leader.first);
+}
+
+BOOST_AUTO_TEST_CASE(followers_read_from_the_beginning)
+{
+  CoalescedResponse response;
+  std::size_t index = 0;
+  std::vector<std::string> chunks;
+
+  BOOST_CHECK(response.read(index, chunks) == Status::PENDING);
+  BOOST_CHECK(chunks.empty());
+
+  response.append("abc");
+  response.append("de");
+  BOOST_CHECK(response.read(index, chunks) == Status::STREAMING);
+  BOOST_CHECK_EQUAL(chunks.size(), 2);
+  BOOST_CHECK_EQUAL(index, 2);
+  BOOST_CHECK_EQUAL(response.size(), 5);
+
+  chunks.clear();
+  response.append("f");
+  response.end(true);
+  BOOST_CHECK(response.read(index, chunks) == Status::FINISHED);
+  BOOST_CHECK_EQUAL(chunks.size(), 1);
+  BOOST_CHECK_EQUAL(chunks[0], "f");
+
+  std::size_t late = 0;
+  chunks.clear();
+  BOOST_CHECK(response.read(late, chunks) == Status::FINISHED);
+  BOOST_CHECK_EQUAL(chunks.size(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(end_without_data_is_not_shared)
+{
+  CoalescedResponse response;
+  response.end(true);
+
+  std::size_t index = 0;
+  std::vector<std::string> chunks;
+  BOOST_CHECK(response.read(index, chunks) == Status::NOT_SHARED);
+
+  CoalescedResponse failed;
+  failed.append("abc");
+  failed.end(false);
+  BOOST_CHECK(failed.read(index, chunks) == Status::FAILED);
+}
+
+BOOST_AUTO_TEST_CASE(listeners_are_notified)
+{
+  CoalescedResponse response;
+
+  int calls = 0;
+  response.subscribe([&calls] { ++calls; });
+  response.subscribe([&calls] { ++calls; });
+
+  response.append("");
+  BOOST_CHECK_EQUAL(calls, 0);
+  response.append("abc");
+  BOOST_CHECK_EQUAL(calls, 2);
+  response.end(true);
+  BOOST_CHECK_EQUAL(calls, 4);
+}
+
+BOOST_AUTO_TEST_CASE(listener_may_read)
+{
+  CoalescedResponse response;
+  std::size_t index = 0;
+  std::vector<std::string> chunks;
+
+  // Would deadlock if the response was locked during the call
+  response.subscribe([&] { response.read(index, chunks); });
+  response.append("abc");
+  BOOST_CHECK_EQUAL(chunks.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(follower_waits_without_polling)
+{
+  CoalescedResponse response;
+
+  std::mutex mutex;
+  std::condition_variable event;
+  std::size_t index = 0;
+  std::vector<std::string> chunks;
+  int wakeups = 0;
+
+  response.subscribe(
+      [&]
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        event.notify_one();
+      });
+
+  std::thread follower(
+      [&]
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto status = Status::PENDING;
+        while (status == Status::PENDING || status == Status::STREAMING)
+        {
+          event.wait(lock);
+          ++wakeups;
+          status = response.read(index, chunks);
+        }
+      });
+
+  // Give the follower time to start waiting, the leader is slow
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    BOOST_CHECK_EQUAL(wakeups, 0);
+  }
+
+  response.append("abc");
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  response.end(true);
+  follower.join();
+
+  BOOST_CHECK_EQUAL(chunks.size(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
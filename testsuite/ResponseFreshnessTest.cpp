@@ -0,0 +1,91 @@
+#include "../frontend/ResponseFreshness.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::ResponseFreshness;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Response freshness tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+// Sun, 06 Nov 1994 08:49:37 GMT
+const std::time_t now = 784111777;
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(ResponseFreshnessTests)
+
+BOOST_AUTO_TEST_CASE(http_date)
+{
+  BOOST_CHECK_EQUAL(ResponseFreshness::parseHttpDate("Sun, 06 Nov 1994 08:49:37 GMT"), now);
+  BOOST_CHECK_EQUAL(ResponseFreshness::parseHttpDate("0"), -1);
+  BOOST_CHECK_EQUAL(ResponseFreshness::parseHttpDate(""), -1);
+}
+
+BOOST_AUTO_TEST_CASE(no_headers)
+{
+  auto freshness = ResponseFreshness::parse("", "", now);
+  BOOST_CHECK_EQUAL(freshness.freshUntil, now);
+  BOOST_CHECK_EQUAL(freshness.staleWhileRevalidate, -1);
+  BOOST_CHECK_EQUAL(freshness.staleIfError, -1);
+  BOOST_CHECK(!freshness.mustRevalidate);
+}
+
+BOOST_AUTO_TEST_CASE(expires)
+{
+  auto freshness = ResponseFreshness::parse("", "Sun, 06 Nov 1994 08:50:37 GMT", now);
+  BOOST_CHECK_EQUAL(freshness.freshUntil, now + 60);
+
+  // Already expired or invalid
+  freshness = ResponseFreshness::parse("", "Sun, 06 Nov 1994 08:48:37 GMT", now);
+  BOOST_CHECK_EQUAL(freshness.freshUntil, now);
+  freshness = ResponseFreshness::parse("", "0", now);
+  BOOST_CHECK_EQUAL(freshness.freshUntil, now);
+}
+
+BOOST_AUTO_TEST_CASE(max_age_overrides_expires)
+{
+  auto freshness =
+      ResponseFreshness::parse("public, max-age=300", "Sun, 06 Nov 1994 08:50:37 GMT", now);
+  BOOST_CHECK_EQUAL(freshness.freshUntil, now + 300);
+
+  freshness = ResponseFreshness::parse("max-age=300, s-maxage=30", "", now);
+  BOOST_CHECK_EQUAL(freshness.freshUntil, now + 30);
+}
+
+BOOST_AUTO_TEST_CASE(stale_extensions)
+{
+  auto freshness = ResponseFreshness::parse(
+      "max-age=60, stale-while-revalidate=30, stale-if-error=86400", "", now);
+  BOOST_CHECK_EQUAL(freshness.freshUntil, now + 60);
+  BOOST_CHECK_EQUAL(freshness.staleWhileRevalidate, 30);
+  BOOST_CHECK_EQUAL(freshness.staleIfError, 86400);
+}
+
+BOOST_AUTO_TEST_CASE(revalidation_required)
+{
+  auto freshness = ResponseFreshness::parse("no-cache, max-age=60", "", now);
+  BOOST_CHECK_EQUAL(freshness.freshUntil, now);
+  BOOST_CHECK(!freshness.mustRevalidate);
+
+  // Fresh responses may be served, stale ones never
+  freshness = ResponseFreshness::parse("max-age=60, must-revalidate", "", now);
+  BOOST_CHECK_EQUAL(freshness.freshUntil, now + 60);
+  BOOST_CHECK(freshness.mustRevalidate);
+
+  freshness = ResponseFreshness::parse("private, max-age=60", "", now);
+  BOOST_CHECK_EQUAL(freshness.freshUntil, now);
+  BOOST_CHECK(freshness.mustRevalidate);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
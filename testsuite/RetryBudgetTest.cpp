@@ -0,0 +1,97 @@
+#include "../frontend/RetryBudget.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::RetryBudget;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Retry budget tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+RetryBudget::Settings settings()
+{
+  RetryBudget::Settings s;
+  s.enabled = true;
+  s.percent = 10;
+  s.minRetries = 2;
+  s.window = 10;
+  return s;
+}
+
+// A fixed starting time so that the tests do not depend on the clock
+const RetryBudget::Clock::time_point start{std::chrono::hours(1000)};
+
+RetryBudget::Clock::time_point at(int theSeconds)
+{
+  return start + std::chrono::seconds(theSeconds);
+}
+
+// Retry for as long as the budget allows
+std::size_t use_budget(RetryBudget& theBudget, RetryBudget::Clock::time_point theTime)
+{
+  std::size_t count = 0;
+  while (theBudget.canRetry(theTime))
+  {
+    theBudget.recordRetry(theTime);
+    ++count;
+  }
+  return count;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(RetryBudgetTests)
+
+BOOST_AUTO_TEST_CASE(minimum_allows_retries_without_traffic)
+{
+  RetryBudget budget(settings());
+  BOOST_CHECK_EQUAL(use_budget(budget, at(0)), 2);
+  BOOST_CHECK(!budget.canRetry(at(5)));
+
+  budget.recordRefusal();
+  const auto stats = budget.getStats();
+  BOOST_CHECK_EQUAL(stats.hits, 2);
+  BOOST_CHECK_EQUAL(stats.misses, 1);
+}
+
+BOOST_AUTO_TEST_CASE(retries_are_a_percentage_of_requests)
+{
+  RetryBudget budget(settings());
+  for (int i = 0; i < 100; i++)
+    budget.recordRequest(at(i % 5));
+
+  // The minimum plus 10% of the requests
+  BOOST_CHECK_EQUAL(use_budget(budget, at(5)), 12);
+
+  for (int i = 0; i < 9; i++)
+    budget.recordRequest(at(6));
+  BOOST_CHECK(!budget.canRetry(at(6)));
+  budget.recordRequest(at(6));
+  BOOST_CHECK(budget.canRetry(at(6)));
+}
+
+BOOST_AUTO_TEST_CASE(old_traffic_leaves_the_window)
+{
+  RetryBudget budget(settings());
+  for (int i = 0; i < 100; i++)
+    budget.recordRequest(at(0));
+  BOOST_CHECK_EQUAL(use_budget(budget, at(1)), 12);
+
+  // The requests of second 0 have left the window, the retries of second 1 have not
+  BOOST_CHECK(!budget.canRetry(at(10)));
+
+  // Everything has left the window
+  BOOST_CHECK_EQUAL(use_budget(budget, at(11)), 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,45 @@
+// Not a correctness test: reports the cost of a service route match compared to the
+// earlier matching. Built and run by 'make bench', not by 'make check'.
+
+#include "../frontend/ServiceRoute.h"
+#include "ServiceRouteCases.h"
+#include <chrono>
+#include <iostream>
+
+using SmartMet::ServiceRoute;
+using ServiceRouteCases::cases;
+using ServiceRouteCases::reference;
+
+int main()
+{
+  using Clock = std::chrono::steady_clock;
+
+  const auto all = cases(1000);
+  const int rounds = 1000;
+
+  std::size_t sum1 = 0;
+  const auto t1 = Clock::now();
+  for (int i = 0; i < rounds; i++)
+    for (const auto& c : all)
+      sum1 += reference(c.resource, c.uri, c.prefix, c.host).value_or(1);
+  const auto t2 = Clock::now();
+
+  std::size_t sum2 = 0;
+  for (int i = 0; i < rounds; i++)
+    for (const auto& c : all)
+      sum2 += ServiceRoute::match(c.resource, c.uri, c.prefix, c.host).value_or(1);
+  const auto t3 = Clock::now();
+
+  if (sum1 != sum2)
+  {
+    std::cerr << "Service route matches differ from the string building ones" << std::endl;
+    return 1;
+  }
+
+  const auto n = static_cast<double>(rounds * all.size());
+  const auto ns = [n](Clock::duration d)
+  { return std::chrono::duration<double, std::nano>(d).count() / n; };
+  std::cout << "String building: " << ns(t2 - t1) << " ns per match" << std::endl;
+  std::cout << "String views: " << ns(t3 - t2) << " ns per match" << std::endl;
+  return 0;
+}
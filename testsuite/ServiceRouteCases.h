@@ -0,0 +1,70 @@
+#pragma once
+
+// Random routing cases and the earlier string building matching, shared by the service
+// route test and benchmark
+
+#include <boost/algorithm/string.hpp>
+#include <cstddef>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace ServiceRouteCases
+{
+namespace ba = boost::algorithm;
+
+// The earlier matching which built the prefixed strings for each request
+inline std::optional<std::size_t> reference(const std::string& theResource,
+                                            const std::string& theServiceURI,
+                                            bool thePrefix,
+                                            const std::string& theHostName)
+{
+  const std::string hostPrefix = "/" + theHostName;
+  if (thePrefix)
+  {
+    if (ba::starts_with(theResource, theServiceURI))
+      return 0;
+    if (ba::starts_with(theResource, hostPrefix + "/") &&
+        ba::starts_with(theResource.substr(hostPrefix.length()), theServiceURI))
+      return hostPrefix.length();
+    return {};
+  }
+  if (theResource == theServiceURI)
+    return 0;
+  if (theResource == hostPrefix + theServiceURI)
+    return hostPrefix.length();
+  return {};
+}
+
+struct Case
+{
+  std::string resource;
+  std::string uri;
+  bool prefix;
+  std::string host;
+};
+
+inline std::vector<Case> cases(std::size_t theCount)
+{
+  const std::vector<std::string> uris = {"/wms", "/wms/tiles", "/timeseries", "/w", "/"};
+  const std::vector<std::string> hosts = {"a", "smartmet-backend-01.example.com"};
+  const std::vector<std::string> tails = {"", "/", "x", "/x?a=1"};
+
+  std::mt19937 gen(12345);
+  std::vector<Case> ret;
+  for (std::size_t i = 0; i < theCount; i++)
+  {
+    Case c;
+    c.uri = uris[gen() % uris.size()];
+    c.prefix = (gen() % 2 == 0);
+    c.host = hosts[gen() % hosts.size()];
+    if (gen() % 2 == 0)
+      c.resource = "/" + hosts[gen() % hosts.size()];
+    c.resource += uris[gen() % uris.size()] + tails[gen() % tails.size()];
+    ret.push_back(c);
+  }
+  return ret;
+}
+
+}  // namespace ServiceRouteCases
@@ -0,0 +1,56 @@
+#include "../frontend/ServiceRoute.h"
+#include "ServiceRouteCases.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::ServiceRoute;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Service route tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+using ServiceRouteCases::cases;
+using ServiceRouteCases::reference;
+
+BOOST_AUTO_TEST_SUITE(ServiceRouteTests)
+
+BOOST_AUTO_TEST_CASE(prefix_service)
+{
+  BOOST_CHECK(ServiceRoute::match("/wms", "/wms", true, "a") == std::size_t(0));
+  BOOST_CHECK(ServiceRoute::match("/wms?service=WMS", "/wms", true, "a") == std::size_t(0));
+  BOOST_CHECK(ServiceRoute::match("/a/wms/x", "/wms", true, "a") == std::size_t(2));
+  BOOST_CHECK(!ServiceRoute::match("/a/wms/x", "/wms", true, "b"));
+  BOOST_CHECK(!ServiceRoute::match("/ab/wms", "/wms", true, "a"));
+  BOOST_CHECK(!ServiceRoute::match("/wfs", "/wms", true, "a"));
+  BOOST_CHECK(!ServiceRoute::match("", "/wms", true, "a"));
+}
+
+BOOST_AUTO_TEST_CASE(exact_service)
+{
+  BOOST_CHECK(ServiceRoute::match("/timeseries", "/timeseries", false, "a") == std::size_t(0));
+  BOOST_CHECK(ServiceRoute::match("/a/timeseries", "/timeseries", false, "a") == std::size_t(2));
+  BOOST_CHECK(!ServiceRoute::match("/timeseries/x", "/timeseries", false, "a"));
+  BOOST_CHECK(!ServiceRoute::match("/timeserie", "/timeseries", false, "a"));
+  BOOST_CHECK(!ServiceRoute::match("/b/timeseries", "/timeseries", false, "a"));
+}
+
+BOOST_AUTO_TEST_CASE(same_as_string_matching)
+{
+  for (const auto& c : cases(20000))
+  {
+    const auto expected = reference(c.resource, c.uri, c.prefix, c.host);
+    const auto result = ServiceRoute::match(c.resource, c.uri, c.prefix, c.host);
+    BOOST_REQUIRE_MESSAGE(expected == result, c.resource + " for " + c.uri + " on " + c.host);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,76 @@
+#include "../frontend/SlidingWindowCounter.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::SlidingWindowCounter;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Sliding window counter tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+// A fixed starting time so that the tests do not depend on the clock
+const SlidingWindowCounter::Clock::time_point start{std::chrono::hours(1000)};
+
+SlidingWindowCounter::Clock::time_point at(int theSeconds)
+{
+  return start + std::chrono::seconds(theSeconds);
+}
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(SlidingWindowCounterTests)
+
+BOOST_AUTO_TEST_CASE(counters_are_separate)
+{
+  SlidingWindowCounter counter(10, 2);
+  counter.add(0, at(0));
+  counter.add(0, at(1));
+  counter.add(1, at(1));
+  BOOST_CHECK_EQUAL(counter.total(0, at(1)), 2);
+  BOOST_CHECK_EQUAL(counter.total(1, at(1)), 1);
+}
+
+BOOST_AUTO_TEST_CASE(old_seconds_leave_window)
+{
+  SlidingWindowCounter counter(10, 1);
+  counter.add(0, at(0));
+  counter.add(0, at(5));
+  BOOST_CHECK_EQUAL(counter.total(0, at(9)), 2);
+  BOOST_CHECK_EQUAL(counter.total(0, at(10)), 1);
+  BOOST_CHECK_EQUAL(counter.total(0, at(15)), 0);
+
+  // A slot is reused for a later second
+  counter.add(0, at(20));
+  BOOST_CHECK_EQUAL(counter.total(0, at(20)), 1);
+}
+
+BOOST_AUTO_TEST_CASE(clear_forgets_everything)
+{
+  SlidingWindowCounter counter(10, 2);
+  counter.add(0, at(0));
+  counter.add(1, at(3));
+  counter.clear();
+  BOOST_CHECK_EQUAL(counter.total(0, at(3)), 0);
+  BOOST_CHECK_EQUAL(counter.total(1, at(3)), 0);
+}
+
+BOOST_AUTO_TEST_CASE(window_has_at_least_one_second)
+{
+  SlidingWindowCounter counter(0, 1);
+  counter.add(0, at(0));
+  counter.add(0, at(0));
+  BOOST_CHECK_EQUAL(counter.total(0, at(0)), 2);
+  BOOST_CHECK_EQUAL(counter.total(0, at(1)), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
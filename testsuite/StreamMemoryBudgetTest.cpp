@@ -0,0 +1,84 @@
+#include "../frontend/StreamMemoryBudget.h"
+#include <boost/test/included/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace boost::unit_test;
+using SmartMet::StreamMemoryBudget;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Stream memory budget tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+StreamMemoryBudget::Settings settings()
+{
+  StreamMemoryBudget::Settings s;
+  s.window = 1000;
+  s.throttleWindow = 100;
+  s.totalSize = 5000;
+  return s;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(StreamMemoryBudgetTests)
+
+BOOST_AUTO_TEST_CASE(pause_beyond_the_window)
+{
+  StreamMemoryBudget budget(settings());
+
+  BOOST_CHECK(!budget.mustPause(0));
+  BOOST_CHECK(!budget.mustPause(1000));
+  BOOST_CHECK(budget.mustPause(1001));
+
+  const auto stats = budget.getStats();
+  BOOST_CHECK_EQUAL(stats.hits, 1);
+  BOOST_CHECK_EQUAL(stats.misses, 0);
+}
+
+BOOST_AUTO_TEST_CASE(slow_clients_pause_first_when_over_the_budget)
+{
+  StreamMemoryBudget budget(settings());
+
+  budget.add(5000);
+  BOOST_CHECK(!budget.exceeded());
+  BOOST_CHECK(!budget.mustPause(500));
+
+  budget.add(1);
+  BOOST_CHECK(budget.exceeded());
+
+  // Fast clients with short queues continue, the others wait
+  BOOST_CHECK(!budget.mustPause(100));
+  BOOST_CHECK(budget.mustPause(101));
+
+  const auto stats = budget.getStats();
+  BOOST_CHECK_EQUAL(stats.hits, 0);
+  BOOST_CHECK_EQUAL(stats.misses, 1);
+  BOOST_CHECK_EQUAL(stats.size, 5001);
+  BOOST_CHECK_EQUAL(stats.maxsize, 5000);
+}
+
+BOOST_AUTO_TEST_CASE(resume_once_clients_take_the_data)
+{
+  StreamMemoryBudget budget(settings());
+
+  budget.add(6000);
+  BOOST_CHECK(budget.mustPause(500));
+
+  budget.release(1000);
+  BOOST_CHECK(!budget.exceeded());
+  BOOST_CHECK(!budget.mustPause(500));
+
+  budget.release(5000);
+  BOOST_CHECK_EQUAL(budget.getStats().size, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,155 @@
+#include "../frontend/TimeoutWheel.h"
+#include <boost/test/included/unit_test.hpp>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace boost::unit_test;
+using SmartMet::TimeoutWheel;
+
+test_suite* init_unit_test_suite(int argc, char* argv[])
+{
+  const char* name = "Timeout wheel tester";
+  unit_test_log.set_threshold_level(log_messages);
+  framework::master_test_suite().p_name.value = name;
+  BOOST_TEST_MESSAGE("");
+  BOOST_TEST_MESSAGE(name);
+  BOOST_TEST_MESSAGE(std::string(std::strlen(name), '='));
+  return nullptr;
+}
+
+namespace
+{
+// 8 slots of 10 ms: a one second timeout goes around the wheel many times
+const auto tick = std::chrono::milliseconds(10);
+const std::size_t slots = 8;
+
+using std::chrono::milliseconds;
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(TimeoutWheelTests)
+
+BOOST_AUTO_TEST_CASE(armed_timeout_expires)
+{
+  boost::asio::io_context io;
+  TimeoutWheel wheel(io, tick, slots);
+
+  int fired = 0;
+  auto timeout = wheel.create([&fired] { ++fired; });
+  BOOST_CHECK(!timeout->armed());
+
+  timeout->arm(std::chrono::seconds(1));
+  BOOST_CHECK(timeout->armed());
+  BOOST_CHECK_EQUAL(wheel.size(), 1);
+
+  io.run_for(milliseconds(700));
+  BOOST_CHECK_EQUAL(fired, 0);
+  BOOST_CHECK(!timeout->expired());
+
+  io.run_for(milliseconds(600));
+  BOOST_CHECK_EQUAL(fired, 1);
+  BOOST_CHECK(timeout->expired());
+  BOOST_CHECK_EQUAL(wheel.size(), 0);
+
+  wheel.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(activity_postpones_expiry)
+{
+  boost::asio::io_context io;
+  TimeoutWheel wheel(io, tick, slots);
+
+  int fired = 0;
+  auto timeout = wheel.create([&fired] { ++fired; });
+  timeout->arm(std::chrono::seconds(1));
+
+  io.run_for(milliseconds(600));
+  timeout->touch();
+
+  // Past the original deadline, the entry is moved to the new one
+  io.run_for(milliseconds(700));
+  BOOST_CHECK_EQUAL(fired, 0);
+  BOOST_CHECK_EQUAL(wheel.size(), 1);
+
+  io.run_for(milliseconds(600));
+  BOOST_CHECK_EQUAL(fired, 1);
+
+  wheel.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(disarmed_timeout_does_not_fire)
+{
+  boost::asio::io_context io;
+  TimeoutWheel wheel(io, tick, slots);
+
+  int fired = 0;
+  auto timeout = wheel.create([&fired] { ++fired; });
+  timeout->arm(std::chrono::seconds(1));
+  timeout->disarm();
+
+  io.run_for(milliseconds(1300));
+  BOOST_CHECK_EQUAL(fired, 0);
+  BOOST_CHECK_EQUAL(wheel.size(), 0);
+
+  wheel.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(handler_may_rearm)
+{
+  boost::asio::io_context io;
+  TimeoutWheel wheel(io, tick, slots);
+
+  int fired = 0;
+  std::shared_ptr<TimeoutWheel::Timeout> timeout;
+  timeout = wheel.create(
+      [&]
+      {
+        if (++fired == 1)
+          timeout->arm(std::chrono::seconds(1));
+      });
+  timeout->arm(std::chrono::seconds(1));
+
+  io.run_for(milliseconds(1300));
+  BOOST_CHECK_EQUAL(fired, 1);
+  io.run_for(milliseconds(1000));
+  BOOST_CHECK_EQUAL(fired, 2);
+
+  wheel.shutdown();
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_arming)
+{
+  boost::asio::io_context io;
+  TimeoutWheel wheel(io, milliseconds(1), slots);
+
+  std::atomic<int> fired{0};
+  std::vector<std::shared_ptr<TimeoutWheel::Timeout>> timeouts;
+  for (int i = 0; i < 64; i++)
+    timeouts.push_back(wheel.create([&fired] { ++fired; }));
+
+  // The wheel ticks on its own thread while the others keep arming
+  std::thread ticker([&io] { io.run_for(milliseconds(500)); });
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++)
+    threads.emplace_back(
+        [&timeouts, t]
+        {
+          for (int round = 0; round < 2000; round++)
+            for (std::size_t i = t; i < timeouts.size(); i += 4)
+              timeouts[i]->arm(std::chrono::seconds(1 + round % 3));
+        });
+  for (auto& thread : threads)
+    thread.join();
+  ticker.join();
+
+  BOOST_CHECK_EQUAL(fired, 0);
+  BOOST_CHECK_EQUAL(wheel.size(), timeouts.size());
+
+  wheel.shutdown();
+  BOOST_CHECK_EQUAL(wheel.size(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()